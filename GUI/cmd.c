@@ -11,6 +11,17 @@ static gboolean all_digits (char* string) {
   return TRUE;
 }
 
+// Markowanie gracza na liście
+
+void mark_eliminated (int index) {
+  char buf[66];
+
+  memset(buf, 0, sizeof(buf));
+  strcpy(buf, kolgracz[index].player);
+  strcat(buf, " X");
+  gtk_label_set_text(GTK_LABEL(kolgracz[index].label), buf);
+}
+
 int process_command (int numtok, char *tokens[]) {
   if (strcmp(tokens[0], "NEW_GAME") == 0 && numtok > 4) {
     if (!all_digits(tokens[1]) || !all_digits(tokens[2]))
@@ -46,6 +57,7 @@ int process_command (int numtok, char *tokens[]) {
       gtk_box_pack_start(GTK_BOX(player_box), label, FALSE, FALSE, 3);
       gtk_widget_show(label);
     }
+    index_players();
 #ifdef DEBUG
     fprintf(stderr, "NEW_GAME command accepted\n");
 #endif
@@ -54,9 +66,45 @@ int process_command (int numtok, char *tokens[]) {
   else if (strcmp(tokens[0], "PIXEL") == 0) {
     // Rysowanie kolejnego punktu
     if (numtok == 4 && all_digits(tokens[1]) && all_digits(tokens[2])) {
-      draw_brush(drawing_area, atoi(tokens[1]), atoi(tokens[2]), tokens[3]);
+      draw_pixels(drawing_area, 1, tokens + 1);
 #ifdef DEBUG
       fprintf(stderr, "PIXEL command accepted\n");
+#endif
+      return 1;
+    }
+    else return 0;
+  }
+  else if (strcmp(tokens[0], "PIXELS") == 0) {
+    // Rysowanie serii punktów (trójki x y gracz), zwykle z jednego datagramu
+    if (numtok >= 4 && (numtok - 1) % 3 == 0) {
+      for (int i = 1; i < numtok; i += 3)
+        if (!all_digits(tokens[i]) || !all_digits(tokens[i + 1]))
+          return 0;
+      draw_pixels(drawing_area, (numtok - 1) / 3, tokens + 1);
+#ifdef DEBUG
+      fprintf(stderr, "PIXELS command accepted\n");
+#endif
+      return 1;
+    }
+    else return 0;
+  }
+  else if (strcmp(tokens[0], "ERASE") == 0) {
+    // Wymazywanie punktów (pary x y) narysowanych przez klienta na zapas,
+    // których serwer nie potwierdził
+    if (numtok >= 3 && (numtok - 1) % 2 == 0) {
+      int count = (numtok - 1) / 2;
+      Punkt points[count];
+
+      for (int i = 0; i < count; i++) {
+        if (!all_digits(tokens[2 * i + 1]) || !all_digits(tokens[2 * i + 2]))
+          return 0;
+        points[i].x = atoi(tokens[2 * i + 1]);
+        points[i].y = atoi(tokens[2 * i + 2]);
+        points[i].index = -1;
+      }
+      erase_points(drawing_area, count, points);
+#ifdef DEBUG
+      fprintf(stderr, "ERASE command accepted\n");
 #endif
       return 1;
     }
@@ -66,12 +114,10 @@ int process_command (int numtok, char *tokens[]) {
     // Markowanie gracza
     if (numtok == 2) {
       int index = find_player_index(tokens[1]);
-      char buf[66];
 
-      memset(buf, 0, sizeof(buf));
-      strcpy(buf, tokens[1]);
-      strcat(buf, " X");
-      gtk_label_set_text(GTK_LABEL(kolgracz[index].label), buf);
+      if (index < 0)
+        return 0;
+      mark_eliminated(index);
 #ifdef DEBUG
       fprintf(stderr, "PLAYER_ELIMINATED command accepted\n");
 #endif
@@ -17,9 +17,16 @@ extern int gsock;
 typedef struct {
   char player[65];
   GdkColor color;
+  guint32 pixel;  // kolor w formacie powierzchni CAIRO_FORMAT_RGB24
   GtkWidget *label;
 } KolGracz;
 
+// Punkt do narysowania, index to indeks w tablicy opisów graczy (-1 pomija)
+
+typedef struct {
+  int x, y, index;
+} Punkt;
+
 // Maks. liczba graczy
 
 #define MAX_PLAYER 20
@@ -34,8 +41,22 @@ extern int ilgracz;
 extern GtkWidget *player_box;
 
 extern int find_player_index (char *player);
-extern void draw_brush (GtkWidget *widget, gdouble x, gdouble y, char *player);
+extern void index_players (void);
+extern void draw_pixels (GtkWidget *widget, int count, char *tokens[]);
+extern void draw_points (GtkWidget *widget, int count, Punkt points[]);
+extern void erase_points (GtkWidget *widget, int count, Punkt points[]);
+extern void mark_eliminated (int index);
+extern void process_line (char *line);
 
 extern int process_command (int numtok, char *tokens[]);
 
 extern int init_net (unsigned short port);
+
+// Pierścień w pamięci współdzielonej od lokalnego klienta (ring.c)
+
+extern int init_ring_listener (unsigned short port);
+extern gboolean ring_accept (GIOChannel *source, GIOCondition condition,
+                             gpointer data);
+extern gboolean ring_callback (GIOChannel *source, GIOCondition condition,
+                               gpointer data);
+extern void drain_ring (void);
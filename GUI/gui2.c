@@ -5,21 +5,26 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <glib.h>
 #include <gdk/gdkkeysyms-compat.h>
 #include <gtk/gtk.h>
 
 #include "err.h"
-#include "read_line.h"
 #include "gui.h"
 
 // Maks. długość komunikatu
 
 #define BUFFER_SIZE 2000
 
-// Maks. liczba niepustych tokenów w komunikacie wejściowym
+// Maks. liczba niepustych tokenów w komunikacie wejściowym (PIXELS niesie
+// do 40 trójek x y gracz)
 
-#define MAX_TOKENS 30
+#define MAX_TOKENS 128
+
+// Rozmiar bufora odbiorczego; jednorazowo czytamy wiele linii
+
+#define INPUT_SIZE 65536
 
 int gsock = -1;  // gniazdko do poleceń
 
@@ -67,15 +72,36 @@ void init_colors () {
     if (!gdk_color_parse(colors[i], &color))
       syserr("Invalid color spec");
     kolgracz[i].color = color;
+    kolgracz[i].pixel = ((guint32)(color.red >> 8) << 16)
+                        | ((guint32)(color.green >> 8) << 8)
+                        | (guint32)(color.blue >> 8);
   }
 }
 
+// Słownik nazwa gracza -> indeks w tablicy opisów
+
+static GHashTable *player_index = NULL;
+
+// Budowanie słownika graczy bieżącej partii
+
+void index_players (void) {
+  if (player_index == NULL)
+    player_index = g_hash_table_new(g_str_hash, g_str_equal);
+  else
+    g_hash_table_remove_all(player_index);
+
+  for (int i = 0; i < ilgracz; i++)
+    g_hash_table_insert(player_index, kolgracz[i].player, GINT_TO_POINTER(i));
+}
+
 // Szukanie opisu gracza po nazwie, zwraca indeks w tablicy opisów
 
 int find_player_index (char *player) {
-  for (int i = 0; i < ilgracz; i++)
-    if (strncmp(kolgracz[i].player, player, 64) == 0)  //z protokołu
-      return i;
+  gpointer index;
+
+  if (player_index != NULL
+      && g_hash_table_lookup_extended(player_index, player, NULL, &index))
+    return GPOINTER_TO_INT(index);
 #ifdef DEBUG
   fprintf(stderr, "Brak gracza w tablicy");
 #endif
@@ -100,19 +126,40 @@ int remove_empty_tokens (char *tokens[], char *result[]) {
   return j;
 }
 
-// Okresowy callback do komunikacji z siecią
+// Przetwarzanie jednej linii od klienta
+
+void process_line (char *line) {
+  char **raw_tokens, *tokens[MAX_TOKENS + 1];
+  int numtok;
+
+#ifdef DEBUG
+  fprintf(stderr, "Command:%s\n", line);
+#endif
+  raw_tokens = g_strsplit_set(line, " \t\n\r", 0);
+  numtok = remove_empty_tokens(raw_tokens, tokens);
+
+  if (numtok > 0)
+    process_command(numtok, tokens);
+  g_strfreev(raw_tokens);
+}
+
+// Odebrane, jeszcze nieprzetworzone dane od klienta
+
+static char input[INPUT_SIZE];
+static size_t input_len = 0;
+
+// Okresowy callback do komunikacji z siecią; przetwarza wszystkie pełne
+// linie, które już nadeszły, a niepełną końcówkę zostawia na później
 
 gboolean idle_callback (gpointer data) {
   if (started) {
-    char buffer[BUFFER_SIZE];
     ssize_t len;
+    size_t start = 0;
+    char *end;
 
-    memset(buffer, 0, sizeof(buffer));
-    len = readLine(gsock, buffer, sizeof(buffer));
+    len = read(gsock, input + input_len, sizeof(input) - input_len);
     if (len < 0) {
-      if (errno == EAGAIN || errno == EWOULDBLOCK)
-        return G_SOURCE_CONTINUE;
-      else
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
         syserr("reading error");
     }
     else if (len == 0) {
@@ -122,18 +169,25 @@ gboolean idle_callback (gpointer data) {
       close(gsock);
       exit(1);
     }
-    else {
-      char **raw_tokens, *tokens[MAX_TOKENS + 1];
-      int numtok;
+    else
+      input_len += len;
 
-#ifdef DEBUG
-      fprintf(stderr, "Command:%s\n", buffer);
-#endif
-      raw_tokens = g_strsplit_set(buffer, " \t\n\r", 0);
-      numtok = remove_empty_tokens(raw_tokens, tokens);
+    while ((end = memchr(input + start, '\n', input_len - start)) != NULL) {
+      *end = '\0';
+      process_line(input + start);
+      start = end - input + 1;
+    }
 
-      process_command(numtok, tokens);
+    // Linia dłuższa niż cały bufor jest odrzucana
+    if (start == 0 && input_len == sizeof(input))
+      input_len = 0;
+    else {
+      memmove(input, input + start, input_len - start);
+      input_len -= start;
     }
+
+    // Pierścień od lokalnego klienta, gdy eventfd nie obudził
+    drain_ring();
   }
   return G_SOURCE_CONTINUE;
 }
@@ -211,8 +265,14 @@ gint keyboard_event (GtkWidget *widget, GdkEventKey *event, gpointer data) {
 
 cairo_surface_t *surface = NULL;
 
+// Indeks gracza, którego punkt leży w danym miejscu kopii (-1 - brak);
+// pozwala odtworzyć sąsiednie punkty przy wymazywaniu
+
+static int *owner = NULL;
+
 // Inicjowanie kopii pola gry nowym rozmiarem pola.  Uwaga: nie zachowuje 
-// dotychczasowej zawartości => pole gry zostanie wyczyszczone.
+// dotychczasowej zawartości => pole gry zostanie wyczyszczone.  Kopia jest
+// powierzchnią w pamięci, żeby punkty można było wpisywać bezpośrednio.
 
 gboolean configure_event (GtkWidget *widget, GdkEventConfigure *event,
                           gpointer data) {
@@ -223,10 +283,9 @@ gboolean configure_event (GtkWidget *widget, GdkEventConfigure *event,
     cairo_surface_destroy(surface);
 
   gtk_widget_get_allocation(widget, &allocation);
-  surface = gdk_window_create_similar_surface(gtk_widget_get_window(widget),
-                                              CAIRO_CONTENT_COLOR,
-                                              allocation.width,
-                                              allocation.height);
+  surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+                                       allocation.width,
+                                       allocation.height);
 
   // Czyszczenie tła
   cr = cairo_create(surface);
@@ -234,6 +293,11 @@ gboolean configure_event (GtkWidget *widget, GdkEventConfigure *event,
   cairo_paint(cr);
   cairo_destroy(cr);
 
+  g_free(owner);
+  owner = g_new(int, allocation.width * allocation.height);
+  for (int i = 0; i < allocation.width * allocation.height; i++)
+    owner[i] = -1;
+
   return TRUE;
 }
 
@@ -251,26 +315,127 @@ gboolean expose_event (GtkWidget *widget, GdkEventExpose *event,
   return FALSE;
 }
 
-// Rysowanie nowego punktu w polu gry (mały kwadrat wygląda lepiej)
+// Rysowanie serii nowych punktów w polu gry (mały kwadrat wygląda lepiej).
+// Punkty wpisujemy wprost do pamięci kopii pola gry, a do odrysowania
+// zgłaszamy jeden wspólny region na całą serię.
+
+void draw_points (GtkWidget *widget, int count, Punkt points[]) {
+  unsigned char *pixels;
+  int stride, width, height;
+  GdkRegion *damage;
+
+  if (surface == NULL || count == 0)
+    return;
+
+  cairo_surface_flush(surface);
+  pixels = cairo_image_surface_get_data(surface);
+  stride = cairo_image_surface_get_stride(surface);
+  width = cairo_image_surface_get_width(surface);
+  height = cairo_image_surface_get_height(surface);
+  damage = gdk_region_new();
+
+  for (int i = 0; i < count; i++) {
+    int x = points[i].x;
+    int y = points[i].y;
+    GdkRectangle brush;
+
+    if (points[i].index < 0)
+      continue;
+
+    // Kwadrat 3x3 wokół punktu, przycięty do rozmiaru kopii
+    brush.x = MAX(x - 1, 0);
+    brush.y = MAX(y - 1, 0);
+    brush.width = MIN(x + 2, width) - brush.x;
+    brush.height = MIN(y + 2, height) - brush.y;
+    if (brush.width <= 0 || brush.height <= 0)
+      continue;
+
+    for (int row = brush.y; row < brush.y + brush.height; row++) {
+      guint32 *line = (guint32 *)(pixels + row * stride);
+
+      for (int col = brush.x; col < brush.x + brush.width; col++)
+        line[col] = kolgracz[points[i].index].pixel;
+    }
+    if (x >= 0 && x < width && y >= 0 && y < height)
+      owner[y * width + x] = points[i].index;
+    gdk_region_union_with_rect(damage, &brush);
+  }
+
+  cairo_surface_mark_dirty(surface);
+  if (!gdk_region_empty(damage) && gtk_widget_get_window(widget) != NULL)
+    gdk_window_invalidate_region(gtk_widget_get_window(widget), damage, FALSE);
+  gdk_region_destroy(damage);
+}
+
+// Wymazywanie serii punktów narysowanych przez klienta na zapas.  Kwadrat
+// wokół punktu dostaje kolor sąsiedniego punktu, który został, albo tło.
+
+void erase_points (GtkWidget *widget, int count, Punkt points[]) {
+  unsigned char *pixels;
+  int stride, width, height;
+  GdkRegion *damage;
+
+  if (surface == NULL || count == 0)
+    return;
+
+  cairo_surface_flush(surface);
+  pixels = cairo_image_surface_get_data(surface);
+  stride = cairo_image_surface_get_stride(surface);
+  width = cairo_image_surface_get_width(surface);
+  height = cairo_image_surface_get_height(surface);
+  damage = gdk_region_new();
+
+  for (int i = 0; i < count; i++)
+    if (points[i].x >= 0 && points[i].x < width
+        && points[i].y >= 0 && points[i].y < height)
+      owner[points[i].y * width + points[i].x] = -1;
+
+  for (int i = 0; i < count; i++) {
+    int x = points[i].x;
+    int y = points[i].y;
+    GdkRectangle brush;
+
+    brush.x = MAX(x - 1, 0);
+    brush.y = MAX(y - 1, 0);
+    brush.width = MIN(x + 2, width) - brush.x;
+    brush.height = MIN(y + 2, height) - brush.y;
+    if (brush.width <= 0 || brush.height <= 0)
+      continue;
+
+    for (int row = brush.y; row < brush.y + brush.height; row++) {
+      guint32 *line = (guint32 *)(pixels + row * stride);
+
+      for (int col = brush.x; col < brush.x + brush.width; col++) {
+        guint32 pixel = 0xffffff;
+
+        // Kwadrat pozostałego punktu w odległości 1 zakrywa to miejsce
+        for (int r = MAX(row - 1, 0); r <= MIN(row + 1, height - 1); r++)
+          for (int c = MAX(col - 1, 0); c <= MIN(col + 1, width - 1); c++)
+            if (owner[r * width + c] >= 0)
+              pixel = kolgracz[owner[r * width + c]].pixel;
+        line[col] = pixel;
+      }
+    }
+    gdk_region_union_with_rect(damage, &brush);
+  }
 
-void draw_brush (GtkWidget *widget, gdouble x, gdouble y, char* player) {
-  int index = find_player_index(player);
+  cairo_surface_mark_dirty(surface);
+  if (!gdk_region_empty(damage) && gtk_widget_get_window(widget) != NULL)
+    gdk_window_invalidate_region(gtk_widget_get_window(widget), damage, FALSE);
+  gdk_region_destroy(damage);
+}
 
-  if (index >= 0) {
-    cairo_t *cr = cairo_create(surface);
-    GdkColor color = kolgracz[index].color;
+// Rysowanie serii punktów z polecenia tekstowego (trójki x y gracz)
 
-    gdk_cairo_set_source_color(cr, &color);
-    cairo_rectangle(cr, (x - 1.0), (y - 1.0), 3.0, 3.0);
-    cairo_fill(cr);
-    cairo_destroy(cr);
+void draw_pixels (GtkWidget *widget, int count, char *tokens[]) {
+  Punkt points[MAX_TOKENS / 3];
 
-    gtk_widget_queue_draw_area(widget,
-                               (int)(x - 1.0),
-                               (int)(y - 1.0),
-                               3,
-                               3);
+  for (int i = 0; i < count; i++) {
+    points[i].x = atoi(tokens[3 * i]);
+    points[i].y = atoi(tokens[3 * i + 1]);
+    points[i].index = find_player_index(tokens[3 * i + 2]);
   }
+  draw_points(widget, count, points);
 }
 
 // Obecnie nie używana.
@@ -301,6 +466,7 @@ gint main (gint argc, gchar *argv[]) {
   GtkWidget *event_box;
   GtkWidget *button;
   int idle_id;
+  int ring_listener;
 
   unsigned short port = 20210;  //default
 
@@ -308,6 +474,8 @@ gint main (gint argc, gchar *argv[]) {
   if (argc > 1)
     port = atoi(argv[1]);
 
+  // Gniazdo do negocjacji pierścienia musi istnieć przed połączeniem TCP
+  ring_listener = init_ring_listener(port);
   init_net(port);
 
   // Inicjowanie Gtk, automatyczne obrobienie gtk-related opcji
@@ -317,6 +485,11 @@ gint main (gint argc, gchar *argv[]) {
 
   // Ustawienie callbacka dla idle
   idle_id = g_timeout_add(1, idle_callback, &started);
+
+  // Callback dla lokalnego klienta proponującego pierścień
+  if (ring_listener >= 0)
+    g_io_add_watch(g_io_channel_unix_new(ring_listener), G_IO_IN,
+                   ring_accept, NULL);
   
   // Utworzenie głównego okna aplikacji
   window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+
+#include "err.h"
+#include "gui.h"
+#include "shm_ring.h"
+
+// Maks. liczba rekordów przetwarzanych w jednym wywołaniu (GUI ma reagować)
+
+#define MAX_RECORDS_PER_CALL 4096
+
+// Maks. liczba punktów rysowanych jednym wywołaniem draw_points
+
+#define MAX_POINTS 1024
+
+extern gboolean started;
+
+static int ring_listener = -1;  // gniazdo uniksowe do negocjacji
+static int ring_event = -1;  // eventfd od klienta
+static int ring_space = -1;  // eventfd do klienta o zwolnionym miejscu
+static shm_ring_header *ring = NULL;  // pierścień od klienta
+
+// Gniazdo uniksowe w przestrzeni abstrakcyjnej; brak gniazda nie jest
+// błędem, klient wtedy zostaje przy TCP
+
+int init_ring_listener (unsigned short port) {
+  struct sockaddr_un address;
+  socklen_t address_len;
+
+  ring_listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (ring_listener < 0)
+    return -1;
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  snprintf(address.sun_path + 1, sizeof(address.sun_path) - 1,
+           SHM_RING_SOCKET_FORMAT, port);
+  address_len = offsetof(struct sockaddr_un, sun_path) + 1
+                + strlen(address.sun_path + 1);
+
+  if (bind(ring_listener, (struct sockaddr *)&address, address_len) < 0
+      || listen(ring_listener, 1) < 0) {
+    close(ring_listener);
+    ring_listener = -1;
+  }
+  return ring_listener;
+}
+
+// Odbiór memfd i obu eventfd od klienta, zwraca 0 po przyjęciu pierścienia
+
+static int receive_ring (int conn) {
+  char buf[16];
+  struct iovec iov = {buf, sizeof(buf)};
+  char control[CMSG_SPACE(3 * sizeof(int))];
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  struct stat st;
+  int fds[3];
+  void *mapped;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  if (recvmsg(conn, &msg, 0) <= 0)
+    return -1;
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS
+      || cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+    return -1;
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+  if (fstat(fds[0], &st) < 0 || st.st_size != (off_t)SHM_RING_MAP_SIZE) {
+    close(fds[0]);
+    close(fds[1]);
+    close(fds[2]);
+    return -1;
+  }
+
+  mapped = mmap(NULL, SHM_RING_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                fds[0], 0);
+  close(fds[0]);
+  if (mapped == MAP_FAILED) {
+    close(fds[1]);
+    close(fds[2]);
+    return -1;
+  }
+  if (((shm_ring_header *)mapped)->data_size != SHM_RING_DATA_SIZE) {
+    munmap(mapped, SHM_RING_MAP_SIZE);
+    close(fds[1]);
+    close(fds[2]);
+    return -1;
+  }
+
+  ring = mapped;
+  ring_event = fds[1];
+  ring_space = fds[2];
+  fcntl(ring_event, F_SETFL, O_NONBLOCK);
+  fcntl(ring_space, F_SETFL, O_NONBLOCK);
+  g_io_add_watch(g_io_channel_unix_new(ring_event), G_IO_IN, ring_callback, NULL);
+  return 0;
+}
+
+// Callback dla gniazda negocjacji: przyjmujemy tylko jeden pierścień
+
+gboolean ring_accept (GIOChannel *source, GIOCondition condition,
+                      gpointer data) {
+  int conn = accept(ring_listener, NULL, NULL);
+
+  if (conn < 0)
+    return G_SOURCE_CONTINUE;
+
+  if (ring == NULL && receive_ring(conn) == 0) {
+    if (write(conn, SHM_RING_ACCEPTED, strlen(SHM_RING_ACCEPTED)) < 0)
+      syserr("writing to ring socket");
+#ifdef DEBUG
+    fprintf(stderr, "Shared memory ring accepted\n");
+#endif
+  }
+  close(conn);
+  return G_SOURCE_CONTINUE;
+}
+
+// Klient, który zastał pełny pierścień, czeka na ten sygnał z ponowieniem zapisu
+
+static void signal_space (int records) {
+  uint64_t value = 1;
+
+  if (records > 0 && shm_ring_should_signal_space(ring)
+      && write(ring_space, &value, sizeof(value)) < 0 && errno != EAGAIN)
+    syserr("writing ring space event");
+}
+
+// Przetwarzanie rekordów z pierścienia; kolejne punkty rysowane są razem
+
+void drain_ring (void) {
+  static Punkt points[MAX_POINTS];
+  int count = 0;
+  int records = 0;
+  shm_ring_record *record;
+
+  if (ring == NULL || !started)
+    return;
+
+  while (records < MAX_RECORDS_PER_CALL) {
+    while (records < MAX_RECORDS_PER_CALL && (record = shm_ring_peek(ring)) != NULL) {
+      records++;
+      if (record->type == SHM_RING_PIXEL) {
+        shm_ring_pixel *pixel = (shm_ring_pixel *)record;
+
+        if (count == MAX_POINTS) {
+          draw_points(drawing_area, count, points);
+          count = 0;
+        }
+        points[count].index = record->player < ilgracz ? record->player : -1;
+        points[count].x = pixel->x;
+        points[count].y = pixel->y;
+        count++;
+      }
+      else {
+        // Punkty sprzed innego polecenia muszą być już narysowane
+        draw_points(drawing_area, count, points);
+        count = 0;
+
+        if (record->type == SHM_RING_ELIMINATED) {
+          if (record->player < ilgracz)
+            mark_eliminated(record->player);
+        }
+        else if (record->type == SHM_RING_LINE) {
+          char line[record->len - sizeof(shm_ring_record) + 1];
+
+          memcpy(line, record + 1, record->len - sizeof(shm_ring_record));
+          line[record->len - sizeof(shm_ring_record)] = '\0';
+          process_line(line);
+        }
+      }
+      shm_ring_consume(ring, record);
+    }
+
+    // Usypiamy się tylko po opróżnieniu pierścienia
+    if (records == MAX_RECORDS_PER_CALL || !shm_ring_prepare_wait(ring))
+      break;
+  }
+  draw_points(drawing_area, count, points);
+  signal_space(records);
+}
+
+// Callback dla eventfd; przed startem rozgrywki tylko kasuje licznik
+
+gboolean ring_callback (GIOChannel *source, GIOCondition condition,
+                        gpointer data) {
+  uint64_t value;
+
+  if (read(ring_event, &value, sizeof(value)) < 0
+      && errno != EAGAIN && errno != EWOULDBLOCK)
+    syserr("reading ring event");
+  drain_ring();
+  return G_SOURCE_CONTINUE;
+}
+
+/*EOF*/
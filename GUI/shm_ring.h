@@ -0,0 +1,158 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+// Pierścień w pamięci współdzielonej między klientem a lokalnym GUI: jeden
+// piszący (klient) i jeden czytający (GUI).  Klient tworzy memfd z
+// nagłówkiem i danymi oraz dwa eventfd: do budzenia GUI i do zgłaszania przez
+// GUI zwolnionego miejsca; wszystkie przekazuje przez gniazdo uniksowe
+// SHM_RING_SOCKET_FORMAT (SCM_RIGHTS, w tej kolejności), GUI odpowiada
+// SHM_RING_ACCEPTED.  Wtedy polecenia dla GUI idą pierścieniem, a TCP
+// zostaje tylko do klawiszy.  Plik używany także przez klienta (C++).
+
+#include <stdint.h>
+#include <string.h>
+
+// Rozmiar danych pierścienia, potęga dwójki
+
+#define SHM_RING_DATA_SIZE (1u << 23)
+
+// Rekordy są wyrównane do 8 bajtów, więc nagłówek nigdy nie jest dzielony
+
+#define SHM_RING_ALIGN 8u
+
+// Abstrakcyjna nazwa gniazda uniksowego GUI (po '\0'), parametrem jest port TCP
+
+#define SHM_RING_SOCKET_FORMAT "screen-worms-gui:%u"
+#define SHM_RING_ACCEPTED "SHM_OK\n"
+
+// Rodzaje rekordów
+
+enum {
+  SHM_RING_PADDING = 0,     // dopełnienie do końca danych
+  SHM_RING_LINE = 1,        // polecenie tekstowe bez '\n' (NEW_GAME)
+  SHM_RING_PIXEL = 2,       // player, x, y
+  SHM_RING_ELIMINATED = 3   // player
+};
+
+// Licznik zapisu i odczytu w osobnych liniach pamięci podręcznej
+
+typedef struct {
+  uint64_t head;
+  char head_pad[56];
+  uint64_t tail;
+  char tail_pad[56];
+  uint32_t waiting;  // czytający śpi na eventfd
+  uint32_t data_size;
+  uint32_t writer_waiting;  // piszący czeka na miejsce
+  char waiting_pad[52];
+} shm_ring_header;
+
+// Nagłówek rekordu; len obejmuje nagłówek i dane, bez wyrównania
+
+typedef struct {
+  uint32_t len;
+  uint8_t type;
+  uint8_t pad;
+  uint16_t player;  // numer gracza wg kolejności z NEW_GAME
+} shm_ring_record;
+
+typedef struct {
+  shm_ring_record header;
+  uint32_t x;
+  uint32_t y;
+} shm_ring_pixel;
+
+#define SHM_RING_MAP_SIZE (sizeof(shm_ring_header) + SHM_RING_DATA_SIZE)
+
+static inline char *shm_ring_data (shm_ring_header *ring) {
+  return (char *)(ring + 1);
+}
+
+static inline uint32_t shm_ring_aligned (uint32_t len) {
+  return (len + SHM_RING_ALIGN - 1) & ~(SHM_RING_ALIGN - 1);
+}
+
+// Strona piszącego: dopisuje cały rekord albo nic (zwraca 0, gdy brak miejsca)
+
+static inline int shm_ring_write (shm_ring_header *ring, const void *record,
+                                  uint32_t len) {
+  uint64_t head = ring->head;
+  uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  uint32_t size = SHM_RING_DATA_SIZE;
+  uint32_t offset = head & (size - 1);
+  uint32_t contiguous = size - offset;
+  uint32_t aligned = shm_ring_aligned(len);
+  uint32_t need = aligned + (contiguous < aligned ? contiguous : 0);
+
+  if (size - (head - tail) < need)
+    return 0;
+
+  if (contiguous < aligned) {
+    shm_ring_record padding;
+
+    memset(&padding, 0, sizeof(padding));
+    padding.len = contiguous;
+    padding.type = SHM_RING_PADDING;
+    memcpy(shm_ring_data(ring) + offset, &padding, sizeof(padding));
+    head += contiguous;
+    offset = 0;
+  }
+
+  memcpy(shm_ring_data(ring) + offset, record, len);
+  __atomic_store_n(&ring->head, head + aligned, __ATOMIC_SEQ_CST);
+  return 1;
+}
+
+// Czy po zapisie trzeba obudzić czytającego (zdejmuje znacznik)
+
+static inline int shm_ring_should_wake (shm_ring_header *ring) {
+  return __atomic_exchange_n(&ring->waiting, 0, __ATOMIC_SEQ_CST) != 0;
+}
+
+// Zgłoszenie przez piszącego, że brakło miejsca; po nim trzeba jeszcze raz
+// spróbować zapisu, bo czytający mógł zwolnić miejsce w międzyczasie
+
+static inline void shm_ring_prepare_space_wait (shm_ring_header *ring) {
+  __atomic_store_n(&ring->writer_waiting, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+// Czy po zwolnieniu miejsca trzeba dać znać piszącemu (zdejmuje znacznik)
+
+static inline int shm_ring_should_signal_space (shm_ring_header *ring) {
+  return __atomic_exchange_n(&ring->writer_waiting, 0, __ATOMIC_SEQ_CST) != 0;
+}
+
+// Strona czytającego: następny rekord albo NULL, gdy pierścień pusty lub
+// rekord jest uszkodzony
+
+static inline shm_ring_record *shm_ring_peek (shm_ring_header *ring) {
+  uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+  while (ring->tail != head) {
+    uint32_t offset = ring->tail & (SHM_RING_DATA_SIZE - 1);
+    shm_ring_record *record = (shm_ring_record *)(shm_ring_data(ring) + offset);
+
+    if (record->len < SHM_RING_ALIGN || record->len > SHM_RING_DATA_SIZE - offset)
+      return NULL;
+    if (record->type != SHM_RING_PADDING)
+      return record;
+    __atomic_store_n(&ring->tail, ring->tail + record->len, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+static inline void shm_ring_consume (shm_ring_header *ring,
+                                     shm_ring_record *record) {
+  __atomic_store_n(&ring->tail, ring->tail + shm_ring_aligned(record->len),
+                   __ATOMIC_RELEASE);
+}
+
+// Zgłoszenie zamiaru zaśnięcia; zwraca 1, gdy w międzyczasie coś doszło
+
+static inline int shm_ring_prepare_wait (shm_ring_header *ring) {
+  __atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+  return __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != ring->tail;
+}
+
+#endif
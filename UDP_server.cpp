@@ -2,7 +2,13 @@
 #include <cstring>
 #include <unistd.h>
 #include <iostream>
+#include <algorithm>
+#include <thread>
+#include <cerrno>
 #include "game_constant.h"
+#include "socket_transport.h"
+#include "phase_timer.h"
+#include "trace.h"
 
 // Comparators for struct sockaddr_in6.
 bool operator<(const struct sockaddr_in6 &A, const struct sockaddr_in6 &B)
@@ -18,54 +24,105 @@ bool operator!=(const struct sockaddr_in6 &A, const struct sockaddr_in6 &B)
     return !(A == B);
 }
 
-// Setting up the port.
-UDPServer::UDPServer(std::map<char, uint32_t> settings)
+// Nanoseconds of CLOCK_REALTIME, the clock of kernel receive timestamps.
+static int64_t realtime_ns()
 {
-    port = settings[game_constant::PORT];
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
 }
 
+// Time over which sends of one turn are spread, 0 without pacing.
+static int64_t pacing_time(std::map<char, uint32_t> &settings)
+{
+    if (settings[game_constant::VELOCITY] == 0)
+        return 0;
+    return int64_t(1e9) * settings[game_constant::PACING] / 100 / settings[game_constant::VELOCITY];
+}
+
+// Setting up the port.
+UDPServer::UDPServer(std::map<char, uint32_t> settings)
+        : own_transport(std::make_unique<SocketTransport>(settings[game_constant::PORT],
+                                                          settings[game_constant::RECEIVE_BUFFER],
+                                                          settings[game_constant::SEND_BUFFER])),
+          transport(*own_transport), stream_port(settings[game_constant::STREAM_PORT]),
+          pacing_ns(pacing_time(settings)) {}
+
+UDPServer::UDPServer(std::map<char, uint32_t> settings, Transport &_transport)
+        : transport(_transport), stream_port(settings[game_constant::STREAM_PORT]),
+          pacing_ns(pacing_time(settings)) {}
+
 // Commencing connection.
 void UDPServer::start()
 {
-    con_socket = socket(AF_INET6, SOCK_DGRAM, 0);
-    if (con_socket < 0)
-    {
-        throw UDPError("Error for UDP socket");
-    }
+    transport.start();
 
-    server_address.sin6_family = AF_INET6;
-    server_address.sin6_port = htons(port);
-    server_address.sin6_addr = in6addr_any;
-
-    if (bind(con_socket, (struct sockaddr *) &server_address, sizeof(server_address)) < 0)
-    {
-        throw UDPError("Error for UDP binding");
-    }
+    if (stream_port != 0)
+        streamer.start(stream_port);
 }
 
 // Obtain single datagram.
 datagram_input UDPServer::receive_datagram()
 {
     struct sockaddr_in6 client_address_temp;
-    socklen_t rcva_len = sizeof(client_address_temp);
-    int flags = 0;
-    int len = recvfrom(con_socket, buffer, sizeof(buffer), flags,
-                   (struct sockaddr *) &client_address_temp, &rcva_len);
-    if (len < 0)
+    datagram_input result;
+    const size_t len = transport.receive(buffer, sizeof(buffer), client_address_temp, result.received_ns);
+    trace::Span span("receive");
+    if (result.received_ns != 0)
     {
-        throw UDPError("Error on datagram from client socket");
+        const int64_t delay = realtime_ns() - result.received_ns;
+        kernel_delay.record(delay > 0 ? delay : 0);
     }
-    datagram_input result;
     result.valid = true;
-    size_t name_len = len - (sizeof(result.session_id) + sizeof(result.turn_direction)
-                             + sizeof(result.next_expected_event_no));
+    result.lockstep = false;
+    result.held_from = result.held_to = 0;
+    const size_t header_len = sizeof(result.session_id) + sizeof(result.turn_direction)
+                              + sizeof(result.next_expected_event_no);
+    if (len < header_len)
+    {
+        result.valid = false;
+        return result;
+    }
 
     memcpy(&result.session_id, buffer, sizeof(result.session_id));
     memcpy(&result.turn_direction, buffer + sizeof(result.session_id), sizeof(result.turn_direction));
     memcpy(&result.next_expected_event_no, buffer + sizeof(result.session_id)
             + sizeof(result.turn_direction), sizeof(result.next_expected_event_no));
 
-    result.player_name = std::string(buffer + len - name_len,  name_len);
+    // Name may be followed by '\0', range of events client already holds, flags and viewport.
+    size_t name_len = len - header_len;
+    const char *name_end = (const char *) memchr(buffer + header_len, '\0', name_len);
+    result.has_view = false;
+    if (name_end != nullptr)
+    {
+        const size_t extension_len = name_len - (name_end - (buffer + header_len)) - 1;
+        name_len = name_end - (buffer + header_len);
+        const uint8_t flags = extension_len > game_constant::HELD_RANGE_LENGTH
+                              ? name_end[1 + game_constant::HELD_RANGE_LENGTH] : 0;
+        const size_t expected_len = extension_len == game_constant::HELD_RANGE_LENGTH ? extension_len
+                : game_constant::HELD_RANGE_LENGTH + game_constant::FLAGS_LENGTH
+                  + ((flags & game_constant::VIEWPORT_FLAG) ? game_constant::VIEWPORT_LENGTH : 0);
+        if (extension_len != expected_len)
+        {
+            result.valid = false;
+            return result;
+        }
+        memcpy(&result.held_from, name_end + 1, sizeof(result.held_from));
+        memcpy(&result.held_to, name_end + 1 + sizeof(result.held_from), sizeof(result.held_to));
+        result.held_from = ntohl(result.held_from);
+        result.held_to = ntohl(result.held_to);
+        result.lockstep = (flags & game_constant::LOCKSTEP_FLAG) != 0;
+        if (flags & game_constant::VIEWPORT_FLAG)
+        {
+            uint32_t edges[4];
+            memcpy(edges, name_end + 1 + game_constant::HELD_RANGE_LENGTH + game_constant::FLAGS_LENGTH,
+                   sizeof(edges));
+            result.view = {ntohl(edges[0]), ntohl(edges[1]), ntohl(edges[2]), ntohl(edges[3])};
+            result.has_view = true;
+        }
+    }
+
+    result.player_name = std::string(buffer + header_len, name_len);
     if (result.player_name.empty() == false
         && is_nick_fine(result.player_name) == false)
     {
@@ -76,7 +133,11 @@ datagram_input UDPServer::receive_datagram()
     result.session_id = be64toh(result.session_id);
     result.next_expected_event_no = ntohl(result.next_expected_event_no);
 
-    std::lock_guard<std::mutex> lock(address_mutex);
+    std::unique_lock<std::mutex> lock(address_mutex, std::defer_lock);
+    {
+        trace::Span wait("receive lock wait");
+        lock.lock();
+    }
     if (result.player_name.empty() == false) // Normal player.
     {
         client_adress[result.player_name] = client_address_temp;
@@ -87,76 +148,269 @@ datagram_input UDPServer::receive_datagram()
     }
 
     client_next_emit[client_address_temp] = result.next_expected_event_no;
+    client_held[client_address_temp] = {result.held_from, result.held_to};
+    if (result.lockstep)
+        lockstep_clients.insert(client_address_temp);
+    else
+        lockstep_clients.erase(client_address_temp);
+    if (result.has_view)
+        client_view[client_address_temp] = result.view;
+    else
+        client_view.erase(client_address_temp);
     client_last_time[client_address_temp] = std::chrono::system_clock::now();
 
     return result;
 }
 
-// Sends events to every players and spectator.
-void UDPServer::send_datagram(const std::vector<std::string> &messages, uint32_t game_id)
+// Sends events [from, to) to one client, each datagram filled with as many events as fit.
+// Datagrams of a burst are written one after another into one buffer, each at a multiple of MAX_UDP_SIZE.
+void UDPServer::send_events(const struct sockaddr_in6 &address, const std::vector<std::string> &messages,
+                            uint32_t from, uint32_t to, uint32_t game_id_htonled)
 {
-    const uint32_t game_id_htonled = htonl(game_id);
+    auto &sent = client_sent[address];
+    if (sent.first != game_id_htonled)
+        sent = {game_id_htonled, 0};
+    if (from < sent.second)
+        stats.resent_events.fetch_add(std::min(to, sent.second) - from, std::memory_order_relaxed);
+    sent.second = std::max(sent.second, to);
 
-    std::lock_guard<std::mutex> lock(address_mutex);
-    for (const auto &adress: client_adress)
+    uint32_t i = from;
+    while (i < to)
     {
-        uint32_t i = client_next_emit[adress.second];
-        if (i >= messages.size() && messages.empty() == false)
-            i = messages.size() - 1;
-
-        while (i < messages.size())
+        burst.clear();
+        burst_ends.clear();
+        while (i < to && burst_ends.size() < game_constant::GSO_MAX_SEGMENTS)
         {
-            std::string whole_message = "0000";
-            memcpy(&whole_message[0], &game_id_htonled, sizeof(game_id_htonled));
+            burst.resize(burst_ends.size() * game_constant::MAX_UDP_SIZE, '\0');
+            const size_t start = burst.size();
+            burst.append((const char *) &game_id_htonled, sizeof(game_id_htonled));
 
-            while (i < messages.size())
+            while (i < to && burst.size() - start + messages[i].size() <= game_constant::MAX_UDP_SIZE)
             {
-                if (whole_message.size() + messages[i].size() <= game_constant::MAX_UDP_SIZE)
-                {
-                    whole_message += messages[i++];
-                }
+                burst += messages[i++];
             }
-            int flags = 0;
-            int snd_len = sendto(con_socket, whole_message.c_str(), (size_t) whole_message.size(), flags,
-                                 (struct sockaddr *) &(adress.second),
-                                 (socklen_t) sizeof(adress.second));
-            if (snd_len < 0)
-                throw UDPError("Error on sending datagram to client socket.");
+            burst_ends.push_back(burst.size());
         }
+        send_burst(address);
     }
+}
 
-    for (const auto &adress: empty_clients)
+// Sends datagrams of the burst to one client.
+void UDPServer::send_burst(const struct sockaddr_in6 &address)
+{
+    trace::Span span("send batch", burst_ends.size());
+    const size_t sent = transport.send_burst(address, burst, burst_ends);
+    stats.datagrams.fetch_add(burst_ends.size(), std::memory_order_relaxed);
+    stats.bytes.fetch_add(sent, std::memory_order_relaxed);
+}
+
+// Sends events from the one client expects, skipping range it already holds.
+void UDPServer::send_to_client(const struct sockaddr_in6 &address, const std::vector<std::string> &messages,
+                               uint32_t game_id_htonled)
+{
+    uint32_t i = client_next_emit[address];
+    if (i >= messages.size() && messages.empty() == false)
+        i = messages.size() - 1;
+
+    const auto held = client_held[address];
+    if (held.first > i && held.first < held.second && held.second <= messages.size())
     {
-        uint32_t i = client_next_emit[adress];
-        if (i >= messages.size() && messages.empty() == false)
-            i = messages.size() - 1;
+        send_events(address, messages, i, held.first, game_id_htonled);
+        i = held.second;
+    }
+    send_events(address, messages, i, messages.size(), game_id_htonled);
+}
 
-        while (i < messages.size())
+// Sends events of the viewport from the one client expects, each datagram starting with VIEWPORT_SKIP
+// record that tells which events it covers.
+void UDPServer::send_viewport(const struct sockaddr_in6 &address, const std::vector<std::string> &messages,
+                              const TileIndex &tiles, const struct viewport &view, uint32_t game_id_htonled)
+{
+    uint32_t from = client_next_emit[address];
+    const uint32_t to = messages.size();
+    if (from >= to)
+        return;
+
+    view_events.clear();
+    tiles.collect(from, to, view, view_events);
+
+    // len - event_no - event_type - end of covered events - crc32.
+    const uint32_t skip_len = htonl(sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint32_t));
+    const size_t skip_size = sizeof(uint32_t) + ntohl(skip_len) + sizeof(uint32_t);
+    size_t next = 0;
+    while (from < to)
+    {
+        // Event too long to follow VIEWPORT_SKIP record goes alone, as to other clients.
+        if (next < view_events.size() && view_events[next] == from
+            && sizeof(game_id_htonled) + skip_size + messages[from].size() > game_constant::MAX_UDP_SIZE)
         {
-            std::string whole_message = "0000";
-            memcpy(&whole_message[0], &game_id_htonled, sizeof(game_id_htonled));
+            send_events(address, messages, from, from + 1, game_id_htonled);
+            from++;
+            next++;
+            continue;
+        }
 
-            while (i < messages.size())
-            {
-                if (whole_message.size() + messages[i].size() <= game_constant::MAX_UDP_SIZE)
-                {
-                    whole_message += messages[i++];
-                }
-            }
-            int flags = 0;
-            int snd_len = sendto(con_socket, whole_message.c_str(), (size_t) whole_message.size(), flags,
-                                 (struct sockaddr *) &(adress),
-                                 (socklen_t) sizeof(adress));
-            if (snd_len < 0)
-                throw UDPError("Error on sending datagram to client socket.");
+        std::string whole_message(sizeof(game_id_htonled) + skip_size, '\0');
+        memcpy(&whole_message[0], &game_id_htonled, sizeof(game_id_htonled));
+        while (next < view_events.size()
+               && whole_message.size() + messages[view_events[next]].size() <= game_constant::MAX_UDP_SIZE)
+            whole_message += messages[view_events[next++]];
+        const uint32_t end = next < view_events.size() ? view_events[next] : to;
+
+        char *skip = &whole_message[sizeof(game_id_htonled)];
+        const uint32_t send_from = htonl(from);
+        const uint32_t send_end = htonl(end);
+        skip[2 * sizeof(uint32_t)] = game_constant::VIEWPORT_SKIP;
+        memcpy(skip, &skip_len, sizeof(skip_len));
+        memcpy(skip + sizeof(uint32_t), &send_from, sizeof(send_from));
+        memcpy(skip + 2 * sizeof(uint32_t) + sizeof(uint8_t), &send_end, sizeof(send_end));
+        const uint32_t crc32_value = htonl(crc32(skip, skip_size - sizeof(uint32_t)));
+        memcpy(skip + skip_size - sizeof(uint32_t), &crc32_value, sizeof(crc32_value));
+
+        const size_t snd_len = transport.send(address, whole_message.c_str(), whole_message.size());
+        stats.datagrams.fetch_add(1, std::memory_order_relaxed);
+        stats.bytes.fetch_add(snd_len, std::memory_order_relaxed);
+        from = end;
+    }
+}
+
+// Calls send for every player and spectator. With pacing their slots are spread evenly over part of the turn
+// and the lock is released while waiting, so receiving goes on.
+void UDPServer::for_each_client(const std::function<void(const struct sockaddr_in6 &)> &send)
+{
+    std::unique_lock<std::mutex> lock(address_mutex, std::defer_lock);
+    {
+        trace::Span wait("send lock wait");
+        lock.lock();
+    }
+    if (pacing_ns == 0)
+    {
+        for (const auto &adress: client_adress)
+            send(adress.second);
+
+        for (const auto &adress: empty_clients)
+            send(adress);
+        return;
+    }
+
+    paced_clients.clear();
+    for (const auto &adress: client_adress)
+        paced_clients.push_back(adress.second);
+    paced_clients.insert(paced_clients.end(), empty_clients.begin(), empty_clients.end());
+
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < paced_clients.size(); ++i)
+    {
+        const auto slot = start + std::chrono::nanoseconds(pacing_ns * (int64_t) i / (int64_t) paced_clients.size());
+        if ((slot - std::chrono::steady_clock::now()).count() > game_constant::PACING_MIN_SLEEP_NS)
+        {
+            lock.unlock();
+            std::this_thread::sleep_until(slot);
+            lock.lock();
+        }
+
+        // Client forgotten while the lock was free.
+        if (client_last_time.find(paced_clients[i]) != client_last_time.end())
+            send(paced_clients[i]);
+    }
+}
+
+// Sends events to every players and spectator.
+void UDPServer::send_datagram(const std::vector<std::string> &messages, uint32_t game_id)
+{
+    const uint32_t game_id_htonled = htonl(game_id);
+
+    for_each_client([&](const struct sockaddr_in6 &address)
+    {
+        send_to_client(address, messages, game_id_htonled);
+    });
+
+    streamer.send_log(messages, game_id);
+}
+
+// Sends lockstep log, events of a viewport or all events to every players and spectator.
+void UDPServer::send_datagram(const std::vector<std::string> &messages,
+                              const std::vector<std::string> &lockstep_messages, const TileIndex &tiles,
+                              uint32_t game_id)
+{
+    const uint32_t game_id_htonled = htonl(game_id);
+
+    for_each_client([&](const struct sockaddr_in6 &address)
+    {
+        if (lockstep_messages.empty() == false && lockstep_clients.find(address) != lockstep_clients.end())
+        {
+            send_to_client(address, lockstep_messages, game_id_htonled);
+            return;
         }
+
+        const auto view = client_view.find(address);
+        if (view != client_view.end())
+            send_viewport(address, messages, tiles, view->second, game_id_htonled);
+        else
+            send_to_client(address, messages, game_id_htonled);
+    });
+
+    streamer.send_log(messages, game_id);
+}
+
+void UDPServer::record_apply_delay(int64_t received_ns)
+{
+    const int64_t delay = realtime_ns() - received_ns;
+    apply_delay.record(delay > 0 ? delay : 0);
+}
+
+std::string UDPServer::get_telemetry()
+{
+    const auto [receive_size, send_size] = transport.get_buffer_sizes();
+
+    const uint64_t us = 1000;
+    return kernel_delay.summary("kernel_to_receive_us", us) + "\n"
+           + apply_delay.summary("receive_to_turn_us", us) + "\n"
+           + "rcvbuf=" + std::to_string(receive_size) + " sndbuf=" + std::to_string(send_size)
+           + " dropped=" + std::to_string(transport.get_dropped()) + "\n";
+}
+
+// Phases are recorded in cycle counter ticks and reported in nanoseconds.
+std::string UDPServer::get_report(bool json)
+{
+    const uint64_t us = 1000;
+    const uint64_t tick_unit = ticks_per_us();
+    const std::pair<const char *, const Histogram *> phases[] = {
+            {"check_sleepers_ns", &stats.check_sleepers}, {"movement_ns", &stats.movement},
+            {"collision_ns", &stats.collision}, {"serialization_ns", &stats.serialization},
+            {"fan_out_ns", &stats.fan_out}, {"turn_ns", &stats.turn}};
+    const std::pair<const char *, uint64_t> counters[] = {
+            {"turns", stats.turns.load(std::memory_order_relaxed)},
+            {"events", stats.events.load(std::memory_order_relaxed)},
+            {"datagrams", stats.datagrams.load(std::memory_order_relaxed)},
+            {"bytes", stats.bytes.load(std::memory_order_relaxed)},
+            {"resent_events", stats.resent_events.load(std::memory_order_relaxed)},
+            {"dropped", transport.get_dropped()}};
+
+    if (json == false)
+    {
+        std::string report = get_telemetry();
+        for (const auto &phase: phases)
+            report += phase.second->summary(phase.first, tick_unit, us) + "\n";
+        for (const auto &counter: counters)
+            report += std::string(counter.first) + "=" + std::to_string(counter.second) + "\n";
+        return report;
     }
+
+    std::string report = "{" + kernel_delay.json("kernel_to_receive_us", us) + ","
+                         + apply_delay.json("receive_to_turn_us", us);
+    for (const auto &phase: phases)
+        report += "," + phase.second->json(phase.first, tick_unit, us);
+    for (const auto &counter: counters)
+        report += ",\"" + std::string(counter.first) + "\":" + std::to_string(counter.second);
+    const auto [receive_size, send_size] = transport.get_buffer_sizes();
+    return report + ",\"rcvbuf\":" + std::to_string(receive_size)
+           + ",\"sndbuf\":" + std::to_string(send_size) + "}\n";
 }
 
-// Desctructor shuts down connection.
-UDPServer::~UDPServer()
+ServerStats &UDPServer::get_stats()
 {
-    close(con_socket);
+    return stats;
 }
 
 // Get number of players.
@@ -173,24 +427,46 @@ size_t UDPServer::get_empty_number()
     return empty_clients.size();
 }
 
+void UDPServer::serve_streams()
+{
+    streamer.serve();
+}
+
 // Checks if any player is time-outed.
 void UDPServer::check_sleepers()
 {
     std::lock_guard<std::mutex> lock(address_mutex);
-    for (const auto &client: empty_clients)
+    const auto now = std::chrono::system_clock::now();
+    for (auto client = empty_clients.begin(); client != empty_clients.end();)
     {
-        if ((std::chrono::system_clock::now() - client_last_time[client]).count() > game_constant::TIMEOUT_LENGTH_NS)
+        if ((now - client_last_time[*client]).count() > game_constant::TIMEOUT_LENGTH_NS)
+        {
+            client_last_time.erase(*client);
+            client_sent.erase(*client);
+            client_held.erase(*client);
+            lockstep_clients.erase(*client);
+            client_view.erase(*client);
+            client = empty_clients.erase(client);
+        }
+        else
         {
-            client_last_time.erase(client);
-            empty_clients.erase(client);
+            ++client;
         }
     }
-    for (const auto &client: client_adress)
+    for (auto client = client_adress.begin(); client != client_adress.end();)
     {
-        if ((std::chrono::system_clock::now() - client_last_time[client.second]).count() > game_constant::TIMEOUT_LENGTH_NS)
+        if ((now - client_last_time[client->second]).count() > game_constant::TIMEOUT_LENGTH_NS)
+        {
+            client_last_time.erase(client->second);
+            client_sent.erase(client->second);
+            client_held.erase(client->second);
+            lockstep_clients.erase(client->second);
+            client_view.erase(client->second);
+            client = client_adress.erase(client);
+        }
+        else
         {
-            client_last_time.erase(client.second);
-            client_adress.erase(client.first);
+            ++client;
         }
     }
 }
@@ -12,13 +12,15 @@
 #include <set>
 #include <cstring>
 #include <mutex>
+#include <functional>
+#include <memory>
 #include "game_constant.h"
-
-class UDPError: public std::runtime_error
-{
-    public:
-    UDPError(const char *w) : std::runtime_error(w) {}
-};
+#include "tile_index.h"
+#include "stream_server.h"
+#include "histogram.h"
+#include "server_stats.h"
+#include "transport.h"
+#include "event_sink.h"
 
 // Comparators for struct sockaddr_in6.
 bool operator<(const struct sockaddr_in6 &A, const struct sockaddr_in6 &B);
@@ -31,16 +33,30 @@ struct datagram_input
     uint8_t turn_direction;
     uint32_t next_expected_event_no;
     std::string player_name;
+    // Events [held_from, held_to) the client already holds, both 0 if none.
+    uint32_t held_from;
+    uint32_t held_to;
+    // Client follows lockstep log.
+    bool lockstep;
+    // Client watches only part of the board.
+    bool has_view;
+    struct viewport view;
+    // Time the kernel took the datagram in, nanoseconds of CLOCK_REALTIME (0 if unknown).
+    int64_t received_ns;
     bool valid;
 };
 
-class UDPServer
+class UDPServer : public EventSink
 {
     public:
     UDPServer() = delete;
 
+    // Datagrams go through a UDP socket on the port from settings.
     explicit UDPServer(std::map<char, uint32_t>);
 
+    // Datagrams go through given transport, which outlives the server.
+    UDPServer(std::map<char, uint32_t>, Transport &);
+
     // Copy and move semantics are disabled.
     UDPServer (const UDPServer &) = delete;
     UDPServer &operator=(const UDPServer &) = delete;
@@ -49,25 +65,70 @@ class UDPServer
 
     datagram_input receive_datagram();
 
-    void send_datagram(const std::vector<std::string> &, uint32_t);
+    void send_datagram(const std::vector<std::string> &, uint32_t) override;
+
+    void send_datagram(const std::vector<std::string> &, const std::vector<std::string> &, const TileIndex &,
+                       uint32_t) override;
+
+    size_t get_client_number() override;
+
+    size_t get_empty_number() override;
 
-    size_t get_client_number();
+    void check_sleepers() override;
 
-    size_t get_empty_number();
+    // Stream spectators get the rest of the log and slow handshakes time out between games too.
+    void serve_streams();
 
-    void check_sleepers();
+    void record_apply_delay(int64_t received_ns) override;
 
-    ~UDPServer();
+    // Delay histograms, socket buffer sizes and datagrams dropped by the kernel, one line each.
+    std::string get_telemetry();
+
+    // Telemetry with turn phases in nanoseconds and counters, as text or JSON.
+    std::string get_report(bool json);
+
+    ServerStats &get_stats() override;
 
     private:
-    int con_socket;
-    uint32_t port;
-    struct sockaddr_in6 server_address;
+    void send_events(const struct sockaddr_in6 &, const std::vector<std::string> &, uint32_t, uint32_t, uint32_t);
+
+    void send_burst(const struct sockaddr_in6 &);
+
+    void for_each_client(const std::function<void(const struct sockaddr_in6 &)> &);
+
+    void send_to_client(const struct sockaddr_in6 &, const std::vector<std::string> &, uint32_t);
+
+    void send_viewport(const struct sockaddr_in6 &, const std::vector<std::string> &, const TileIndex &,
+                       const struct viewport &, uint32_t);
+
+    // Socket transport made by the server itself, if it was not given one.
+    std::unique_ptr<Transport> own_transport;
+    Transport &transport;
+    // Kernel to receiving thread and kernel to turn, in nanoseconds.
+    Histogram kernel_delay;
+    Histogram apply_delay;
+    ServerStats stats;
+    // Game id (as sent) and end of events sent to a client so far, to count resent events.
+    std::map<struct sockaddr_in6, std::pair<uint32_t, uint32_t>> client_sent;
     std::map<std::string, struct sockaddr_in6> client_adress;
     std::set<struct sockaddr_in6> empty_clients;
     std::mutex address_mutex;
     std::map<struct sockaddr_in6, std::chrono::time_point<std::chrono::system_clock>> client_last_time;
     std::map<struct sockaddr_in6, uint32_t> client_next_emit;
+    std::map<struct sockaddr_in6, std::pair<uint32_t, uint32_t>> client_held;
+    std::set<struct sockaddr_in6> lockstep_clients;
+    std::map<struct sockaddr_in6, struct viewport> client_view;
+    // Spectators over TCP, when stream port is set.
+    uint32_t stream_port;
+    StreamServer streamer;
+    // Sends of one turn spread over this time, clients in order of their slots.
+    int64_t pacing_ns;
+    std::vector<struct sockaddr_in6> paced_clients;
+    // Datagrams for one client handed to the transport together.
+    std::string burst;
+    std::vector<size_t> burst_ends;
+    // Numbers of events sent to a viewport client, kept between calls.
+    std::vector<uint32_t> view_events;
     char buffer[game_constant::BUFFER_SIZE];
 };
 
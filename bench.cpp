@@ -0,0 +1,384 @@
+#include <iostream>
+#include <fstream>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <chrono>
+#include <functional>
+#include <vector>
+#include <map>
+#include <string>
+#include <algorithm>
+#include "game_constant.h"
+#include "event_record.h"
+#include "event_decode.h"
+#include "client_datagram.h"
+#include "UDP_server.h"
+#include "memory_transport.h"
+#include "game.h"
+#include "randomiser.h"
+
+// Microbenchmarks of kernels on hot paths of server and client.
+// Usage: ./screen-worms-bench [-b baseline_file] [-t max_slowdown_percent]
+// Every benchmark prints one line "bench=name ops=n ns_per_op=x"; output saved to a file is a baseline.
+// Against a baseline lines get baseline_ns and change_percent, and exit status is 1 when any
+// benchmark got slower by more than allowed.
+
+namespace bench_constant
+{
+    const char BENCH_OPTSTRING[] = "b:t:";
+    const char BASELINE = 'b';
+    const char SLOWDOWN = 't';
+
+    // Above the run to run spread of a small virtual machine.
+    const uint32_t DEFAULT_SLOWDOWN = 50;
+
+    // Every benchmark runs at least this many rounds and this long, the median round counts.
+    const size_t MIN_ROUNDS = 7;
+    const int64_t MIN_NS = 200000000;
+
+    // Lookups and pixels go round tables of this size.
+    const size_t TABLE_SIZE = 4096;
+
+    // Spectators sent to, events each of them is behind and frames their queues hold.
+    const size_t SINK_CLIENTS = 8;
+    const uint32_t SINK_BACKLOG = 200;
+    const size_t SINK_QUEUE = 256;
+}
+
+// Results of benchmarked calls end here, so they are not optimised away.
+volatile uint64_t bench_sink;
+
+// Private parts of Game timed on their own.
+struct GameBench
+{
+    static void call_pixel(Game &game, const pixel &p, size_t player_id)
+    {
+        game.call_pixel(p, player_id);
+    }
+
+    static void clear_events(Game &game)
+    {
+        game.events_to_emit.clear();
+        game.tiles.reset(game.width, game.height);
+    }
+
+    static void eat(Game &game, const pixel &p)
+    {
+        game.eaten_pixels[game.pixel_index(p)] = true;
+    }
+
+    static bool is_eaten(const Game &game, const pixel &p)
+    {
+        return game.eaten_pixels[game.pixel_index(p)];
+    }
+};
+
+std::map<std::string, double> baseline;
+uint32_t max_slowdown = bench_constant::DEFAULT_SLOWDOWN;
+bool slower = false;
+
+// Reads lines printed by an earlier run, other lines such as notes on the machine are skipped.
+void read_baseline(const char *file_name)
+{
+    std::ifstream file(file_name);
+    if (file.is_open() == false)
+    {
+        std::cerr << "Cannot open baseline file." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        char name[64];
+        double ns;
+        if (sscanf(line.c_str(), "bench=%63s ops=%*u ns_per_op=%lf", name, &ns) == 2)
+            baseline[name] = ns;
+    }
+}
+
+// Runs batch of ops until MIN_ROUNDS and MIN_NS, with prepare untimed before every round.
+void run(const char *name, size_t ops, const std::function<void()> &batch,
+         const std::function<void()> &prepare = [] {})
+{
+    std::vector<double> rounds;
+    int64_t total = 0;
+    while (rounds.size() < bench_constant::MIN_ROUNDS || total < bench_constant::MIN_NS)
+    {
+        prepare();
+        auto begin = std::chrono::steady_clock::now();
+        batch();
+        auto end = std::chrono::steady_clock::now();
+        const int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+        rounds.push_back((double) ns / ops);
+        total += ns;
+    }
+    std::sort(rounds.begin(), rounds.end());
+    const double ns_per_op = rounds[rounds.size() / 2];
+
+    printf("bench=%s ops=%zu ns_per_op=%.2f", name, ops, ns_per_op);
+    const auto old = baseline.find(name);
+    if (old != baseline.end() && old->second > 0)
+    {
+        const double change = (ns_per_op / old->second - 1) * 100;
+        printf(" baseline_ns=%.2f change_percent=%+.1f", old->second, change);
+        if (change > max_slowdown)
+            slower = true;
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+std::map<char, uint32_t> bench_settings()
+{
+    auto settings(game_constant::DEFAULT_GAME_SETTINGS);
+    settings[game_constant::SEED] = 2021;
+    settings[game_constant::BOARD_WIDTH] = game_constant::MAX_WIDTH;
+    settings[game_constant::BOARD_HEIGHT] = game_constant::MAX_HEIGHT;
+    // Records read by parse_record include START_STATE events.
+    settings[game_constant::PREDICTION] = 1;
+    return settings;
+}
+
+std::vector<pixel> random_pixels(Randomiser &randomiser)
+{
+    std::vector<pixel> result;
+    for (size_t i = 0; i < bench_constant::TABLE_SIZE; ++i)
+        result.emplace_back((uint32_t) (randomiser.rand() % game_constant::MAX_WIDTH),
+                            (uint32_t) (randomiser.rand() % game_constant::MAX_HEIGHT));
+    return result;
+}
+
+// Started game of two players, events are only serialised.
+void start_game(Game &game, Randomiser &randomiser)
+{
+    game.add_player("alice");
+    game.add_player("bob");
+    game.start(randomiser);
+}
+
+void bench_crc32()
+{
+    char buffer[game_constant::MAX_UDP_SIZE];
+    for (size_t i = 0; i < sizeof(buffer); ++i)
+        buffer[i] = (char) (i * 31);
+
+    const size_t ops = 10000;
+    run("crc32_550", ops, [&]
+    {
+        uint64_t sum = 0;
+        for (size_t i = 0; i < ops; ++i)
+        {
+            buffer[0] = (char) i;
+            sum += crc32(buffer, sizeof(buffer));
+        }
+        bench_sink = sum;
+    });
+}
+
+void bench_call_pixel()
+{
+    NullEventSink sink;
+    Game game(bench_settings(), sink);
+    Randomiser randomiser(2021);
+    start_game(game, randomiser);
+    const auto pixels = random_pixels(randomiser);
+
+    const size_t ops = 10000;
+    run("call_pixel", ops, [&]
+    {
+        for (size_t i = 0; i < ops; ++i)
+            GameBench::call_pixel(game, pixels[i % pixels.size()], i & 1);
+        bench_sink = game.get_event_count();
+    }, [&]
+    {
+        GameBench::clear_events(game);
+    });
+}
+
+void bench_eaten_pixels()
+{
+    NullEventSink sink;
+    Game game(bench_settings(), sink);
+    Randomiser randomiser(2021);
+    start_game(game, randomiser);
+    const auto pixels = random_pixels(randomiser);
+    for (size_t i = 0; i < pixels.size(); i += 2)
+        GameBench::eat(game, pixels[i]);
+
+    const size_t ops = 100000;
+    run("eaten_pixels_lookup", ops, [&]
+    {
+        uint64_t eaten = 0;
+        for (size_t i = 0; i < ops; ++i)
+            eaten += GameBench::is_eaten(game, pixels[(i * 7) % pixels.size()]);
+        bench_sink = eaten;
+    });
+}
+
+void bench_is_nick_fine()
+{
+    std::vector<std::string> nicks;
+    for (size_t len = 1; len <= 20; ++len)
+        nicks.push_back(std::string(len, (char) ('a' + len)));
+    nicks.push_back("with space");
+    nicks.push_back(std::string(21, 'x'));
+
+    const size_t ops = 100000;
+    run("is_nick_fine", ops, [&]
+    {
+        uint64_t fine = 0;
+        for (size_t i = 0; i < ops; ++i)
+            fine += is_nick_fine(nicks[i % nicks.size()]);
+        bench_sink = fine;
+    });
+}
+
+// Log of a short game, packed into datagrams the way the server sends it.
+std::vector<std::string> game_datagrams(size_t &records)
+{
+    NullEventSink sink;
+    Game game(bench_settings(), sink);
+    Randomiser randomiser(2021);
+    start_game(game, randomiser);
+    for (size_t i = 0; i < 300 && game.make_turn() == false; ++i);
+
+    const auto &events = game.get_events();
+    std::vector<std::string> result;
+    const uint32_t game_id = htonl(1);
+    records = events.size();
+    for (size_t i = 0; i < events.size();)
+    {
+        std::string datagram((const char *) &game_id, sizeof(game_id));
+        while (i < events.size() && datagram.size() + events[i].size() <= game_constant::MAX_UDP_SIZE)
+            datagram += events[i++];
+        result.push_back(datagram);
+    }
+    return result;
+}
+
+// Reading of records and decoding of their fields as parse_UDP does it, without passing them on to the GUI.
+void bench_parse_records()
+{
+    size_t records;
+    const auto datagrams = game_datagrams(records);
+
+    run("parse_record", records, [&]
+    {
+        uint64_t sum = 0;
+        uint32_t next_expected_event_no = 0;
+        for (const auto &datagram: datagrams)
+        {
+            RecordReader reader(datagram.data(), datagram.size());
+            uint32_t game_id;
+            if (reader.read_game_id(game_id) == false)
+                continue;
+
+            event_record record;
+            while (reader.next(record) == record_status::FINE)
+            {
+                if (record.event_no != next_expected_event_no)
+                    break;
+                next_expected_event_no++;
+
+                new_game_event new_game;
+                pixel_event pixel;
+                uint16_t player_id;
+                start_state_event start_state;
+                if ((record.type == 0 || record.type == game_constant::NEW_GAME_WIDE)
+                    && decode_new_game(record, new_game))
+                    sum += new_game.maxx + new_game.maxy + new_game.names.size();
+                else if ((record.type == 1 || record.type == game_constant::PIXEL_WIDE) && decode_pixel(record, pixel))
+                    sum += pixel.player_id + pixel.x + pixel.y;
+                else if ((record.type == 2 || record.type == game_constant::PLAYER_ELIMINATED_WIDE)
+                         && decode_eliminated(record, player_id))
+                    sum += player_id;
+                else if (record.type == game_constant::START_STATE && decode_start_state(record, start_state))
+                    sum += start_state.turning + start_state.angles.size();
+            }
+        }
+        bench_sink = sum + next_expected_event_no;
+    });
+}
+
+// Spectators on in-process queues, emptied between rounds.
+void bench_send_datagram()
+{
+    MemoryTransport transport(bench_constant::SINK_CLIENTS, 1, bench_constant::SINK_QUEUE);
+    UDPServer server(bench_settings(), transport);
+    server.start();
+
+    NullEventSink log_sink;
+    Game game(bench_settings(), log_sink);
+    Randomiser randomiser(2021);
+    start_game(game, randomiser);
+    for (size_t i = 0; i < 300 && game.make_turn() == false; ++i);
+    const auto &events = game.get_events();
+    const uint32_t next_expected = events.size() > bench_constant::SINK_BACKLOG
+                                   ? events.size() - bench_constant::SINK_BACKLOG : 0;
+
+    for (size_t i = 0; i < bench_constant::SINK_CLIENTS; ++i)
+    {
+        char mess[game_constant::BUFFER_SIZE];
+        const size_t len = build_client_datagram(mess, i + 1, 0, next_expected, "", 0);
+        transport.to_server(i).push(transport.client_address(i), mess, len);
+        server.receive_datagram();
+    }
+
+    const size_t ops = 10;
+    run("send_datagram_8_clients", ops, [&]
+    {
+        for (size_t i = 0; i < ops; ++i)
+            server.send_datagram(events, 1);
+    }, [&]
+    {
+        for (size_t i = 0; i < bench_constant::SINK_CLIENTS; ++i)
+            while (transport.to_client(i).front() != nullptr)
+                transport.to_client(i).pop();
+    });
+    if (transport.get_dropped() != 0)
+    {
+        std::cerr << "Sink queues too short." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, bench_constant::BENCH_OPTSTRING)) != -1)
+    {
+        if (opt == bench_constant::BASELINE)
+        {
+            read_baseline(optarg);
+            continue;
+        }
+
+        if (opt == '?' || is_integer(optarg) == false || atol(optarg) < 0)
+        {
+            std::cerr << "Usage: " << argv[0] << " [-b baseline_file] [-t max_slowdown_percent]"
+                      << std::endl;
+            exit(EXIT_FAILURE);
+        }
+
+        if (opt == bench_constant::SLOWDOWN)
+            max_slowdown = atol(optarg);
+    }
+    if (optind != argc)
+    {
+        std::cerr << "Usage: " << argv[0] << " [-b baseline_file] [-t max_slowdown_percent]" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    bench_crc32();
+    bench_call_pixel();
+    bench_send_datagram();
+    bench_parse_records();
+    bench_is_nick_fine();
+    bench_eaten_pixels();
+
+    return slower ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,53 @@
+#ifndef ROBALETHEGAME_CLIENT_DATAGRAM_H
+#define ROBALETHEGAME_CLIENT_DATAGRAM_H
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <endian.h>
+#include <netinet/in.h>
+#include "game_constant.h"
+
+// Builds client to server datagram in mess, returns its length.
+// Held events [from, to), packed as from << 32 | to, follow name after '\0' when non-zero or when flags are set.
+// Viewport edges (left, top, right, bottom) follow flags with VIEWPORT_FLAG.
+inline size_t build_client_datagram(char mess[], uint64_t session_id, uint8_t turn_direction,
+                                    uint32_t next_expected_event_no, const std::string &player_name,
+                                    uint64_t held_range, uint8_t flags = 0, const uint32_t *view = nullptr)
+{
+    uint64_t a = htobe64(session_id);
+    uint8_t b = turn_direction;
+    uint32_t c = htonl(next_expected_event_no);
+    size_t len = sizeof(uint64_t) + sizeof(uint8_t) + sizeof(uint32_t) + sizeof(char) * player_name.size();
+
+    memcpy(mess, &a, sizeof(a));
+    memcpy(mess + sizeof(a), &b, sizeof(b));
+    memcpy(mess + sizeof(a) + sizeof(b), &c, sizeof(c));
+    memcpy(mess + sizeof(a) + sizeof(b) + sizeof(c), player_name.c_str(), sizeof(char) * player_name.size());
+
+    if (held_range != 0 || flags != 0)
+    {
+        const uint32_t held_from = htonl(held_range >> 32);
+        const uint32_t held_to = htonl((uint32_t) held_range);
+        mess[len] = '\0';
+        memcpy(mess + len + 1, &held_from, sizeof(held_from));
+        memcpy(mess + len + 1 + sizeof(held_from), &held_to, sizeof(held_to));
+        len += 1 + sizeof(held_from) + sizeof(held_to);
+    }
+
+    if (flags != 0)
+        mess[len++] = flags;
+
+    if (flags & game_constant::VIEWPORT_FLAG)
+    {
+        for (size_t i = 0; i < game_constant::VIEWPORT_LENGTH / sizeof(uint32_t); ++i)
+        {
+            const uint32_t edge = htonl(view[i]);
+            memcpy(mess + len, &edge, sizeof(edge));
+            len += sizeof(edge);
+        }
+    }
+
+    return len;
+}
+
+#endif //ROBALETHEGAME_CLIENT_DATAGRAM_H
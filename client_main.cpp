@@ -2,17 +2,35 @@
 #include <cstdint>
 #include <unistd.h>
 #include "game_constant.h"
+#include "event_record.h"
+#include "event_decode.h"
+#include "client_datagram.h"
+#include "worm_prediction.h"
+#include "game.h"
+#include "randomiser.h"
+#include "GUI/shm_ring.h"
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
 #include <cstdio>
 #include <cstring>
+#include <cstddef>
 #include <chrono>
-#include <thread>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
 #include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <vector>
 #include <algorithm>
 #include <set>
+#include <charconv>
+#include <limits>
+#include <cerrno>
+#include <string_view>
+#include <memory>
 
 // Auxiliary struct for holding game settings.
 struct launch_settings
@@ -22,6 +40,13 @@ struct launch_settings
     size_t port{};
     std::string gui_server;
     size_t gui_port{};
+    bool batch_pixels{};
+    bool local_prediction{};
+    bool lockstep{};
+    // Left, top, right and bottom edge of watched part of board, empty when whole board is watched.
+    std::vector<uint32_t> view;
+    // TCP port of event stream, spectator reads events from it instead of UDP when set.
+    size_t stream_port{};
 
     launch_settings() = default;
 
@@ -29,6 +54,25 @@ struct launch_settings
     : server_name(std::move(sn)), player_name(std::move(pn)), port(p), gui_server(std::move(gs)), gui_port(gp) {};
 };
 
+// Reads viewport given as x,y,width,height, returns its edges.
+std::vector<uint32_t> parse_viewport(const char *arg)
+{
+    std::vector<uint32_t> values;
+    std::string_view rest(arg);
+    while (values.size() < 4)
+    {
+        const std::string number(rest.substr(0, rest.find(',')));
+        if (number.empty() || is_integer(number.c_str()) == false)
+            throw game_constant::NotNumberArgument{};
+        values.push_back(std::stoul(number));
+        rest.remove_prefix(std::min(rest.size(), number.size() + 1));
+    }
+    if (rest.empty() == false || values[2] == 0 || values[3] == 0)
+        throw game_constant::WrongValueArgument{};
+
+    return {values[0], values[1], values[0] + values[2], values[1] + values[3]};
+}
+
 // Analyses input arguments.
 launch_settings get_game_settings(int argc, char *argv[])
 {
@@ -70,6 +114,30 @@ launch_settings get_game_settings(int argc, char *argv[])
                 result.gui_port = atoi(optarg);
                 break;
 
+            case game_constant::BATCH_PIXELS:
+                result.batch_pixels = true;
+                break;
+
+            case game_constant::LOCAL_PREDICTION:
+                result.local_prediction = true;
+                break;
+
+            case game_constant::LOCKSTEP:
+                result.lockstep = true;
+                break;
+
+            case game_constant::VIEWPORT:
+                result.view = parse_viewport(optarg);
+                break;
+
+            case game_constant::STREAM_PORT:
+                if (is_integer(optarg) == false)
+                    throw game_constant::NotNumberArgument{};
+                if (atol(optarg) < (int64_t) game_constant::MIN_PORT || atol(optarg) > (int64_t) game_constant::MAX_PORT)
+                    throw game_constant::WrongValueArgument{};
+                result.stream_port = atol(optarg);
+                break;
+
             case OPT_UNKNOWN_SIGN:
                 throw game_constant::WrongValueArgument{};
         }
@@ -81,6 +149,10 @@ launch_settings get_game_settings(int argc, char *argv[])
         throw game_constant::ArgumentException{};
     }
 
+    // Event stream is for spectators only.
+    if (result.stream_port != 0 && result.player_name.empty() == false)
+        throw game_constant::WrongValueArgument{};
+
     return result;
 }
 
@@ -88,345 +160,1290 @@ launch_settings get_game_settings(int argc, char *argv[])
 bool game_concluded;
 uint64_t session_id;
 uint8_t turn_direction;
+uint8_t last_sent_direction;
+int64_t direction_changed_ns;
+bool events_missing;
 uint32_t next_expected_event_no;
 std::vector <std::string> get_player;
 uint32_t game_width, game_height;
+uint32_t awaited_players;
 uint32_t current_game_id;
 std::set <uint32_t> previous_game_id;
 
-// TCP connection socket.
+// Validated events received ahead of a gap, slot is event_no modulo window.
+std::vector<std::string> reorder_slots(game_constant::REORDER_WINDOW);
+std::vector<bool> reorder_held(game_constant::REORDER_WINDOW);
+size_t reorder_count;
+// First run of held events advertised to server, packed as from << 32 | to.
+uint64_t held_range;
+
+// TCP connection socket, UDP socket connected to server, heartbeat timer and epoll instance.
 int tcp_sock;
+int sock;
+// Server socket is TCP event stream, bytes of incomplete frame wait in input.
+bool streaming;
+std::string stream_input;
+int timer_fd;
+int epoll_fd;
+
+// Partial line received from GUI.
+struct gui_line_state
+{
+    char line[game_constant::MAX_GUI_LINE];
+    size_t len = 0;
+    bool too_long = false;
+};
+gui_line_state gui_line;
+
+// Local prediction of own worm: own player number, turning, speed and own start angle of current game.
+bool local_prediction;
+std::string own_name;
+WormPrediction prediction;
+int prediction_timer_fd = -1;
+size_t own_player;
+uint32_t start_turning, start_rounds_per_sec;
+int32_t own_start_angle;
+
+// Lockstep mode: game run locally from turn inputs of the server, until its state hash disagrees.
+// Game runs with a sink that sends nothing.
+bool lockstep_requested;
+bool lockstep_active;
+bool lockstep_failed;
+bool lockstep_fallback;
+NullEventSink local_sink;
+std::unique_ptr<Game> local_game;
+size_t rendered_events;
+uint32_t local_turn;
+
+// Current time of monotonic clock.
+int64_t steady_now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>
+            (std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Records direction chosen by the player together with time of the key event.
+void publish_direction(uint8_t direction)
+{
+    direction_changed_ns = steady_now_ns();
+    turn_direction = direction;
+}
+
+// Matches single complete line sent by GUI.
+void parse_GUI_line(const char *line, size_t line_len)
+{
+    const std::string_view command(line, line_len);
+    if (command == game_constant::GUI_LEFT_TURN)
+        publish_direction(game_constant::LEFT_TURN);
+    else if (command == game_constant::GUI_RIGHT_TURN)
+        publish_direction(game_constant::RIGHT_TURN);
+    else if (command == game_constant::GUI_FORWARD || command == game_constant::GUI_FORWARD2)
+        publish_direction(game_constant::FORWARD_TURN);
+}
 
-// Analyses input from GUI.
+// Analyses input from GUI, line by line as bytes arrive.
 void receive_from_GUI()
 {
-    std::string read_moves;
-    size_t pos;
     char buffer[game_constant::BUFFER_SIZE];
-    do
+    int rcv_len = recv(tcp_sock, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (rcv_len < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+    if (rcv_len <= 0)
+    {
+        std::cerr << "GUI receive error" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < rcv_len; ++i)
     {
-        int flags = 0;
-        int rcv_len = recv(tcp_sock, buffer, sizeof(buffer), flags);
-        if (rcv_len < 0)
+        if (buffer[i] == '\n')
         {
-            std::cerr << "GUI receive error" << std::endl;
-            exit(EXIT_FAILURE);
+            if (gui_line.len > 0 && gui_line.line[gui_line.len - 1] == '\r')
+                gui_line.len--;
+            if (gui_line.too_long == false)
+                parse_GUI_line(gui_line.line, gui_line.len);
+            gui_line.len = 0;
+            gui_line.too_long = false;
         }
-
-        read_moves += std::string(buffer, rcv_len);
-        if ((pos = read_moves.rfind(game_constant::GUI_LEFT_TURN)) != std::string::npos)
+        else if (gui_line.len < sizeof(gui_line.line))
         {
-            turn_direction = game_constant::LEFT_TURN;
-            read_moves = read_moves.substr(pos);
+            gui_line.line[gui_line.len++] = buffer[i];
         }
-        if ((pos = read_moves.rfind(game_constant::GUI_RIGHT_TURN)) != std::string::npos)
+        else
         {
-            turn_direction = game_constant::RIGHT_TURN;
-            read_moves = read_moves.substr(pos);
+            // Overlong lines are not GUI commands.
+            gui_line.too_long = true;
         }
-        if ((pos = read_moves.rfind(game_constant::GUI_FORWARD)) != std::string::npos)
+    }
+}
+
+// Schedules next heartbeat, faster while events are missing.
+void arm_heartbeat()
+{
+    const uint32_t interval = events_missing ? game_constant::HEARTBEAT_FAST_NS : game_constant::HEARTBEAT_IDLE_NS;
+    struct itimerspec timeout;
+    memset(&timeout, 0, sizeof(timeout));
+    timeout.it_value.tv_sec = interval / 1000000000;
+    timeout.it_value.tv_nsec = interval % 1000000000;
+    if (timerfd_settime(timer_fd, 0, &timeout, NULL) < 0)
+    {
+        std::cerr << "Timer error." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Send datagram with current status.
+// Sent at once when direction changes, otherwise as heartbeat.
+void report_current_status(const launch_settings &settings)
+{
+    // Spectator reading event stream sends nothing to the server, heartbeat only retries GUI output.
+    if (streaming)
+    {
+        arm_heartbeat();
+        return;
+    }
+
+    char mess[game_constant::BUFFER_SIZE];
+    const uint8_t b = turn_direction;
+    uint8_t flags = lockstep_requested && lockstep_failed == false ? game_constant::LOCKSTEP_FLAG : 0;
+    if (settings.view.empty() == false)
+        flags |= game_constant::VIEWPORT_FLAG;
+    const size_t len = build_client_datagram(mess, session_id, b, next_expected_event_no,
+                                             settings.player_name, held_range, flags, settings.view.data());
+
+    ssize_t snd_len = write(sock, mess, len);
+    if (snd_len != (ssize_t)len)
+    {
+        std::cerr << "Partial / failed write error." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    arm_heartbeat();
+
+    if (local_prediction)
+        prediction.add_input(b, steady_now_ns());
+
+#ifdef DEBUG
+    static int64_t latency_sum_ns = 0, latency_max_ns = 0, latency_count = 0, datagrams_sent = 0;
+    static auto report_start = std::chrono::steady_clock::now();
+    datagrams_sent++;
+#endif
+
+    if (b != last_sent_direction)
+    {
+        last_sent_direction = b;
+#ifdef DEBUG
+        // Key-to-wire latency of direction changes and datagram rate.
+        const auto now = std::chrono::steady_clock::now();
+        const int64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>
+                (now.time_since_epoch()).count() - direction_changed_ns;
+        latency_sum_ns += latency;
+        latency_max_ns = std::max(latency_max_ns, latency);
+        if (++latency_count == game_constant::LATENCY_REPORT_EVERY)
         {
-            turn_direction = game_constant::FORWARD_TURN;
-            read_moves = read_moves.substr(pos);
+            const double seconds = std::chrono::duration<double>(now - report_start).count();
+            std::cerr << "Key-to-wire latency: mean " << latency_sum_ns / latency_count / 1000
+                      << " us, max " << latency_max_ns / 1000 << " us, "
+                      << datagrams_sent / seconds << " datagrams/s" << std::endl;
+            latency_sum_ns = latency_max_ns = latency_count = datagrams_sent = 0;
+            report_start = now;
         }
-        if ((pos = read_moves.rfind(game_constant::GUI_FORWARD2)) != std::string::npos)
+#endif
+    }
+}
+
+// GUI commands not yet sent, capacity is kept between datagrams.
+std::string gui_output;
+bool gui_pending;
+// Whether pixels go to GUI as PIXELS commands and length of the open one.
+bool batch_pixels;
+size_t pixels_in_batch;
+
+// Appends decimal number to GUI output without allocation.
+void append_number(uint32_t value)
+{
+    char digits[std::numeric_limits<uint32_t>::digits10 + 1];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    gui_output.append(digits, result.ptr);
+}
+
+// Shared memory ring to GUI on the same host, null while GUI is fed over TCP.
+shm_ring_header *gui_ring;
+int gui_ring_event = -1;
+// GUI signals it when it frees space in the ring after the client found it full.
+int gui_ring_space = -1;
+// Ring records waiting for space in the ring.
+std::string ring_output;
+
+// Queues ring record, padded to ring alignment.
+void append_ring_record(uint8_t type, uint16_t player, const void *payload, size_t payload_len)
+{
+    shm_ring_record header;
+    memset(&header, 0, sizeof(header));
+    header.len = sizeof(header) + payload_len;
+    header.type = type;
+    header.player = player;
+
+    ring_output.append((const char *) &header, sizeof(header));
+    ring_output.append((const char *) payload, payload_len);
+    ring_output.append(shm_ring_aligned(header.len) - header.len, '\0');
+}
+
+// Moves queued records into the ring and wakes GUI if it sleeps.
+void flush_ring_output()
+{
+    size_t done = 0;
+    while (done < ring_output.size())
+    {
+        shm_ring_record header;
+        memcpy(&header, ring_output.data() + done, sizeof(header));
+        if (shm_ring_write(gui_ring, ring_output.data() + done, header.len) == 0)
         {
-            turn_direction = game_constant::FORWARD_TURN;
-            read_moves = read_moves.substr(pos);
+            // Rest is written on the space signal, GUI might have freed some before seeing the request.
+            shm_ring_prepare_space_wait(gui_ring);
+            if (shm_ring_write(gui_ring, ring_output.data() + done, header.len) == 0)
+                break;
         }
-    } while(true);
+        done += shm_ring_aligned(header.len);
+    }
+    ring_output.erase(0, done);
+
+    const uint64_t wake = 1;
+    if (done > 0 && shm_ring_should_wake(gui_ring)
+        && write(gui_ring_event, &wake, sizeof(wake)) < 0 && errno != EAGAIN)
+    {
+        std::cerr << "GUI ring error." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if (ring_output.size() > game_constant::MAX_GUI_BACKLOG)
+    {
+        std::cerr << "GUI does not keep up." << std::endl;
+        exit(EXIT_FAILURE);
+    }
 }
 
-// Send datagram with current status.
-int sock;
-void report_current_status(launch_settings settings)
+// Terminates open PIXELS command.
+void end_pixel_batch()
 {
-    auto last_action = std::chrono::system_clock::now();
-    size_t len;
-    ssize_t snd_len;
+    if (pixels_in_batch > 0)
+    {
+        gui_output += '\n';
+        pixels_in_batch = 0;
+    }
+}
 
-    char *mess = (char*) malloc(game_constant::BUFFER_SIZE);
-    while (true)
+// Watches GUI socket for writability only while output is pending.
+void watch_gui_output(bool pending)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = pending ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    event.data.fd = tcp_sock;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, tcp_sock, &event) < 0)
+    {
+        std::cerr << "Epoll error." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Sends collected GUI commands without blocking, rest waits for the socket to drain.
+void flush_gui_output()
+{
+    if (gui_ring != nullptr)
+    {
+        flush_ring_output();
+        return;
+    }
+
+    end_pixel_batch();
+    const bool was_pending = gui_pending;
+    size_t sent = 0;
+    while (sent < gui_output.size())
+    {
+        ssize_t snd_len = send(tcp_sock, gui_output.data() + sent, gui_output.size() - sent,
+                               MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (snd_len < 0 && errno == EINTR)
+            continue;
+        if (snd_len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (snd_len <= 0)
+        {
+            std::cerr << "GUI write error." << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        sent += snd_len;
+    }
+    gui_output.erase(0, sent);
+
+    if (gui_output.size() > game_constant::MAX_GUI_BACKLOG)
+    {
+        std::cerr << "GUI does not keep up." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    gui_pending = gui_output.empty() == false;
+    if (gui_pending != was_pending)
+        watch_gui_output(gui_pending);
+}
+
+// Splits '\0' separated player names and appends them to player list.
+void append_players(std::string_view list)
+{
+    size_t begin = 0;
+    while (begin < list.size())
+    {
+        size_t end = list.find('\0', begin);
+        if (end == std::string_view::npos)
+            end = list.size();
+        if (end > begin)
+            get_player.emplace_back(list.substr(begin, end - begin));
+        begin = end + 1;
+    }
+}
+
+// Sets timer drawing predicted pixels, zero interval stops it.
+void arm_prediction_timer(int64_t interval_ns)
+{
+    struct itimerspec timeout;
+    memset(&timeout, 0, sizeof(timeout));
+    timeout.it_value.tv_sec = interval_ns / 1000000000;
+    timeout.it_value.tv_nsec = interval_ns % 1000000000;
+    timeout.it_interval = timeout.it_value;
+    if (timerfd_settime(prediction_timer_fd, 0, &timeout, NULL) < 0)
+    {
+        std::cerr << "Timer error." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+void erase_unconfirmed();
+
+void stop_prediction()
+{
+    if (prediction.active())
     {
-        // Equal interval synchronisation.
-        std::this_thread::sleep_for(std::chrono::nanoseconds
-            (game_constant::INTEVAL_LENGTH_NS - (std::chrono::system_clock::now() - last_action).count()));
-        last_action = std::chrono::system_clock::now();
+        prediction.stop();
+        arm_prediction_timer(0);
+        erase_unconfirmed();
+    }
+}
 
-        uint64_t a = htobe64(session_id);
-        uint8_t b = turn_direction;
-        uint32_t c = htonl(next_expected_event_no);
-        len = sizeof(uint64_t) + sizeof(uint8_t) + sizeof(uint32_t) + sizeof(char) * settings.player_name.size();
+// Finds own player number in complete player list of new game.
+void prepare_prediction()
+{
+    prediction.reset(game_width, game_height);
+    arm_prediction_timer(0);
+    own_start_angle = -1;
+    const auto found = std::lower_bound(get_player.begin(), get_player.end(), own_name);
+    own_player = found != get_player.end() && *found == own_name ? found - get_player.begin() : get_player.size();
+}
 
-        memcpy(mess, &a, sizeof(a));
-        memcpy(mess + sizeof(a), &b, sizeof(b));
-        memcpy(mess + sizeof(a) + sizeof(b), &c, sizeof(c));
-        memcpy(mess + sizeof(a) + sizeof(b) + sizeof(c), settings.player_name.c_str(),
-               sizeof(char) * settings.player_name.size());
+// Validates complete player list and passes new game to GUI.
+void announce_new_game(size_t max_players)
+{
+    // Checks if players are fine;
+    if (get_player.size() < 2 || get_player.size() > max_players)
+    {
+        std::cerr << "Wrong number of players." << std::endl;
+        exit(EXIT_FAILURE);
+    }
 
-        snd_len = write(sock, mess, len);
-        if (snd_len != (ssize_t)len)
+    for (const auto &player: get_player)
+    {
+        if (is_nick_fine(player) == false)
         {
-            std::cerr << "Partial / failed write error." << std::endl;
+            std::cerr << "Wrong name of player." << std::endl;
             exit(EXIT_FAILURE);
         }
     }
+
+    if (std::is_sorted(get_player.begin(), get_player.end()) == false)
+    {
+        std::cerr << "Wrong order of players." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if (local_prediction)
+        prepare_prediction();
+
+    // Lockstep log is followed again after a new game, but not after falling back.
+    local_game.reset();
+    lockstep_active = lockstep_requested && lockstep_failed == false;
+
+    end_pixel_batch();
+    gui_output += "NEW_GAME ";
+    append_number(game_width);
+    gui_output += ' ';
+    append_number(game_height);
+    for (const auto &player: get_player)
+    {
+        gui_output += ' ';
+        gui_output += player;
+    }
+
+    if (gui_ring != nullptr)
+    {
+        append_ring_record(SHM_RING_LINE, 0, gui_output.data(), gui_output.size());
+        gui_output.clear();
+        return;
+    }
+    gui_output += '\n';
 }
 
-int parse_UDP(const std::string &status)
+// Checks and stores board size.
+void set_board(uint32_t maxx, uint32_t maxy)
 {
-    uint32_t len, event_no, crc32value;
-    uint8_t type;
-    memcpy(&len, &status[0], sizeof(len));
-    len = ntohl(len);
-    memcpy(&event_no, &status[0] + sizeof(len), sizeof(event_no));
-    memcpy(&type, &status[0] + sizeof(len) + sizeof(event_no), sizeof(type));
-    memcpy(&crc32value, &status[0] + len + sizeof(event_no), sizeof(crc32value));
-    event_no = ntohl(event_no);
-    crc32value = ntohl(crc32value);
-    uint32_t crc32_here = crc32(status.c_str(), status.size() - sizeof(crc32_here));
+    game_width = maxx;
+    game_height = maxy;
 
-    if (crc32value != crc32_here)
+    // Check if board size if fine.
+    if (game_width < game_constant::MIN_WIDTH || game_width > game_constant::MAX_WIDTH
+        || game_height < game_constant::MIN_HEIGHT || game_height > game_constant::MAX_HEIGHT)
     {
-        // Ignore rest of datagram.
-        return -2;
+        std::cerr << "Wrong board size" << std::endl;
+        exit(EXIT_FAILURE);
     }
+}
+
+void write_pixel(size_t player_id, uint32_t posx, uint32_t posy);
+
+// Draws pixels predicted up to now.
+void draw_predicted()
+{
+    static std::vector<pixel> to_draw;
+    to_draw.clear();
+    prediction.advance(steady_now_ns(), to_draw);
+    for (const auto &p: to_draw)
+        write_pixel(own_player, p.x, p.y);
+    if (to_draw.empty() == false)
+        flush_gui_output();
+}
 
-    if (event_no != next_expected_event_no)
+// Follows server pixels in prediction, returns true if pixel has already been drawn.
+bool predict_pixel(size_t player_id, const pixel &p)
+{
+    prediction.mark_eaten(p);
+    if (player_id != own_player)
+        return false;
+
+    // Start pixel is the first own pixel.
+    if (prediction.active() == false && own_start_angle >= 0)
     {
-        return -1;
+        prediction.start(start_turning, start_rounds_per_sec, p, own_start_angle, steady_now_ns());
+        own_start_angle = -1;
+        arm_prediction_timer(prediction.turn_length_ns() / game_constant::PREDICTION_DRAWS_PER_TURN);
+        return false;
     }
+    const bool drawn = prediction.confirm(p, steady_now_ns());
+    erase_unconfirmed();
+    return drawn;
+}
 
-    if (type < 4)
+// Passes GUI pixels drawn ahead of the server which it did not confirm, at most
+// MAX_BATCHED_PIXELS of them in one ERASE line.
+void erase_unconfirmed()
+{
+    static std::vector<pixel> to_erase;
+    to_erase.clear();
+    prediction.take_unconfirmed(to_erase);
+
+    end_pixel_batch();
+    for (size_t first = 0; first < to_erase.size(); first += game_constant::MAX_BATCHED_PIXELS)
     {
-        if (type == 0) // Create new game.
+        const size_t line_start = gui_output.size();
+        gui_output += "ERASE";
+        const size_t last = std::min(to_erase.size(), first + game_constant::MAX_BATCHED_PIXELS);
+        for (size_t i = first; i < last; ++i)
         {
-            uint32_t maxx, maxy;
-            memcpy(&maxx, &status[0] + sizeof(len) + sizeof(type) + sizeof(event_no), sizeof(maxx));
-            memcpy(&maxy, &status[0] + sizeof(len) + sizeof(type) + sizeof(event_no) + sizeof(maxx), sizeof(maxy));
-            maxx = ntohl(maxx);
-            maxy = ntohl(maxy);
-            game_width = maxx;
-            game_height = maxy;
+            gui_output += ' ';
+            append_number(to_erase[i].x);
+            gui_output += ' ';
+            append_number(to_erase[i].y);
+        }
 
-            // Check if board size if fine.
-            if (game_width < game_constant::MIN_WIDTH || game_width > game_constant::MAX_WIDTH
-                || game_height < game_constant::MIN_HEIGHT || game_height > game_constant::MAX_HEIGHT)
-            {
-                std::cerr << "Wrong board size" << std::endl;
-                exit(EXIT_FAILURE);
-            }
+        if (gui_ring != nullptr)
+        {
+            append_ring_record(SHM_RING_LINE, 0, gui_output.data() + line_start, gui_output.size() - line_start);
+            gui_output.resize(line_start);
+            continue;
+        }
+        gui_output += '\n';
+    }
+}
 
-            auto players = status.substr(sizeof(len) + sizeof(type) + sizeof(event_no) + sizeof(maxx) + sizeof(maxy));
-            players = std::string(players.c_str(), players.size() - sizeof(crc32_here));
-            for (auto &c: players)
-                if (c == '\0')
-                    c = ' ';
+// Passes eaten pixel to GUI.
+void report_pixel(size_t player_id, uint32_t posx, uint32_t posy)
+{
+    // Checks if command is correct.
+    if (player_id >= get_player.size())
+    {
+        std::cerr << "Wrong player." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    else if (posx >= game_width || posy >= game_height)
+    {
+        std::cerr << "Wrong pixel position." << std::endl;
+        exit(EXIT_FAILURE);
+    }
 
-            while (players.back() == ' ')
-                players = std::string(players.c_str(), players.size() - 1);
+    if (local_prediction && predict_pixel(player_id, pixel(posx, posy)))
+        return;
 
-            get_player.clear();
-            auto players_backup = players;
-            char *ptr = strtok(&players[0], " ");
-            while (ptr != NULL)
-            {
-                get_player.push_back(ptr);
-                ptr = strtok(NULL, " ");
-            }
+    write_pixel(player_id, posx, posy);
+}
 
-            std::string message = "NEW_GAME " + std::to_string(maxx) + " " + std::to_string(maxy) + " " + players_backup;
-            message += '\n';
+// Appends PIXEL command of checked pixel.
+void write_pixel(size_t player_id, uint32_t posx, uint32_t posy)
+{
+    if (gui_ring != nullptr)
+    {
+        const uint32_t position[] = {posx, posy};
+        append_ring_record(SHM_RING_PIXEL, player_id, position, sizeof(position));
+        return;
+    }
 
-            // Checks if players are fine;
-            if (get_player.size() < 2 || get_player.size() > 25)
-            {
-                std::cerr << "Wrong number of players." << std::endl;
-                exit(EXIT_FAILURE);
-            }
+    if (batch_pixels == false)
+    {
+        gui_output += "PIXEL ";
+    }
+    else
+    {
+        // Pixels of one datagram share single PIXELS line.
+        if (pixels_in_batch == game_constant::MAX_BATCHED_PIXELS)
+            end_pixel_batch();
+        gui_output += pixels_in_batch == 0 ? "PIXELS " : " ";
+        pixels_in_batch++;
+    }
 
-            for (const auto &player: get_player)
-            {
-                if (is_nick_fine(player) == false)
-                {
-                    std::cerr << "Wrong name of player." << std::endl;
-                    exit(EXIT_FAILURE);
-                }
-            }
+    append_number(posx);
+    gui_output += ' ';
+    append_number(posy);
+    gui_output += ' ';
+    gui_output += get_player[player_id];
+    if (batch_pixels == false)
+        gui_output += '\n';
+}
 
-            auto copy = get_player;
-            std::sort(copy.begin(), copy.end());
-            for (size_t i = 0; i < get_player.size(); ++i)
-            {
-                if (copy[i] != get_player[i])
-                {
-                    std::cerr << "Wrong order of players." << std::endl;
-                    exit(EXIT_FAILURE);
-                }
-            }
+// Passes player elimination to GUI.
+void report_eliminated(size_t player_id)
+{
+    if (player_id >= get_player.size())
+    {
+        std::cerr << "Wrong player." << std::endl;
+        exit(EXIT_FAILURE);
+    }
 
-            size_t snd_len = write(tcp_sock, message.c_str(), message.size());
-            if (snd_len != message.size())
-            {
-                std::cerr << "New game write error." << std::endl;
-                exit(EXIT_FAILURE);
-            }
+    if (player_id == own_player)
+        stop_prediction();
 
-            next_expected_event_no++;
-            return 0;
+    if (gui_ring != nullptr)
+    {
+        append_ring_record(SHM_RING_ELIMINATED, player_id, nullptr, 0);
+        return;
+    }
+
+    end_pixel_batch();
+    gui_output += "PLAYER_ELIMINATED ";
+    gui_output += get_player[player_id];
+    gui_output += '\n';
+}
+
+// Stops on event data too short for its type.
+void check_decoded(bool decoded)
+{
+    if (decoded == false)
+    {
+        std::cerr << "Wrong event length." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Checks if event data is long enough for its type.
+void check_event_length(const event_record &record, size_t min_len)
+{
+    check_decoded(record.data.size() >= min_len);
+}
+
+// Passes pixels and eliminations generated by local game to GUI.
+void render_local_events()
+{
+    const auto &events = local_game->get_events();
+    for (; rendered_events < events.size(); ++rendered_events)
+    {
+        RecordReader reader(events[rendered_events].data(), events[rendered_events].size());
+        event_record record;
+        reader.next(record);
+        if (record.type == 1 || record.type == game_constant::PIXEL_WIDE)
+        {
+            pixel_event event;
+            check_decoded(decode_pixel(record, event));
+            report_pixel(event.player_id, event.x, event.y);
         }
-        else if (type == 1) // New pixel.
-        {
-            uint8_t player_id;
-            uint32_t posx, posy;
-            memcpy(&player_id, &status[0] + sizeof(len) + sizeof(type)+ sizeof(event_no), sizeof(player_id));
-            memcpy(&posx, &status[0] + sizeof(len) + sizeof(type) + sizeof(player_id) + sizeof(event_no), sizeof(posx));
-            memcpy(&posy, &status[0] + sizeof(len) + sizeof(type) + sizeof(player_id) + sizeof(event_no) + sizeof(posx), sizeof(posy));
-            posx = ntohl(posx);
-            posy = ntohl(posy);
-
-            // Checks if command is correct.
-            if (player_id > get_player.size())
-            {
-                std::cerr << "Wrong player." << std::endl;
-                exit(EXIT_FAILURE);
-            }
-            else if (posx >= game_width || posy >= game_height)
-            {
-                std::cerr << "Wrong pixel position." << std::endl;
-                exit(EXIT_FAILURE);
-            }
+        else if (record.type == 2 || record.type == game_constant::PLAYER_ELIMINATED_WIDE)
+        {
+            uint16_t player_id;
+            check_decoded(decode_eliminated(record, player_id));
+            report_eliminated(player_id);
+        }
+    }
+}
 
-            std::string message = "PIXEL " + std::to_string(posx) + " " + std::to_string(posy) + " " + get_player[player_id];
-            message += '\n';
+// Starts the game locally once lockstep log follows events shared by both logs.
+void start_local_game()
+{
+    std::map<char, uint32_t> settings = {{game_constant::ROOM_SIZE, game_constant::MAX_ROOM_SIZE},
+                                         {game_constant::BOARD_WIDTH, game_width},
+                                         {game_constant::BOARD_HEIGHT, game_height},
+                                         {game_constant::TURNING, start_turning},
+                                         {game_constant::VELOCITY, start_rounds_per_sec},
+                                         // Ordinary log of a lockstep server holds START_STATE events.
+                                         {game_constant::PREDICTION, 1}};
+    local_game = std::make_unique<Game>(settings, local_sink);
+    for (const auto &player: get_player)
+        local_game->add_player(player);
+
+    // Game id is the first number of the randomiser that starts the game.
+    Randomiser randomiser(current_game_id);
+    local_game->start(randomiser);
+    local_turn = 0;
+    rendered_events = next_expected_event_no;
+    render_local_events();
+}
 
-            size_t snd_len = write(tcp_sock, message.c_str(), message.size());
-            if (snd_len != message.size())
-            {
-                std::cerr << "Pixel write error." << std::endl;
-                exit(EXIT_FAILURE);
-            }
+// Asks server for events of current game from the start, GUI gets NEW_GAME again.
+void fall_back_to_events()
+{
+    lockstep_failed = true;
+    lockstep_active = false;
+    lockstep_fallback = true;
+    local_game.reset();
+    next_expected_event_no = 0;
+#ifdef DEBUG
+    std::cerr << "Lockstep state differs from server, falling back to events." << std::endl;
+#endif
+}
 
-            next_expected_event_no++;
-            return 1;
+// Runs turn of local game or checks its state against the server.
+void follow_lockstep(const event_record &record)
+{
+    if (local_game == nullptr)
+        start_local_game();
+
+    const auto &data = record.data;
+    if (record.type == game_constant::TURN_INPUTS)
+    {
+        check_event_length(record, 2 * sizeof(uint32_t));
+        const uint32_t turn = read_u32(data, 0);
+        const uint32_t first = read_u32(data, sizeof(uint32_t));
+        if (turn != local_turn + 1)
+        {
+            fall_back_to_events();
+            return;
         }
-        else if (type == 2)
-        {
-            uint8_t player_id;
-            memcpy(&player_id, &status[0] + sizeof(len) + sizeof(event_no) + sizeof(type), sizeof(player_id));
-            std::string player = std::to_string(player_id);
-            std::string message = "PLAYER_ELIMINATED " + get_player[player_id];
-            message += '\n';
-            size_t snd_len = write(tcp_sock, message.c_str(), message.size());
-            if (snd_len != message.size())
-            {
-                std::cerr << "Player eliminated write error." << std::endl;
-                exit(EXIT_FAILURE);
-            }
 
-            next_expected_event_no++;
-            return 2;
+        const size_t count = std::min((data.size() - 2 * sizeof(uint32_t)) * game_constant::DIRECTIONS_PER_BYTE,
+                                      get_player.size() - std::min<size_t>(first, get_player.size()));
+        for (size_t index = 0; index < count; ++index)
+        {
+            const uint8_t packed = data[2 * sizeof(uint32_t) + index / game_constant::DIRECTIONS_PER_BYTE];
+            const uint8_t direction = packed >> 2 * (index % game_constant::DIRECTIONS_PER_BYTE) & 3;
+            local_game->set_direction(get_player[first + index], direction);
         }
-        else if (type == 3) // Game over.
+
+        // Turn is made once directions of all worms arrived.
+        if (first + count == get_player.size())
         {
-            return 3;
+            local_turn++;
+            local_game->make_turn();
+            render_local_events();
         }
     }
-    return -1;
+    else
+    {
+        check_event_length(record, 3 * sizeof(uint32_t));
+        if (read_u32(data, 0) != local_turn || read_u32(data, sizeof(uint32_t)) != local_game->get_event_count()
+            || read_u32(data, 2 * sizeof(uint32_t)) != local_game->get_event_digest())
+            fall_back_to_events();
+    }
 }
 
-// Receives UDP datagrams from server.
-void analyse_datagram()
+int parse_UDP(const event_record &record)
 {
-    char buffer[game_constant::BUFFER_SIZE];
+    if (record.event_no != next_expected_event_no)
+    {
+        return -1;
+    }
 
-    // Waiting for game to start.
-    while (game_concluded == true)
+    if (record.type == 0) // Create new game.
     {
-        int flags = 0;
-        int message_len = recv(sock, buffer, sizeof(buffer), flags);
-        if (message_len < 0)
+        new_game_event event;
+        check_decoded(decode_new_game(record, event));
+        set_board(event.maxx, event.maxy);
+
+        get_player.clear();
+        awaited_players = 0;
+        append_players(event.names);
+        announce_new_game(game_constant::MAX_NARROW_PLAYERS);
+
+        next_expected_event_no++;
+        return 0;
+    }
+    else if (record.type == 1 || record.type == game_constant::PIXEL_WIDE) // New pixel.
+    {
+        pixel_event event;
+        check_decoded(decode_pixel(record, event));
+        report_pixel(event.player_id, event.x, event.y);
+
+        next_expected_event_no++;
+        return 1;
+    }
+    else if (record.type == 2 || record.type == game_constant::PLAYER_ELIMINATED_WIDE) // Player eliminated.
+    {
+        uint16_t player_id;
+        check_decoded(decode_eliminated(record, player_id));
+        report_eliminated(player_id);
+
+        next_expected_event_no++;
+        return 2;
+    }
+    else if (record.type == 3) // Game over.
+    {
+        return 3;
+    }
+    else if (record.type == game_constant::NEW_GAME_WIDE) // New game in large room.
+    {
+        new_game_event event;
+        check_decoded(decode_new_game(record, event));
+        set_board(event.maxx, event.maxy);
+        awaited_players = event.players;
+        if (awaited_players < 2 || awaited_players > game_constant::MAX_ROOM_SIZE)
         {
-            std::cerr << "Error on datagram from client socket." << std::endl;
+            std::cerr << "Wrong number of players." << std::endl;
             exit(EXIT_FAILURE);
         }
-        else if ((size_t)message_len > game_constant::MAX_UDP_SIZE)
+
+        get_player.clear();
+        append_players(event.names);
+    }
+    else if (record.type == game_constant::PLAYER_LIST) // Continuation of large room player list.
+    {
+        if (get_player.size() >= awaited_players)
         {
-            std::cerr << "Too big UDP message." << std::endl;
+            std::cerr << "Unexpected player list." << std::endl;
             exit(EXIT_FAILURE);
         }
-        auto status = std::string(buffer, message_len);
+        append_players(record.data);
+    }
+    else if (record.type == game_constant::START_STATE) // Start angles, used by local prediction and lockstep.
+    {
+        start_state_event event;
+        check_decoded(decode_start_state(record, event));
+        const size_t count = event.angles.size() / sizeof(uint16_t);
+        start_turning = event.turning;
+        start_rounds_per_sec = event.rounds_per_sec;
+        if (local_prediction && own_player >= event.first && own_player - event.first < count)
+        {
+            own_start_angle = read_u16(event.angles, (own_player - event.first) * sizeof(uint16_t));
+            if (start_rounds_per_sec < game_constant::MIN_VELOCITY
+                || start_rounds_per_sec > game_constant::MAX_VELOCITY || own_start_angle >= game_constant::FULL_ROTATE)
+                own_start_angle = -1;
+        }
 
-        uint32_t game_id;
-        memcpy(&game_id, &status[0], sizeof(game_id));
-        game_id = ntohl(game_id);
-        status = status.substr(sizeof(game_id));
+        next_expected_event_no++;
+        return 0;
+    }
+    else if (record.type == game_constant::TURN_INPUTS || record.type == game_constant::STATE_HASH)
+    {
+        // Held records of lockstep log are not counted after falling back to events.
+        if (lockstep_active == false)
+            return -1;
+
+        follow_lockstep(record);
+        if (lockstep_fallback == false)
+            next_expected_event_no++;
+        return -1;
+    }
+    else
+    {
+        // Unknown events are skipped.
+        next_expected_event_no++;
+        return -1;
+    }
+
+    // Player list of large room is announced once complete.
+    if (get_player.size() > awaited_players)
+    {
+        std::cerr << "Wrong number of players." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    else if (get_player.size() == awaited_players)
+    {
+        announce_new_game(game_constant::MAX_ROOM_SIZE);
+    }
+
+    next_expected_event_no++;
+    return 0;
+}
+
+// Drops events held from previous game.
+void clear_reorder_buffer()
+{
+    std::fill(reorder_held.begin(), reorder_held.end(), false);
+    reorder_count = 0;
+    held_range = 0;
+}
+
+// Keeps copy of validated event received beyond the gap.
+void hold_event(const event_record &record)
+{
+    if (record.event_no - next_expected_event_no >= game_constant::REORDER_WINDOW)
+        return;
+
+    const size_t slot = record.event_no % game_constant::REORDER_WINDOW;
+    if (reorder_held[slot])
+        return;
+
+    reorder_slots[slot].assign(record.whole);
+    reorder_held[slot] = true;
+    reorder_count++;
+}
+
+// Parses expected event and releases held events that follow it.
+int deliver_event(const event_record &record)
+{
+    int resp = parse_UDP(record);
+    while (resp != 3 && reorder_count > 0 && lockstep_fallback == false)
+    {
+        const size_t slot = next_expected_event_no % game_constant::REORDER_WINDOW;
+        if (reorder_held[slot] == false)
+            break;
+
+        reorder_held[slot] = false;
+        reorder_count--;
+        RecordReader reader(reorder_slots[slot].data(), reorder_slots[slot].size());
+        event_record held_record;
+        reader.next(held_record);
+        resp = parse_UDP(held_record);
+    }
+    return resp;
+}
+
+// Finds first run of held events after the gap, packed as from << 32 | to.
+uint64_t find_held_range()
+{
+    if (reorder_count == 0)
+        return 0;
+
+    uint32_t from = next_expected_event_no + 1;
+    const uint32_t window_end = next_expected_event_no + game_constant::REORDER_WINDOW;
+    while (from != window_end && reorder_held[from % game_constant::REORDER_WINDOW] == false)
+        from++;
+
+    uint32_t to = from;
+    while (to != window_end && reorder_held[to % game_constant::REORDER_WINDOW])
+        to++;
+
+    return (uint64_t) from << 32 | to;
+}
+
+// Parses records of one datagram in place, returns 3 if game is over.
+int parse_records(RecordReader &reader)
+{
+    event_record record;
+    record_status status;
+    // Events before this one that are missing from the datagram are outside the viewport.
+    uint32_t skip_to = 0;
+    while (lockstep_fallback == false && (status = reader.next(record)) == record_status::FINE)
+    {
+        // Datagram sent from lockstep log before the server saw the fall back, records of its
+        // shared beginning are the same in both logs.
+        if (lockstep_active == false && (record.type == game_constant::TURN_INPUTS
+                                         || record.type == game_constant::STATE_HASH))
+            break;
+
+        if (record.type == game_constant::VIEWPORT_SKIP)
+        {
+            if (record.data.size() >= sizeof(uint32_t) && record.event_no <= next_expected_event_no)
+                skip_to = read_u32(record.data, 0);
+            continue;
+        }
+        if (record.event_no > next_expected_event_no && record.event_no < skip_to)
+            next_expected_event_no = record.event_no;
+
+        if (record.event_no > next_expected_event_no)
+        {
+            // Viewport datagrams cover whole ranges, events beyond a gap come again with their range.
+            if (skip_to == 0)
+                hold_event(record);
+        }
+        else if (record.event_no == next_expected_event_no && deliver_event(record) == 3)
+        {
+            events_missing = false;
+            flush_gui_output();
+            return 3;
+        }
+    }
+
+    // Events of both logs held so far are useless after falling back.
+    if (lockstep_fallback)
+    {
+        clear_reorder_buffer();
+        lockstep_fallback = false;
+    }
+    else if (status == record_status::END && skip_to > next_expected_event_no)
+    {
+        next_expected_event_no = skip_to;
+    }
+
+    // Events held beyond the gap mean some are missing.
+    held_range = find_held_range();
+    events_missing = reorder_count > 0;
+
+    // If crc value is wrong or record is cut rest of datagram is ignored.
+    flush_gui_output();
+    return 0;
+}
+
+// Forgets game after its last event.
+void conclude_game()
+{
+    stop_prediction();
+    game_concluded = true;
+    turn_direction = game_constant::FORWARD_TURN;
+    get_player.clear();
+}
+
+// Handles game_id and records of datagram or stream frame.
+void analyse_message(const char *buffer, size_t message_len)
+{
+    RecordReader reader(buffer, message_len);
+    uint32_t game_id;
+    if (reader.read_game_id(game_id) == false)
+        return;
 
+    if (game_concluded) // Waiting for game to start.
+    {
         if (previous_game_id.find(game_id) == previous_game_id.end())
         {
             previous_game_id.insert(game_id);
             current_game_id = game_id;
             game_concluded = false;
             next_expected_event_no = 0;
+            clear_reorder_buffer();
+            lockstep_failed = false;
         }
+        parse_records(reader);
+    }
+    else if (game_id == current_game_id) // Game in progress.
+    {
+        if (parse_records(reader) == 3)
+            conclude_game();
+    }
+}
 
-        while (status.empty() == false)
-        {
-            uint32_t len;
-            memcpy(&len, &status[0], sizeof(len));
-            len = ntohl(len);
-            size_t package_len = sizeof(len) + len + sizeof(uint32_t);
-            int resp = parse_UDP(status.substr(0, package_len));
-            status = status.substr(package_len);
+// Handles single datagram from server.
+void analyse_datagram(const char *buffer, size_t message_len)
+{
+    if (message_len > game_constant::MAX_UDP_SIZE)
+    {
+        std::cerr << "Too big UDP message." << std::endl;
+        exit(EXIT_FAILURE);
+    }
 
-            // If crc value is wrong rest of datagram is ignored.
-            if (resp == -2)
-                break;
+    analyse_message(buffer, message_len);
+}
+
+// Reads frames of event stream, each of them holds game_id and records as a datagram does.
+void receive_stream()
+{
+    char buffer[game_constant::BUFFER_SIZE];
+    ssize_t len;
+    while ((len = recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+        stream_input.append(buffer, len);
+    if (len == 0 || (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+    {
+        std::cerr << "Event stream closed." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    size_t pos = 0;
+    uint32_t frame_len;
+    while (stream_input.size() - pos >= sizeof(frame_len))
+    {
+        memcpy(&frame_len, stream_input.data() + pos, sizeof(frame_len));
+        frame_len = ntohl(frame_len);
+        if (stream_input.size() - pos - sizeof(frame_len) < frame_len)
+            break;
+
+        // Stream keeps order, game the server moved on from does not continue.
+        const char *frame = stream_input.data() + pos + sizeof(frame_len);
+        uint32_t game_id;
+        if (frame_len >= sizeof(game_id))
+        {
+            memcpy(&game_id, frame, sizeof(game_id));
+            if (game_concluded == false && ntohl(game_id) != current_game_id)
+                conclude_game();
         }
+        analyse_message(frame, frame_len);
+        pos += sizeof(frame_len) + frame_len;
     }
+    stream_input.erase(0, pos);
+}
 
-    // Game in progress.
-    while (game_concluded == false)
+// Receives all queued UDP datagrams from server.
+void receive_datagrams()
+{
+    static char buffer[game_constant::GRO_BUFFER_SIZE];
+    char control[CMSG_SPACE(sizeof(int))];
+    while (true)
     {
-        int flags = 0;
-        int message_len = recv(sock, buffer, sizeof(buffer), flags);
+        struct iovec iov = {buffer, sizeof(buffer)};
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        int message_len = recvmsg(sock, &message, MSG_DONTWAIT);
+        if (message_len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (message_len < 0 && errno == EINTR)
+            continue;
         if (message_len < 0)
         {
-            std::cerr << "Error on datagram from client socket" << std::endl;
+            std::cerr << "Error on datagram from client socket." << std::endl;
             exit(EXIT_FAILURE);
         }
 
-        auto status = std::string(buffer, message_len);
-        uint32_t game_id;
-        memcpy(&game_id, &status[0], sizeof(game_id));
-        game_id = ntohl(game_id);
-        if (game_id != current_game_id)
-            continue;
+        // Coalesced datagrams are split at segment size given by the kernel.
+        size_t segment = message_len;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL; cmsg = CMSG_NXTHDR(&message, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+            {
+                int segment_size;
+                memcpy(&segment_size, CMSG_DATA(cmsg), sizeof(segment_size));
+                segment = segment_size;
+            }
+        }
 
-        status = status.substr(sizeof(game_id));
+        size_t pos = 0;
+        do
+        {
+            const size_t len = std::min(segment, message_len - pos);
+            analyse_datagram(buffer + pos, len);
+            pos += len;
+        } while (pos < (size_t) message_len);
+    }
+}
+
+// Registers descriptor in epoll instance.
+void watch(int fd)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+    {
+        std::cerr << "Epoll error." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
 
-        while (status.empty() == false)
+// Single thread multiplexing GUI, server and heartbeat timer.
+void run_event_loop(const launch_settings &settings)
+{
+    epoll_fd = epoll_create1(0);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (epoll_fd < 0 || timer_fd < 0)
+    {
+        std::cerr << "Epoll error." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    watch(tcp_sock);
+    watch(sock);
+    watch(timer_fd);
+    if (gui_ring != nullptr)
+        watch(gui_ring_space);
+    if (local_prediction)
+    {
+        prediction_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (prediction_timer_fd < 0)
         {
-            uint32_t len;
-            memcpy(&len, &status[0], sizeof(len));
-            len = ntohl(len);
-            size_t package_len = sizeof(len) + len + sizeof(uint32_t);
-            int resp = parse_UDP(status.substr(0, package_len));
-            status = status.substr(package_len);
+            std::cerr << "Epoll error." << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        watch(prediction_timer_fd);
+    }
+    report_current_status(settings);
 
-            // If crc value if wrong rest of datagram is ignored.
-            if (resp == -2)
-                break;
+    struct epoll_event events[game_constant::MAX_EPOLL_EVENTS];
+    while (true)
+    {
+        int ready = epoll_wait(epoll_fd, events, game_constant::MAX_EPOLL_EVENTS, -1);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready < 0)
+        {
+            std::cerr << "Epoll error." << std::endl;
+            exit(EXIT_FAILURE);
+        }
 
-            if (resp == 3)
+        for (int i = 0; i < ready; ++i)
+        {
+            const int fd = events[i].data.fd;
+            if (fd == timer_fd)
             {
-                game_concluded = true;
-                break;
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+                    report_current_status(settings);
+            }
+            else if (fd == gui_ring_space)
+            {
+                uint64_t signals;
+                if (read(gui_ring_space, &signals, sizeof(signals)) == sizeof(signals) && ring_output.empty() == false)
+                    flush_gui_output();
+            }
+            else if (fd == prediction_timer_fd)
+            {
+                uint64_t expirations;
+                if (read(prediction_timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+                    draw_predicted();
+            }
+            else if (fd == sock && streaming)
+            {
+                receive_stream();
+            }
+            else if (fd == sock)
+            {
+                receive_datagrams();
+            }
+            else if (fd == tcp_sock)
+            {
+                if (events[i].events & EPOLLOUT)
+                    flush_gui_output();
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                    receive_from_GUI();
+
+                // Direction change goes to the server at once.
+                if (turn_direction != last_sent_direction)
+                    report_current_status(settings);
             }
         }
     }
 }
 
+// Checks if GUI connection goes through loopback.
+bool is_local_peer(int fd)
+{
+    struct sockaddr_storage peer;
+    socklen_t peer_len = sizeof(peer);
+    if (getpeername(fd, (struct sockaddr *) &peer, &peer_len) < 0)
+        return false;
+
+    if (peer.ss_family == AF_INET)
+        return ntohl(((struct sockaddr_in *) &peer)->sin_addr.s_addr) >> 24 == 127;
+
+    const auto &address = ((struct sockaddr_in6 *) &peer)->sin6_addr;
+    return peer.ss_family == AF_INET6 && (IN6_IS_ADDR_LOOPBACK(&address)
+           || (IN6_IS_ADDR_V4MAPPED(&address) && address.s6_addr[12] == 127));
+}
+
+// Sends ring memory, wake-up eventfd and free space eventfd to GUI, returns true if GUI took them.
+bool offer_ring(int unix_sock, int memfd, int event_fd, int space_fd)
+{
+    const char offer[] = "SHM_RING";
+    struct iovec iov = {(void *) offer, sizeof(offer)};
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    memset(control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    const int fds[] = {memfd, event_fd, space_fd};
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    if (sendmsg(unix_sock, &msg, MSG_NOSIGNAL) < 0)
+        return false;
+
+    // GUI answers from its main loop, which may still be starting.
+    struct timeval timeout = {game_constant::RING_HANDSHAKE_TIMEOUT_S, 0};
+    setsockopt(unix_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    char reply[sizeof(SHM_RING_ACCEPTED)];
+    const size_t expected = strlen(SHM_RING_ACCEPTED);
+    size_t received = 0;
+    while (received < expected)
+    {
+        ssize_t len = recv(unix_sock, reply + received, expected - received, 0);
+        if (len <= 0)
+            return false;
+        received += len;
+    }
+    return memcmp(reply, SHM_RING_ACCEPTED, expected) == 0;
+}
+
+// Negotiates shared memory ring with GUI on the same host, TCP stays in use otherwise.
+void set_up_ring(const launch_settings &settings)
+{
+    if (is_local_peer(tcp_sock) == false)
+        return;
+
+    // GUI without ring support does not listen on the socket.
+    int unix_sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path + 1, sizeof(address.sun_path) - 1, SHM_RING_SOCKET_FORMAT,
+             (unsigned) settings.gui_port);
+    socklen_t address_len = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(address.sun_path + 1);
+    if (unix_sock < 0 || connect(unix_sock, (struct sockaddr *) &address, address_len) < 0)
+    {
+        if (unix_sock >= 0)
+            close(unix_sock);
+        return;
+    }
+
+    int memfd = memfd_create("screen-worms-gui-ring", MFD_CLOEXEC);
+    int event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int space_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    void *mapped = MAP_FAILED;
+    if (memfd >= 0 && event_fd >= 0 && space_fd >= 0 && ftruncate(memfd, SHM_RING_MAP_SIZE) == 0)
+        mapped = mmap(NULL, SHM_RING_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+
+    if (mapped != MAP_FAILED)
+    {
+        ((shm_ring_header *) mapped)->data_size = SHM_RING_DATA_SIZE;
+        if (offer_ring(unix_sock, memfd, event_fd, space_fd))
+        {
+            gui_ring = (shm_ring_header *) mapped;
+            gui_ring_event = event_fd;
+            gui_ring_space = space_fd;
+        }
+        else
+        {
+            munmap(mapped, SHM_RING_MAP_SIZE);
+        }
+    }
+
+    if (gui_ring == nullptr && event_fd >= 0)
+        close(event_fd);
+    if (gui_ring == nullptr && space_fd >= 0)
+        close(space_fd);
+    if (memfd >= 0)
+        close(memfd);
+    close(unix_sock);
+}
+
 void set_up_TCP(launch_settings settings)
 {
     int err;
@@ -476,36 +1493,47 @@ void set_up_TCP(launch_settings settings)
     freeaddrinfo(addr_result);
 }
 
+// Connects to the server, to its event stream for spectators with stream port.
 void set_up(launch_settings settings)
 {
+    streaming = settings.stream_port != 0;
+    const size_t port = streaming ? settings.stream_port : settings.port;
+
     // Converting host/port in string to struct addrinfo.
     struct addrinfo addr_hints;
     struct addrinfo *addr_result;
 
     (void) memset(&addr_hints, 0, sizeof(struct addrinfo));
     addr_hints.ai_family = AF_UNSPEC;
-    addr_hints.ai_socktype = SOCK_DGRAM;
-    addr_hints.ai_protocol = IPPROTO_UDP;
+    addr_hints.ai_socktype = streaming ? SOCK_STREAM : SOCK_DGRAM;
+    addr_hints.ai_protocol = streaming ? IPPROTO_TCP : IPPROTO_UDP;
     addr_hints.ai_flags = 0;
     addr_hints.ai_addrlen = 0;
     addr_hints.ai_addr = NULL;
     addr_hints.ai_canonname = NULL;
     addr_hints.ai_next = NULL;
 
-    if (getaddrinfo(settings.server_name.c_str(), std::to_string(settings.port).c_str(), &addr_hints, &addr_result) != 0)
+    if (getaddrinfo(settings.server_name.c_str(), std::to_string(port).c_str(), &addr_hints, &addr_result) != 0)
     {
         std::cerr << settings.server_name.c_str() << std::endl;
         std::cerr << "Getaddrinfo error." << std::endl;
         exit(EXIT_FAILURE);
     }
 
-    sock = socket(addr_result->ai_family, SOCK_DGRAM, 0);
+    sock = socket(addr_result->ai_family, addr_hints.ai_socktype, 0);
     if (sock < 0)
     {
         std::cerr << "Socket error." << std::endl;
         exit(EXIT_FAILURE);
     }
 
+    // Bursts sent with segmentation offload may come coalesced, older kernels deliver them one by one.
+    if (streaming == false)
+    {
+        int flag = 1;
+        setsockopt(sock, SOL_UDP, UDP_GRO, &flag, sizeof(flag));
+    }
+
     int con = connect(sock, addr_result->ai_addr, addr_result->ai_addrlen);
     if (con < 0)
     {
@@ -513,13 +1541,24 @@ void set_up(launch_settings settings)
         exit(EXIT_FAILURE);
     }
     freeaddrinfo(addr_result);
+
+    // Handshake of event stream: no game known yet, the current one is streamed from its start.
+    if (streaming)
+    {
+        const char handshake[game_constant::STREAM_HANDSHAKE_LENGTH] = {};
+        if (write(sock, handshake, sizeof(handshake)) != (ssize_t) sizeof(handshake))
+        {
+            std::cerr << "Partial / failed write error." << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
 }
 
 int main(int argc, char *argv[])
 {
     if (argc < 2)
     {
-        std::cerr << "Usage: " << argv[0] << " game_server [-n player_name] [-p n] [-i gui_server] [-r n]" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " game_server [-n player_name] [-p n] [-i gui_server] [-r n] [-b] [-l] [-k] [-w x,y,width,height] [-e stream_port]" << std::endl;
         exit(EXIT_FAILURE);
     }
 
@@ -534,22 +1573,21 @@ int main(int argc, char *argv[])
         exit(EXIT_FAILURE);
     }
 
+    gui_output.reserve(game_constant::BUFFER_SIZE);
     set_up_TCP(player_settings);
+    set_up_ring(player_settings);
     set_up(player_settings);
-    std::thread GUI_receiver(receive_from_GUI);
-    std::thread server_reporter(report_current_status, player_settings);
+    batch_pixels = player_settings.batch_pixels;
+    local_prediction = player_settings.local_prediction && player_settings.player_name.empty() == false;
+    own_name = player_settings.player_name;
+    lockstep_requested = player_settings.lockstep;
     session_id = std::chrono::duration_cast<std::chrono::microseconds>
             (std::chrono::system_clock::now().time_since_epoch()).count();
     next_expected_event_no = 0;
+    turn_direction = game_constant::FORWARD_TURN;
+    last_sent_direction = game_constant::FORWARD_TURN;
+    game_concluded = true;
 
-    while (true)
-    {
-        turn_direction = game_constant::FORWARD_TURN;
-        game_concluded = true;
-        get_player.clear();
-
-        std::thread server_analyser(analyse_datagram);
-        server_analyser.join();
-    }
     // Client runs in loop.
+    run_event_loop(player_settings);
 }
@@ -0,0 +1,86 @@
+#ifndef ROBALETHEGAME_EVENT_DECODE_H
+#define ROBALETHEGAME_EVENT_DECODE_H
+#include <cstdint>
+#include <string_view>
+#include "game_constant.h"
+#include "event_record.h"
+
+// Fields of event records checked by RecordReader, decoded the same way wherever records are read.
+// Every decoder takes both narrow and wide form of its event and returns false when data is too short.
+
+struct new_game_event
+{
+    uint32_t maxx;
+    uint32_t maxy;
+    // Players announced by wide form, 0 in narrow one, which lists them all.
+    uint32_t players;
+    // Names separated with zero bytes.
+    std::string_view names;
+};
+
+struct pixel_event
+{
+    uint16_t player_id;
+    uint32_t x;
+    uint32_t y;
+};
+
+struct start_state_event
+{
+    uint32_t turning;
+    uint32_t rounds_per_sec;
+    uint32_t first;
+    // Start angles of players from first on, 2 bytes each.
+    std::string_view angles;
+};
+
+inline bool decode_new_game(const event_record &record, new_game_event &event)
+{
+    const bool wide = record.type == game_constant::NEW_GAME_WIDE;
+    const size_t fields_len = (wide ? 3 : 2) * sizeof(uint32_t);
+    if (record.data.size() < fields_len)
+        return false;
+
+    event.maxx = read_u32(record.data, 0);
+    event.maxy = read_u32(record.data, sizeof(uint32_t));
+    event.players = wide ? read_u32(record.data, 2 * sizeof(uint32_t)) : 0;
+    event.names = record.data.substr(fields_len);
+    return true;
+}
+
+inline bool decode_pixel(const event_record &record, pixel_event &event)
+{
+    const bool wide = record.type == game_constant::PIXEL_WIDE;
+    const size_t id_len = wide ? sizeof(uint16_t) : sizeof(uint8_t);
+    if (record.data.size() < id_len + 2 * sizeof(uint32_t))
+        return false;
+
+    event.player_id = wide ? read_u16(record.data, 0) : (uint8_t) record.data[0];
+    event.x = read_u32(record.data, id_len);
+    event.y = read_u32(record.data, id_len + sizeof(uint32_t));
+    return true;
+}
+
+inline bool decode_eliminated(const event_record &record, uint16_t &player_id)
+{
+    const bool wide = record.type == game_constant::PLAYER_ELIMINATED_WIDE;
+    if (record.data.size() < (wide ? sizeof(uint16_t) : sizeof(uint8_t)))
+        return false;
+
+    player_id = wide ? read_u16(record.data, 0) : (uint8_t) record.data[0];
+    return true;
+}
+
+inline bool decode_start_state(const event_record &record, start_state_event &event)
+{
+    if (record.data.size() < 3 * sizeof(uint32_t))
+        return false;
+
+    event.turning = read_u32(record.data, 0);
+    event.rounds_per_sec = read_u32(record.data, sizeof(uint32_t));
+    event.first = read_u32(record.data, 2 * sizeof(uint32_t));
+    event.angles = record.data.substr(3 * sizeof(uint32_t));
+    return true;
+}
+
+#endif //ROBALETHEGAME_EVENT_DECODE_H
@@ -0,0 +1,102 @@
+#ifndef ROBALETHEGAME_EVENT_RECORD_H
+#define ROBALETHEGAME_EVENT_RECORD_H
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <netinet/in.h>
+#include "game_constant.h"
+
+// Single event record viewed in place inside received datagram.
+struct event_record
+{
+    uint32_t event_no;
+    uint8_t type;
+    std::string_view data; // event_data field.
+    std::string_view whole; // Whole record including len and crc32.
+};
+
+// Outcome of reading next record from datagram.
+enum class record_status
+{
+    FINE,
+    WRONG_CRC,
+    TRUNCATED,
+    END
+};
+
+// Walks event records of one server datagram without copying them.
+class RecordReader
+{
+    public:
+    RecordReader() = delete;
+
+    RecordReader(const char *_buffer, size_t _size) : buffer(_buffer), size(_size), pos(0) {};
+
+    // Reads game_id, returns false if datagram is too short.
+    bool read_game_id(uint32_t &game_id)
+    {
+        if (size < sizeof(game_id))
+            return false;
+
+        memcpy(&game_id, buffer, sizeof(game_id));
+        game_id = ntohl(game_id);
+        pos = sizeof(game_id);
+        return true;
+    }
+
+    // Checks bounds and checksum of next record in place.
+    record_status next(event_record &record)
+    {
+        uint32_t len, crc32value;
+        const size_t header_len = sizeof(len) + sizeof(record.event_no) + sizeof(record.type);
+
+        if (pos == size)
+            return record_status::END;
+        if (size - pos < header_len + sizeof(crc32value))
+            return record_status::TRUNCATED;
+
+        memcpy(&len, buffer + pos, sizeof(len));
+        len = ntohl(len);
+
+        // Declared length has to cover event_no and event_type and stay inside datagram.
+        if (len < sizeof(record.event_no) + sizeof(record.type)
+            || len > size - pos - sizeof(len) - sizeof(crc32value))
+            return record_status::TRUNCATED;
+
+        const size_t record_len = sizeof(len) + len + sizeof(crc32value);
+        memcpy(&crc32value, buffer + pos + sizeof(len) + len, sizeof(crc32value));
+        if (ntohl(crc32value) != crc32(buffer + pos, sizeof(len) + len))
+            return record_status::WRONG_CRC;
+
+        memcpy(&record.event_no, buffer + pos + sizeof(len), sizeof(record.event_no));
+        record.event_no = ntohl(record.event_no);
+        memcpy(&record.type, buffer + pos + sizeof(len) + sizeof(record.event_no), sizeof(record.type));
+        record.data = std::string_view(buffer + pos + header_len, len - sizeof(record.event_no) - sizeof(record.type));
+        record.whole = std::string_view(buffer + pos, record_len);
+
+        pos += record_len;
+        return record_status::FINE;
+    }
+
+    private:
+    const char *buffer;
+    size_t size;
+    size_t pos;
+};
+
+// Reads big-endian integer from event data, caller checks the length.
+inline uint32_t read_u32(std::string_view data, size_t offset)
+{
+    uint32_t value;
+    memcpy(&value, data.data() + offset, sizeof(value));
+    return ntohl(value);
+}
+
+inline uint16_t read_u16(std::string_view data, size_t offset)
+{
+    uint16_t value;
+    memcpy(&value, data.data() + offset, sizeof(value));
+    return ntohs(value);
+}
+
+#endif //ROBALETHEGAME_EVENT_RECORD_H
@@ -0,0 +1,68 @@
+#ifndef ROBALETHEGAME_EVENT_SINK_H
+#define ROBALETHEGAME_EVENT_SINK_H
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "tile_index.h"
+#include "server_stats.h"
+
+// Receiver of events made by Game and source of the clients it counts: UDPServer in the server,
+// nothing in a client that runs the game locally.
+class EventSink
+{
+    public:
+    virtual ~EventSink() = default;
+
+    virtual void send_datagram(const std::vector<std::string> &, uint32_t) = 0;
+
+    // Clients asking for lockstep log get it when it is not empty, clients watching a viewport get
+    // events of the tiles it touches, others get all events.
+    virtual void send_datagram(const std::vector<std::string> &, const std::vector<std::string> &,
+                               const TileIndex &, uint32_t) = 0;
+
+    virtual size_t get_client_number() = 0;
+
+    virtual size_t get_empty_number() = 0;
+
+    virtual void check_sleepers() = 0;
+
+    // Delay from the kernel taking an input in to the turn applying it.
+    virtual void record_apply_delay(int64_t received_ns) = 0;
+
+    // Game records phases of its turns here.
+    virtual ServerStats &get_stats() = 0;
+};
+
+// Sink of a game without clients, its events are only kept in the game.
+class NullEventSink : public EventSink
+{
+    public:
+    void send_datagram(const std::vector<std::string> &, uint32_t) override {}
+
+    void send_datagram(const std::vector<std::string> &, const std::vector<std::string> &, const TileIndex &,
+                       uint32_t) override {}
+
+    size_t get_client_number() override
+    {
+        return 0;
+    }
+
+    size_t get_empty_number() override
+    {
+        return 0;
+    }
+
+    void check_sleepers() override {}
+
+    void record_apply_delay(int64_t) override {}
+
+    ServerStats &get_stats() override
+    {
+        return stats;
+    }
+
+    private:
+    ServerStats stats;
+};
+
+#endif //ROBALETHEGAME_EVENT_SINK_H
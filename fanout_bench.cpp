@@ -0,0 +1,197 @@
+#include <iostream>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "game_constant.h"
+#include "event_record.h"
+#include "client_datagram.h"
+#include "memory_transport.h"
+#include "UDP_server.h"
+#include "game.h"
+#include "randomiser.h"
+
+// Benchmark of whole turns, fan-out included, against number of virtual clients in the process.
+// Every tick each client sends its heartbeat, the server takes all of them, makes a turn and
+// the clients read what it sent, all from one thread, so runs with the same arguments are alike.
+// Usage: ./screen-worms-fanout-bench [ticks] [clients...]
+
+namespace fanout_constant
+{
+    const size_t DEFAULT_TICKS = 500;
+    const std::vector<size_t> DEFAULT_CLIENTS = {100, 1000, 5000};
+
+    // First clients play, the rest watch.
+    const size_t PLAYERS = 25;
+
+    // Frames each queue holds, a turn of PLAYERS worms fits into one datagram.
+    const size_t TO_SERVER_QUEUE = 2;
+    const size_t TO_CLIENT_QUEUE = 16;
+
+    // One in this many heartbeats of a player picks new direction.
+    const uint32_t TURN_ODDS = 8;
+}
+
+// Player names sort in the same order as their numbers.
+std::string bench_name(size_t i)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "w%05zu", i);
+    return name;
+}
+
+// View of one virtual client.
+struct virtual_client
+{
+    std::string player_name;
+    uint8_t turn_direction;
+    uint32_t next_expected_event_no;
+};
+
+double elapsed_us(std::chrono::steady_clock::time_point begin)
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+}
+
+void run_clients(size_t clients_number, size_t ticks)
+{
+    auto settings(game_constant::DEFAULT_GAME_SETTINGS);
+    settings[game_constant::SEED] = 2021;
+    settings[game_constant::BOARD_WIDTH] = game_constant::MAX_WIDTH;
+    settings[game_constant::BOARD_HEIGHT] = game_constant::MAX_HEIGHT;
+    settings[game_constant::ROOM_SIZE] = game_constant::MAX_ROOM_SIZE;
+
+    MemoryTransport transport(clients_number, fanout_constant::TO_SERVER_QUEUE, fanout_constant::TO_CLIENT_QUEUE);
+    UDPServer server(settings, transport);
+    server.start();
+    Game game(settings, server);
+
+    std::vector<virtual_client> clients(clients_number);
+    for (size_t i = 0; i < clients_number; ++i)
+    {
+        if (i < fanout_constant::PLAYERS)
+            clients[i].player_name = bench_name(i);
+        clients[i].turn_direction = game_constant::FORWARD_TURN;
+        clients[i].next_expected_event_no = 0;
+    }
+
+    Randomiser steering(clients_number);
+    char mess[game_constant::BUFFER_SIZE];
+    auto send_heartbeats = [&]
+    {
+        for (size_t i = 0; i < clients_number; ++i)
+        {
+            auto &client = clients[i];
+            if (client.player_name.empty() == false && steering.rand() % fanout_constant::TURN_ODDS == 0)
+                client.turn_direction = steering.rand() % 3;
+            const size_t len = build_client_datagram(mess, i + 1, client.turn_direction,
+                                                     client.next_expected_event_no, client.player_name, 0);
+            transport.to_server(i).push(transport.client_address(i), mess, len);
+        }
+    };
+
+    // Players join before spectators, so the room counts only them when they are added.
+    send_heartbeats();
+    for (size_t i = 0; i < clients_number; ++i)
+    {
+        const auto datagram = server.receive_datagram();
+        game.add_player(datagram.player_name);
+    }
+    Randomiser randomiser(settings[game_constant::SEED]);
+    game.start(randomiser);
+
+    std::vector<double> turn_us, receive_us, read_us;
+    uint64_t datagrams = 0, events = 0;
+    bool over = false;
+    while (over == false && turn_us.size() < ticks)
+    {
+        send_heartbeats();
+        auto begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < clients_number; ++i)
+        {
+            const auto datagram = server.receive_datagram();
+            game.set_direction(datagram.player_name, datagram.turn_direction, datagram.received_ns);
+        }
+        receive_us.push_back(elapsed_us(begin));
+
+        begin = std::chrono::steady_clock::now();
+        over = game.make_turn();
+        turn_us.push_back(elapsed_us(begin));
+
+        begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < clients_number; ++i)
+        {
+            FrameQueue &queue = transport.to_client(i);
+            for (const frame *got = queue.front(); got != nullptr; queue.pop(), got = queue.front())
+            {
+                datagrams++;
+                RecordReader reader(got->data, got->len);
+                uint32_t game_id;
+                event_record record;
+                if (reader.read_game_id(game_id) == false)
+                    continue;
+                while (reader.next(record) == record_status::FINE)
+                {
+                    if (record.event_no == clients[i].next_expected_event_no)
+                    {
+                        clients[i].next_expected_event_no++;
+                        events++;
+                    }
+                }
+            }
+        }
+        read_us.push_back(elapsed_us(begin));
+    }
+
+    auto mean = [](const std::vector<double> &times)
+    {
+        double total = 0;
+        for (auto t: times)
+            total += t;
+        return total / times.size();
+    };
+    auto sorted = turn_us;
+    std::sort(sorted.begin(), sorted.end());
+
+    printf("clients=%zu ticks=%zu turn_mean_us=%.2f turn_p50_us=%.2f turn_p99_us=%.2f turn_max_us=%.2f "
+           "receive_mean_us=%.2f read_mean_us=%.2f datagrams_per_tick=%.1f events_per_tick=%.1f dropped=%u\n",
+           clients_number, turn_us.size(), mean(turn_us), sorted[sorted.size() / 2],
+           sorted[sorted.size() * 99 / 100], sorted.back(), mean(receive_us), mean(read_us),
+           (double) datagrams / turn_us.size(), (double) events / turn_us.size(), transport.get_dropped());
+}
+
+int main(int argc, char *argv[])
+{
+    size_t ticks = fanout_constant::DEFAULT_TICKS;
+    std::vector<size_t> clients = fanout_constant::DEFAULT_CLIENTS;
+
+    if (argc > 1)
+    {
+        if (is_integer(argv[1]) == false || atol(argv[1]) <= 0)
+        {
+            std::cerr << "Usage: " << argv[0] << " [ticks] [clients...]" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        ticks = atol(argv[1]);
+    }
+    if (argc > 2)
+    {
+        clients.clear();
+        for (int i = 2; i < argc; ++i)
+        {
+            if (is_integer(argv[i]) == false || atol(argv[i]) < 2
+                || (size_t) atol(argv[i]) > game_constant::MAX_ROOM_SIZE)
+            {
+                std::cerr << "Wrong number of clients." << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            clients.push_back(atol(argv[i]));
+        }
+    }
+
+    for (auto clients_number: clients)
+        run_clients(clients_number, ticks);
+}
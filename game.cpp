@@ -1,43 +1,42 @@
 #include "game.h"
 #include "game_constant.h"
+#include "phase_timer.h"
+#include "trace.h"
 #include <algorithm>
 #include <utility>
 #include <iostream>
 #include <cmath>
 #include <cstring>
-
-// Comparison for sorting players.
-bool compare_worms(const worm &A, const worm &B)
-{
-    return A.player < B.player;
-}
+#include <netinet/in.h>
 
 // Game settings.
-Game::Game(std::map<char, uint32_t> settings, UDPServer &_server) : server(_server)
+Game::Game(std::map<char, uint32_t> settings, EventSink &_sink) : sink(_sink)
 {
     game_id = 0;
     players_alive = 0;
     final_event = 0;
+    event_digest = 0;
+    turn_no = 0;
+    final_lockstep_event = 0;
+    serialize_ticks = 0;
+    wide_events = false;
+    room_size = settings[game_constant::ROOM_SIZE];
     width = settings[game_constant::BOARD_WIDTH];
     height = settings[game_constant::BOARD_HEIGHT];
     turning = settings[game_constant::TURNING];
+    rounds_per_sec = settings[game_constant::VELOCITY];
+    lockstep_hash_period = settings[game_constant::LOCKSTEP];
+    start_states = settings[game_constant::PREDICTION] != 0 || lockstep_hash_period > 0;
 }
 
 // Adding new player (not if there are already too many).
 void Game::add_player(std::string _player)
 {
     if (_player.empty() == false
-        && server.get_client_number() + server.get_empty_number() < game_constant::MAX_PLAYERS_NUMBER)
+        && sink.get_client_number() + sink.get_empty_number() < room_size
+        && known_players.insert(_player).second)
     {
-        worm new_worm;
-        new_worm.player = std::move(_player);
-        new_worm.is_out = true;
-
-        for (const auto &worm_unit: worm_status)
-            if (worm_unit.player == new_worm.player)
-                return;
-
-        worm_status.push_back(new_worm);
+        worms.names.push_back(std::move(_player));
     }
 }
 
@@ -45,26 +44,95 @@ void Game::add_player(std::string _player)
 void Game::start(Randomiser &randomiser)
 {
     game_id = randomiser.rand();
-    sort(worm_status.begin(), worm_status.end(), compare_worms);
-
-    size_t ind = 0;
-    for (auto &worm_unit: worm_status)
+    sort(worms.names.begin(), worms.names.end());
+    worms.prepare();
+    wide_events = needs_wide_events();
+    eaten_pixels.assign((size_t) width * height, false);
+    tiles.reset(width, height);
+    requested_direction.assign(worms.size(), game_constant::FORWARD_TURN);
+    requested_at.assign(worms.size(), 0);
+
+    for (size_t ind = 0; ind < worms.size(); ++ind)
     {
-        worm_unit.x = game_constant::CENTRE + randomiser.rand() % width;
-        worm_unit.y = game_constant::CENTRE + randomiser.rand() % height;
-        worm_unit.angle = randomiser.rand() % game_constant::FULL_ROTATE;
-        worm_unit.is_out = false;
+        worms.x[ind] = game_constant::CENTRE + randomiser.rand() % width;
+        worms.y[ind] = game_constant::CENTRE + randomiser.rand() % height;
+        worms.angle[ind] = randomiser.rand() % game_constant::FULL_ROTATE;
+        worms.pixel_x[ind] = (int32_t) worms.x[ind];
+        worms.pixel_y[ind] = (int32_t) worms.y[ind];
+        worms.alive[ind] = 1;
         players_alive++;
-        get_id[worm_unit.player] = ind++;
+        get_id[worms.names[ind]] = ind;
     }
 
     call_new_game();
+    if (start_states)
+        call_start_state();
+    // Both logs start alike, lockstep clients build the rest of events themselves.
+    if (lockstep_hash_period > 0)
+        lockstep_events = events_to_emit;
     make_turn(true);
 }
 
+// Adds length and checksum around event fields and stores the record, indexed by tile of its pixel if any.
+void Game::store_event(std::string message, const pixel *at)
+{
+    trace::Span span("serialize", events_to_emit.size());
+    if (at != nullptr)
+        tiles.add_pixel(events_to_emit.size(), *at);
+    else
+        tiles.add_global(events_to_emit.size());
+
+    const uint32_t len = htonl((uint32_t) message.size());
+    message = "llll" + message + "cccc";
+    memcpy(&message[0], &len, sizeof(len));
+
+    const uint32_t crc32_value = crc32(message.c_str(), message.size() - sizeof(crc32_value));
+    const uint32_t send_crc32 = htonl(crc32_value);
+    memcpy(&message[0] + message.size() - sizeof(send_crc32), &send_crc32, sizeof(send_crc32));
+
+    // Rotating digest of record checksums, compared by lockstep clients.
+    event_digest = (event_digest << 5 | event_digest >> 27) ^ crc32_value;
+    events_to_emit.push_back(message);
+    sink.get_stats().events.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Adds length and checksum around lockstep event fields and stores the record.
+void Game::store_lockstep_event(std::string message)
+{
+    trace::Span span("serialize lockstep", lockstep_events.size());
+    const uint32_t len = htonl((uint32_t) message.size());
+    message = "llll" + message + "cccc";
+    memcpy(&message[0], &len, sizeof(len));
+
+    const uint32_t crc32_value = htonl(crc32(message.c_str(), message.size() - sizeof(crc32_value)));
+    memcpy(&message[0] + message.size() - sizeof(crc32_value), &crc32_value, sizeof(crc32_value));
+
+    lockstep_events.push_back(message);
+}
+
+// Checks if room needs events with 2-byte player numbers and split player list.
+bool Game::needs_wide_events() const
+{
+    if (worms.size() > game_constant::MAX_NARROW_PLAYERS)
+        return true;
+
+    size_t list_len = 0;
+    for (const auto &name: worms.names)
+        list_len += name.size() + 1;
+
+    return list_len + 2 * sizeof(uint32_t) > game_constant::MAX_EVENT_DATA;
+}
+
 // New game event.
 void Game::call_new_game()
 {
+    if (wide_events)
+    {
+        call_new_game_wide();
+        sink.send_datagram(events_to_emit, game_id);
+        return;
+    }
+
     std::string message = "nono0maxxmaxy"; // event_no - event_type - maxx - maxy.
     message = message.substr(0, 13);
     const uint32_t event_no = htonl(0);
@@ -75,73 +143,164 @@ void Game::call_new_game()
     memcpy(&message[0] + sizeof(event_no), &type, sizeof(type));
     memcpy(&message[0] + sizeof(event_no) + sizeof(type), &send_width, sizeof(send_width));
     memcpy(&message[0] + sizeof(event_no) + sizeof(type) + sizeof(send_width), &send_height, sizeof(send_height));
-    for (const auto &worm_unit: worm_status)
-        message += worm_unit.player + '\0';
+    for (const auto &name: worms.names)
+        message += name + '\0';
 
     if (message.back() != '\0')
         message += '\0';
 
-    const uint32_t len = htonl((uint32_t) message.size());
-    message = "llll" + message + "cccc";
-    memcpy(&message[0], &len, sizeof(len));
+    store_event(message);
+    sink.send_datagram(events_to_emit, game_id);
+}
 
-    const uint32_t crc32_value = htonl(crc32(message.c_str(), message.size() - sizeof(crc32_value)));
-    memcpy(&message[0] + message.size() - sizeof(crc32_value), &crc32_value, sizeof(crc32_value));
+// New game event of large room, player list continues in PLAYER_LIST events.
+void Game::call_new_game_wide()
+{
+    std::string message = "nono4maxxmaxycccc"; // event_no - event_type - maxx - maxy - players count.
+    message = message.substr(0, 17);
+    const uint32_t event_no = htonl(0);
+    const uint8_t type = game_constant::NEW_GAME_WIDE;
+    const uint32_t send_width  = htonl(width);
+    const uint32_t send_height = htonl(height);
+    const uint32_t send_count = htonl((uint32_t) worms.size());
+    memcpy(&message[0], &event_no, sizeof(event_no));
+    memcpy(&message[0] + sizeof(event_no), &type, sizeof(type));
+    memcpy(&message[0] + sizeof(event_no) + sizeof(type), &send_width, sizeof(send_width));
+    memcpy(&message[0] + sizeof(event_no) + sizeof(type) + sizeof(send_width), &send_height, sizeof(send_height));
+    memcpy(&message[0] + sizeof(event_no) + sizeof(type) + sizeof(send_width) + sizeof(send_height),
+           &send_count, sizeof(send_count));
 
-    events_to_emit.push_back(message);
-    server.send_datagram(events_to_emit, game_id);
+    // Each record holds as many names as fits in single datagram.
+    const size_t header_len = sizeof(event_no) + sizeof(type);
+    for (const auto &name: worms.names)
+    {
+        if (message.size() - header_len + name.size() + 1 > game_constant::MAX_EVENT_DATA)
+        {
+            store_event(message);
+            message = "nono5"; // event_no - event_type - names.
+            const uint32_t list_event_no = htonl((uint32_t) events_to_emit.size());
+            const uint8_t list_type = game_constant::PLAYER_LIST;
+            memcpy(&message[0], &list_event_no, sizeof(list_event_no));
+            memcpy(&message[0] + sizeof(list_event_no), &list_type, sizeof(list_type));
+        }
+        message += name + '\0';
+    }
+
+    store_event(message);
+}
+
+// Start angles with turning and speed, lets clients repeat moves of worms.
+void Game::call_start_state()
+{
+    const uint32_t send_turning = htonl(turning);
+    const uint32_t send_rounds = htonl(rounds_per_sec);
+    const uint8_t type = game_constant::START_STATE;
+
+    for (size_t first = 0; first < worms.size(); first += game_constant::MAX_START_ANGLES)
+    {
+        // event_no - event_type - turning - rounds per second - first player - angles.
+        std::string message(sizeof(uint32_t) + sizeof(type) + 3 * sizeof(uint32_t), '\0');
+        const uint32_t event_no = htonl((uint32_t) events_to_emit.size());
+        const uint32_t send_first = htonl((uint32_t) first);
+        memcpy(&message[0], &event_no, sizeof(event_no));
+        memcpy(&message[0] + sizeof(event_no), &type, sizeof(type));
+        memcpy(&message[0] + sizeof(event_no) + sizeof(type), &send_turning, sizeof(send_turning));
+        memcpy(&message[0] + sizeof(event_no) + sizeof(type) + sizeof(send_turning),
+               &send_rounds, sizeof(send_rounds));
+        memcpy(&message[0] + sizeof(event_no) + sizeof(type) + sizeof(send_turning) + sizeof(send_rounds),
+               &send_first, sizeof(send_first));
+
+        const size_t last = std::min(worms.size(), first + game_constant::MAX_START_ANGLES);
+        for (size_t id = first; id < last; ++id)
+        {
+            const uint16_t send_angle = htons((uint16_t) worms.angle[id]);
+            message.append((const char *) &send_angle, sizeof(send_angle));
+        }
+
+        store_event(message);
+    }
 }
 
 // Eaten pixel event.
-void Game::call_pixel(const pixel &p, uint8_t player_id)
+void Game::call_pixel(const pixel &p, size_t player_id)
 {
+    TickSpan span(serialize_ticks);
+    if (wide_events)
+    {
+        call_pixel_wide(p, player_id);
+        return;
+    }
+
     std::string message = "nono1pwwwwhhhh"; // event_no - event_type - player - x - y.
     message = message.substr(0, 14);
     const uint32_t event_no = htonl((uint32_t)events_to_emit.size());
     const uint8_t type = 1;
+    const uint8_t send_id = player_id;
     const uint32_t send_x = htonl(p.x);
     const uint32_t send_y = htonl(p.y);
     memcpy(&message[0], &event_no, sizeof(event_no));
     memcpy(&message[0] + sizeof(event_no), &type, sizeof(type));
-    memcpy(&message[0] + sizeof(event_no) + sizeof(type), &player_id, sizeof(player_id));
-    memcpy(&message[0] + sizeof(event_no) + sizeof(type) + sizeof(player_id), &send_x, sizeof(send_x));
-    memcpy(&message[0] + sizeof(event_no) + sizeof(type) + sizeof(player_id) + sizeof(send_x), &send_y, sizeof(send_y));
+    memcpy(&message[0] + sizeof(event_no) + sizeof(type), &send_id, sizeof(send_id));
+    memcpy(&message[0] + sizeof(event_no) + sizeof(type) + sizeof(send_id), &send_x, sizeof(send_x));
+    memcpy(&message[0] + sizeof(event_no) + sizeof(type) + sizeof(send_id) + sizeof(send_x), &send_y, sizeof(send_y));
 
-    const uint32_t len = htonl((uint32_t) message.size());
-    message = "llll" + message + "cccc";
-    memcpy(&message[0], &len, sizeof(len));
+    store_event(message, &p);
+}
 
-    const uint32_t crc32_value = htonl(crc32(message.c_str(), message.size() - sizeof(crc32_value)));
-    memcpy(&message[0] + message.size() - sizeof(crc32_value), &crc32_value, sizeof(crc32_value));
+// Eaten pixel event with 2-byte player number.
+void Game::call_pixel_wide(const pixel &p, size_t player_id)
+{
+    std::string message = "nono6ppwwwwhhhh"; // event_no - event_type - player - x - y.
+    message = message.substr(0, 15);
+    const uint32_t event_no = htonl((uint32_t)events_to_emit.size());
+    const uint8_t type = game_constant::PIXEL_WIDE;
+    const uint16_t send_id = htons((uint16_t) player_id);
+    const uint32_t send_x = htonl(p.x);
+    const uint32_t send_y = htonl(p.y);
+    memcpy(&message[0], &event_no, sizeof(event_no));
+    memcpy(&message[0] + sizeof(event_no), &type, sizeof(type));
+    memcpy(&message[0] + sizeof(event_no) + sizeof(type), &send_id, sizeof(send_id));
+    memcpy(&message[0] + sizeof(event_no) + sizeof(type) + sizeof(send_id), &send_x, sizeof(send_x));
+    memcpy(&message[0] + sizeof(event_no) + sizeof(type) + sizeof(send_id) + sizeof(send_x), &send_y, sizeof(send_y));
 
-    events_to_emit.push_back(message);
+    store_event(message, &p);
 }
 
 // Player eliminated event.
-void Game::call_eliminated(uint8_t player_id)
+void Game::call_eliminated(size_t player_id)
 {
+    TickSpan span(serialize_ticks);
+    if (wide_events)
+    {
+        std::string message = "nono7pp"; // event_no - event_type - player
+        const uint32_t event_no = htonl((uint32_t)events_to_emit.size());
+        const uint8_t type = game_constant::PLAYER_ELIMINATED_WIDE;
+        const uint16_t send_id = htons((uint16_t) player_id);
+        memcpy(&message[0], &event_no, sizeof(event_no));
+        memcpy(&message[0] + sizeof(event_no), &type, sizeof(type));
+        memcpy(&message[0] + sizeof(event_no) + sizeof(type), &send_id, sizeof(send_id));
+
+        store_event(message);
+        return;
+    }
+
     std::string message = "nono2p"; // event_no - event_type - player
     message = message.substr(0, 6);
     const uint32_t event_no = htonl((uint32_t)events_to_emit.size());
     const uint8_t type = 2;
+    const uint8_t send_id = player_id;
 
     memcpy(&message[0], &event_no, sizeof(event_no));
     memcpy(&message[0] + sizeof(event_no), &type, sizeof(type));
-    memcpy(&message[0] + sizeof(event_no) + sizeof(type), &player_id, sizeof(player_id));
-
-    const uint32_t len = htonl((uint32_t) message.size());
-    message = "llll" + message + "cccc";
-    memcpy(&message[0], &len, sizeof(len));
+    memcpy(&message[0] + sizeof(event_no) + sizeof(type), &send_id, sizeof(send_id));
 
-    const uint32_t crc32_value = htonl(crc32(message.c_str(), message.size() - sizeof(crc32_value)));
-    memcpy(&message[0] + message.size() - sizeof(crc32_value), &crc32_value, sizeof(crc32_value));
-
-    events_to_emit.push_back(message);
+    store_event(message);
 }
 
 // Game over event.
 void Game::call_game_over()
 {
+    TickSpan span(serialize_ticks);
     std::string message = "nono3"; // event_no - event_type - player
     message = message.substr(0, 5);
     final_event = events_to_emit.size();
@@ -150,97 +309,244 @@ void Game::call_game_over()
     memcpy(&message[0], &event_no, sizeof(event_no));
     memcpy(&message[0] + sizeof(event_no), &type, sizeof(type));
 
-    const uint32_t len = htonl((uint32_t) message.size());
-    message = "llll" + message + "cccc";
-    memcpy(&message[0], &len, sizeof(len));
+    store_event(message);
+}
 
-    const uint32_t crc32_value = htonl(crc32(message.c_str(), message.size() - sizeof(crc32_value)));
-    memcpy(&message[0] + message.size() - sizeof(crc32_value), &crc32_value, sizeof(crc32_value));
+// Directions applied in the turn, 2 bits per worm, split like player list of large rooms.
+void Game::call_turn_inputs()
+{
+    TickSpan span(serialize_ticks);
+    const uint8_t type = game_constant::TURN_INPUTS;
+    const uint32_t send_turn = htonl(turn_no);
 
-    events_to_emit.push_back(message);
+    for (size_t first = 0; first < worms.size(); first += game_constant::MAX_TURN_INPUT_WORMS)
+    {
+        // event_no - event_type - turn - first worm - directions.
+        std::string message(sizeof(uint32_t) + sizeof(type) + 2 * sizeof(uint32_t), '\0');
+        const uint32_t event_no = htonl((uint32_t) lockstep_events.size());
+        const uint32_t send_first = htonl((uint32_t) first);
+        memcpy(&message[0], &event_no, sizeof(event_no));
+        memcpy(&message[0] + sizeof(event_no), &type, sizeof(type));
+        memcpy(&message[0] + sizeof(event_no) + sizeof(type), &send_turn, sizeof(send_turn));
+        memcpy(&message[0] + sizeof(event_no) + sizeof(type) + sizeof(send_turn), &send_first, sizeof(send_first));
+
+        const size_t last = std::min(worms.size(), first + game_constant::MAX_TURN_INPUT_WORMS);
+        const size_t directions_at = message.size();
+        message.resize(directions_at + (last - first + game_constant::DIRECTIONS_PER_BYTE - 1)
+                                       / game_constant::DIRECTIONS_PER_BYTE, '\0');
+        for (size_t id = first; id < last; ++id)
+        {
+            const size_t index = id - first;
+            message[directions_at + index / game_constant::DIRECTIONS_PER_BYTE] |=
+                    (char) (worms.direction[id] << 2 * (index % game_constant::DIRECTIONS_PER_BYTE));
+        }
+
+        store_lockstep_event(message);
+    }
+}
+
+// Number and digest of events after the turn, lockstep clients check their own against it.
+void Game::call_state_hash()
+{
+    TickSpan span(serialize_ticks);
+    std::string message = "nono9ttttccccdddd"; // event_no - event_type - turn - event count - digest.
+    const uint32_t event_no = htonl((uint32_t) lockstep_events.size());
+    const uint8_t type = game_constant::STATE_HASH;
+    const uint32_t send_turn = htonl(turn_no);
+    const uint32_t send_count = htonl((uint32_t) events_to_emit.size());
+    const uint32_t send_digest = htonl(event_digest);
+    memcpy(&message[0], &event_no, sizeof(event_no));
+    memcpy(&message[0] + sizeof(event_no), &type, sizeof(type));
+    memcpy(&message[0] + sizeof(event_no) + sizeof(type), &send_turn, sizeof(send_turn));
+    memcpy(&message[0] + sizeof(event_no) + sizeof(type) + sizeof(send_turn), &send_count, sizeof(send_count));
+    memcpy(&message[0] + sizeof(event_no) + sizeof(type) + sizeof(send_turn) + sizeof(send_count),
+           &send_digest, sizeof(send_digest));
+
+    store_lockstep_event(message);
+}
+
+// Game over event of lockstep log.
+void Game::call_lockstep_game_over()
+{
+    TickSpan span(serialize_ticks);
+    std::string message = "nono3"; // event_no - event_type
+    final_lockstep_event = lockstep_events.size();
+    const uint32_t event_no = htonl(final_lockstep_event);
+    const uint8_t type = 3;
+    memcpy(&message[0], &event_no, sizeof(event_no));
+    memcpy(&message[0] + sizeof(event_no), &type, sizeof(type));
+
+    store_lockstep_event(message);
 }
 
-// Updates player's direction.
-void Game::set_direction(const std::string &player, uint8_t _direction)
+// Updates player's direction, worm turns that way from the next turn.
+void Game::set_direction(const std::string &player, uint8_t _direction, int64_t received_ns)
 {
     if (get_id.find(player) != get_id.end())
     {
         const auto id = get_id[player];
-        if (worm_status[id].is_out == false)
-            worm_status[id].direction = _direction;
+        if (worms.alive[id] == 0)
+            return;
+
+        if (_direction != requested_direction[id] && requested_at[id] == 0)
+            requested_at[id] = received_ns;
+        requested_direction[id] = _direction;
     }
 }
 
-// Checks if player is out of board.
-bool Game::is_outposition(const pixel &p) const
+// Position of pixel in eaten pixels bitmap.
+size_t Game::pixel_index(const pixel &p) const
 {
-    return p.x + 1 == 0 || p.y + 1 == 0 || p.x == width || p.y == height;
+    return (size_t) p.y * width + p.x;
+}
+
+// Takes worm out of the game, returns true if game is over.
+bool Game::eliminate(size_t id)
+{
+    worms.alive[id] = 0;
+    call_eliminated(id);
+    players_alive--;
+    if (players_alive == 1)
+    {
+        call_game_over();
+        return true;
+    }
+    return false;
 }
 
 // One turn of game.
 bool Game::make_turn(bool first_iteration)
 {
-    server.check_sleepers();
-
-    for (auto &worm_unit: worm_status)
+    trace::Span turn_span("turn", turn_no);
+    ServerStats &stats = sink.get_stats();
+    const uint64_t turn_start = read_ticks();
+    sink.check_sleepers();
+    uint64_t phase_start = read_ticks();
+    stats.check_sleepers.record(phase_start - turn_start);
+    serialize_ticks = 0;
+
+    // Worms eat their starting pixels before the first move.
+    if (first_iteration)
     {
-        if (worm_unit.is_out)
-            continue;
-
-        pixel last_pos(worm_unit.x, worm_unit.y);
-        worm_unit.x += std::cos(game_constant::RADIAN_RATIO * worm_unit.angle);
-        worm_unit.y += std::sin(game_constant::RADIAN_RATIO * worm_unit.angle);
+        for (size_t id = 0; id < worms.size(); ++id)
+        {
+            const pixel start_pos((uint32_t) worms.pixel_x[id], (uint32_t) worms.pixel_y[id]);
+            if (eaten_pixels[pixel_index(start_pos)])
+            {
+                if (eliminate(id))
+                    break;
+                continue;
+            }
 
-        const auto direction = worm_unit.direction;
-        worm_unit.angle -= direction == game_constant::LEFT_TURN ? turning : 0;
-        worm_unit.angle += direction == game_constant::RIGHT_TURN ? turning : 0;
-        worm_unit.angle %= game_constant::FULL_ROTATE;
+            call_pixel(start_pos, id);
+            eaten_pixels[pixel_index(start_pos)] = true;
+        }
+    }
+    else
+    {
+        // Directions are taken once per turn, so lockstep log holds exactly those applied.
+        trace::Span span("apply inputs");
+        turn_no++;
+        for (size_t id = 0; id < worms.size(); ++id)
+        {
+            if (worms.alive[id])
+                worms.direction[id] = requested_direction[id];
+            if (requested_at[id] != 0)
+            {
+                sink.record_apply_delay(requested_at[id]);
+                requested_at[id] = 0;
+            }
+        }
+        if (lockstep_hash_period > 0)
+            call_turn_inputs();
+    }
 
-        pixel new_pos(worm_unit.x, worm_unit.y);
+    {
+        trace::Span span("simulate");
+        worms.move_all(turning, width, height);
+    }
 
-        if (first_iteration)
-            new_pos = last_pos;
-        else if (new_pos == last_pos)
-            continue;
+    // Events of the first turn and turn inputs count as serialization, not movement.
+    uint64_t phase_end = read_ticks();
+    const uint64_t movement_serialize_ticks = serialize_ticks;
+    stats.movement.record(phase_end - phase_start - movement_serialize_ticks);
+    phase_start = phase_end;
 
-        if (eaten_pixels.find(new_pos) != eaten_pixels.end())
+    {
+        trace::Span span("collide");
+        for (size_t id = 0; first_iteration == false && id < worms.size(); ++id)
         {
-            worm_unit.is_out = true;
-            call_eliminated(get_id[worm_unit.player]);
-            players_alive--;
-            if (players_alive == 1)
+            if (worms.alive[id] == 0 || worms.move_result[id] == worm_storage_constant::STAYED)
+                continue;
+
+            const pixel new_pos((uint32_t) worms.pixel_x[id], (uint32_t) worms.pixel_y[id]);
+            if (worms.move_result[id] == worm_storage_constant::OUT_OF_BOARD
+                || eaten_pixels[pixel_index(new_pos)])
             {
-                call_game_over();
-                break;
+                if (eliminate(id))
+                    break;
+                continue;
             }
-            continue;
+
+            call_pixel(new_pos, id);
+            eaten_pixels[pixel_index(new_pos)] = true;
         }
 
-        if (is_outposition(new_pos))
+        if (lockstep_hash_period > 0)
         {
-            worm_unit.is_out = true;
-            call_eliminated(get_id[worm_unit.player]);
-            players_alive--;
+            if (turn_no % lockstep_hash_period == 0)
+                call_state_hash();
             if (players_alive == 1)
-            {
-                call_game_over();
-                break;
-            }
-            continue;
+                call_lockstep_game_over();
         }
+    }
+
+    phase_end = read_ticks();
+    stats.collision.record(phase_end - phase_start - (serialize_ticks - movement_serialize_ticks));
+    stats.serialization.record(serialize_ticks);
 
-        call_pixel(new_pos, get_id[worm_unit.player]);
-        eaten_pixels.insert(new_pos);
+    {
+        trace::Span span("fan out");
+        sink.send_datagram(events_to_emit, lockstep_events, tiles, game_id);
     }
-    
-    server.send_datagram(events_to_emit, game_id);
+    const uint64_t turn_end = read_ticks();
+    stats.fan_out.record(turn_end - phase_end);
+    stats.turn.record(turn_end - turn_start);
+    stats.turns.fetch_add(1, std::memory_order_relaxed);
     return players_alive == 1;
 }
 
+// Sends events of the finished game again to clients which have not got them.
+void Game::resend_log()
+{
+    trace::Span span("fan out");
+    sink.send_datagram(events_to_emit, lockstep_events, tiles, game_id);
+}
+
 // Utility function for last barrier.
 uint32_t Game::get_final_event()
 {
     return final_event;
 }
 
+// Number of events generated so far.
+uint32_t Game::get_event_count()
+{
+    return events_to_emit.size();
+}
 
+// Last event of log sent to clients asking for lockstep, events when lockstep is disabled.
+uint32_t Game::get_final_lockstep_event()
+{
+    return lockstep_hash_period > 0 ? final_lockstep_event : final_event;
+}
+
+const std::vector<std::string> &Game::get_events() const
+{
+    return events_to_emit;
+}
+
+uint32_t Game::get_event_digest() const
+{
+    return event_digest;
+}
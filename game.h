@@ -11,14 +11,15 @@
 #include <unordered_set>
 #include "game_constant.h"
 #include "randomiser.h"
-#include "UDP_server.h"
+#include "event_sink.h"
+#include "worm_storage.h"
 
 class Game
 {
     public:
     Game() = delete;
 
-    Game(std::map<char, uint32_t>, UDPServer &);
+    Game(std::map<char, uint32_t>, EventSink &);
 
     void add_player(std::string);
 
@@ -26,32 +27,89 @@ class Game
 
     bool make_turn(bool = false);
 
-    void set_direction(const std::string &player, uint8_t turn);
+    // Sends the log once more after game over, when turns no longer do it.
+    void resend_log();
+
+    // Receive time of the datagram, if known, is kept until the turn applies the direction.
+    void set_direction(const std::string &player, uint8_t turn, int64_t received_ns = 0);
 
     uint32_t get_final_event();
 
+    uint32_t get_event_count();
+
+    uint32_t get_final_lockstep_event();
+
+    // Events generated so far and digest of them, for clients running the game locally.
+    const std::vector<std::string> &get_events() const;
+
+    uint32_t get_event_digest() const;
+
+    // Microbenchmarks time serialisation and collision lookups on their own.
+    friend struct GameBench;
+
     private:
     uint32_t width;
     uint32_t height;
     uint32_t turning;
+    uint32_t rounds_per_sec;
     uint32_t game_id;
     std::map<std::string, size_t> get_id;
-    std::vector<worm> worm_status;
-    std::set<pixel> eaten_pixels;
+    WormStorage worms;
+    uint32_t room_size;
+    std::unordered_set<std::string> known_players;
+    // Eaten pixels as bitmap of the board.
+    std::vector<bool> eaten_pixels;
+    bool wide_events;
     uint32_t players_alive;
-    UDPServer &server;
+    EventSink &sink;
     std::vector<std::string> events_to_emit;
+    // Events by board tile, for clients watching a viewport.
+    TileIndex tiles;
     uint32_t final_event;
+    uint32_t event_digest;
+    // Directions set between turns, applied at the start of next turn.
+    std::vector<uint8_t> requested_direction;
+    // Receive time of the first change of requested direction not applied yet, 0 if there is none.
+    std::vector<int64_t> requested_at;
+    uint32_t turn_no;
+    // START_STATE events are stored, asked for by option or needed by lockstep clients.
+    bool start_states;
+    // Lockstep log: events up to START_STATE, then inputs of every turn, state hashes and game over.
+    uint32_t lockstep_hash_period;
+    std::vector<std::string> lockstep_events;
+    uint32_t final_lockstep_event;
+    // Ticks spent making events during the current turn.
+    uint64_t serialize_ticks;
+
+    [[nodiscard]] size_t pixel_index(const pixel &p) const;
+
+    [[nodiscard]] bool needs_wide_events() const;
 
-    [[nodiscard]] bool is_outposition(const pixel &p) const;
+    bool eliminate(size_t);
+
+    void store_event(std::string, const pixel *at = nullptr);
+
+    void store_lockstep_event(std::string);
 
     void call_new_game();
 
-    void call_pixel(const pixel &p, uint8_t);
+    void call_new_game_wide();
+
+    void call_start_state();
+
+    void call_pixel(const pixel &p, size_t);
 
-    void call_eliminated(uint8_t);
+    void call_pixel_wide(const pixel &p, size_t);
+
+    void call_eliminated(size_t);
 
     void call_game_over();
+
+    void call_turn_inputs();
+
+    void call_state_hash();
+
+    void call_lockstep_game_over();
 };
 
 #endif //ROBALETHEGAME_GAME_H
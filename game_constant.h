@@ -6,12 +6,13 @@
 #include <map>
 #include <cstdint>
 #include <string>
+#include <ctime>
 
 namespace game_constant
 {
     // Constants for parsing data.
     // For Server:
-    const char SERVER_OPTSTRING[] = "p:s:t:v:w:h:";
+    const char SERVER_OPTSTRING[] = "p:s:t:v:w:h:m:k:l:e:g:r:o:a:";
 
     const char PORT = 'p';
     const size_t MIN_PORT = 1024;
@@ -35,14 +36,60 @@ namespace game_constant
     const size_t MIN_HEIGHT = 16;
     const size_t MAX_HEIGHT = 1080;
 
+    // Maximal number of players in room, above 25 enables large room events.
+    const char ROOM_SIZE = 'm';
+    const size_t MIN_ROOM_SIZE = 2;
+    const size_t MAX_ROOM_SIZE = 10000;
+
+    // Lockstep log for clients simulating the game, value is period of state hashes in turns (0 disables it).
+    // Client option of the same letter asks for the lockstep log.
+    const char LOCKSTEP = 'k';
+    const size_t MAX_LOCKSTEP_HASH_PERIOD = 10000;
+
+    // START_STATE events in the ordinary log (1 sends them, 0 only in lockstep mode, whose log starts with them).
+    // Client option of the same letter predicts own worm from them.
+    const char PREDICTION = 'l';
+
+    // TCP port streaming events to spectators (0 disables it), client option of the same letter uses it.
+    const char STREAM_PORT = 'e';
+
+    // Percent of turn interval over which sends to clients are spread (0 sends them back to back).
+    const char PACING = 'g';
+    const size_t MAX_PACING = 100;
+    // Clients whose slots are closer than this go without waiting between them.
+    const int64_t PACING_MIN_SLEEP_NS = 200000;
+
+    // Receive and send buffer of the server socket in bytes (0 keeps system default).
+    const char RECEIVE_BUFFER = 'r';
+    const char SEND_BUFFER = 'o';
+
+    // Loopback TCP port serving turn phase times and counters (0 disables it), clients answered at once.
+    const char ADMIN_PORT = 'a';
+    const int ADMIN_MAX_ANSWERING = 4;
+    // Wait before accepting again after an error other than an interrupted or aborted connection.
+    const int64_t ADMIN_ACCEPT_BACKOFF_MS = 100;
+
+    // Spans kept per thread while tracing, time given to started spans to end, longest capture asked for.
+    const uint64_t TRACE_RING_SPANS = 1 << 16;
+    const int64_t TRACE_SETTLE_MS = 5;
+    const int64_t TRACE_MAX_MS = 10000;
+
     const std::map<char, uint32_t> DEFAULT_GAME_SETTINGS = {{PORT, 2021}, {SEED, time(nullptr)}, {TURNING, 6},
-                                                          {VELOCITY, 50}, {BOARD_WIDTH, 640}, {BOARD_HEIGHT, 480}};
+                                                          {VELOCITY, 50}, {BOARD_WIDTH, 640}, {BOARD_HEIGHT, 480},
+                                                          {ROOM_SIZE, 25}, {LOCKSTEP, 0}, {PREDICTION, 0},
+                                                          {STREAM_PORT, 0},
+                                                          {PACING, 0}, {RECEIVE_BUFFER, 0}, {SEND_BUFFER, 0},
+                                                          {ADMIN_PORT, 0}};
 
     // For player:
-    const char PLAYER_OPTSTRING[] = "n:p:i:r:";
+    const char PLAYER_OPTSTRING[] = "n:p:i:r:blkw:e:";
     const char NAME_OF_PLAYER = 'n';
     const char GUI_SERVER = 'i';
     const char GUI_PORT = 'r';
+    const char BATCH_PIXELS = 'b';
+    const char LOCAL_PREDICTION = 'l';
+    // Part of board watched, given as x,y,width,height.
+    const char VIEWPORT = 'w';
 
     const size_t DEFAULT_PORT = 2021;
     const std::string DEFAULT_SERVER = "localhost";
@@ -78,6 +125,17 @@ namespace game_constant
     const size_t SESSION_ID_LENGTH = 8;
     const size_t TURN_LENGTH = 1;
     const size_t NEXT_EVENT_LENGTH = 4;
+    const size_t HELD_RANGE_LENGTH = 8;
+
+    // Optional flags byte after held range, lockstep flag asks for lockstep log.
+    const size_t FLAGS_LENGTH = 1;
+    const uint8_t LOCKSTEP_FLAG = 1;
+    // Viewport flag is followed by left, top, right and bottom edge (right and bottom excluded).
+    const uint8_t VIEWPORT_FLAG = 2;
+    const size_t VIEWPORT_LENGTH = 16;
+
+    // Number of events after the expected one which client keeps when they arrive early.
+    const uint32_t REORDER_WINDOW = 1024;
 
     const uint8_t FORWARD_TURN = 0;
     const uint8_t RIGHT_TURN = 1;
@@ -88,8 +146,84 @@ namespace game_constant
     const std::string GUI_FORWARD = "LEFT_KEY_UP";
     const std::string GUI_FORWARD2 = "RIGHT_KEY_UP";
 
+    // Longer lines from GUI are ignored.
+    const size_t MAX_GUI_LINE = 64;
+
+    // Pixels in one PIXELS command, keeps line within token and buffer limits of GUI.
+    const size_t MAX_BATCHED_PIXELS = 40;
+
+    // Local prediction of own worm: lead search step as part of turn, longest lead and
+    // turns searched for next pixel (worm leaves its pixel within two turns).
+    const int64_t PREDICTION_LEAD_STEPS_PER_TURN = 4;
+    const int64_t MAX_PREDICTION_LEAD_NS = 1000000000;
+    const int64_t PREDICTION_TURNS_PER_PIXEL = 4;
+    // Confirmed states kept for replay and weight of newest arrival in turn timing.
+    const size_t PREDICTION_CHECKPOINTS = 64;
+    const int64_t PREDICTION_ANCHOR_WEIGHT = 8;
+    // Lead search on mismatch runs on the event loop: newest checkpoints replayed from and moves
+    // it may take before prediction is given up.
+    const size_t PREDICTION_SEARCH_CHECKPOINTS = 16;
+    const int64_t PREDICTION_SEARCH_STEPS = 8000;
+    // Predicted pixels are drawn several times per turn, as turns are not aligned with the timer.
+    const int64_t PREDICTION_DRAWS_PER_TURN = 4;
+
+    // Time given to local GUI to accept shared memory ring.
+    const time_t RING_HANDSHAKE_TIMEOUT_S = 2;
+
+    // Pending GUI output above which client gives up on GUI.
+    const size_t MAX_GUI_BACKLOG = 1 << 26;
+
+    // Descriptors handled in one epoll_wait call of client.
+    const int MAX_EPOLL_EVENTS = 8;
+
+    // Number of direction changes summarised in one latency report (DEBUG builds).
+    const int64_t LATENCY_REPORT_EVERY = 100;
+
     const size_t MAX_UDP_SIZE = 550;
 
+    // Longest event_data fitting into one datagram with game_id, len, event_no, event_type and crc32.
+    const size_t MAX_EVENT_DATA = MAX_UDP_SIZE - 4 * sizeof(uint32_t) - sizeof(uint8_t);
+
+    // Event types of large rooms: 2-byte player numbers and player list split into several records.
+    const uint8_t NEW_GAME_WIDE = 4;
+    const uint8_t PLAYER_LIST = 5;
+    const uint8_t PIXEL_WIDE = 6;
+    const uint8_t PLAYER_ELIMINATED_WIDE = 7;
+
+    // Turning, rounds per second, first player and 2-byte start angles of worms from that one on.
+    const uint8_t START_STATE = 8;
+    const size_t MAX_START_ANGLES = (MAX_EVENT_DATA - 3 * sizeof(uint32_t)) / sizeof(uint16_t);
+
+    // Lockstep log events: turn, first worm and directions applied in the turn (2 bits per worm, lowest first),
+    // turn, number of events and digest of the event log after the turn.
+    const uint8_t TURN_INPUTS = 9;
+    const uint8_t STATE_HASH = 10;
+    const size_t DIRECTIONS_PER_BYTE = 4;
+    const size_t MAX_TURN_INPUT_WORMS = (MAX_EVENT_DATA - 2 * sizeof(uint32_t)) * DIRECTIONS_PER_BYTE;
+
+    // Starts each datagram for clients watching a viewport: events from its number up to the one in data
+    // that are not in the datagram are outside the viewport. Pixels are indexed by square tiles of the board.
+    const uint8_t VIEWPORT_SKIP = 11;
+    const uint32_t VIEWPORT_TILE = 64;
+
+    // Event stream over TCP: client sends game_id and next expected event number, server writes frames
+    // of 4-byte length followed by game_id and records, as in datagrams. Frames are cut after some events,
+    // the rest of a frame is copied only when the socket does not take it at once.
+    const size_t STREAM_HANDSHAKE_LENGTH = 8;
+    // Connections without whole handshake after this time are closed.
+    const int64_t STREAM_HANDSHAKE_TIMEOUT_NS = 5000000000;
+    const size_t STREAM_FRAME_EVENTS = 256;
+    const int STREAM_BACKLOG = 16;
+
+    // Datagrams of one burst to a client leave in one send with UDP segmentation offload, all but the last
+    // padded with zeros to MAX_UDP_SIZE; receivers stop reading records at the padding as at a cut record.
+    const size_t GSO_MAX_SEGMENTS = 64;
+    // Buffer for datagrams coalesced by UDP_GRO on receive.
+    const size_t GRO_BUFFER_SIZE = 65536;
+
+    // Player numbers above this one do not fit into 1 byte.
+    const size_t MAX_NARROW_PLAYERS = 256;
+
     // Pixel positioning.
     const long double CENTRE = 0.5;
     const long FULL_ROTATE = 360;
@@ -98,6 +232,10 @@ namespace game_constant
     // Length of client inverval in nanoseconds.
     const uint32_t INTEVAL_LENGTH_NS = 30000000;
 
+    // Client heartbeat while events are missing and while it is caught up.
+    const uint32_t HEARTBEAT_FAST_NS = 10000000;
+    const uint32_t HEARTBEAT_IDLE_NS = 2 * INTEVAL_LENGTH_NS;
+
     const uint32_t TIMEOUT_LENGTH_NS = 2000000000;
 
     const size_t MAX_PLAYERS_NUMBER = 25;
@@ -105,17 +243,6 @@ namespace game_constant
     const size_t BUFFER_SIZE = 4096;
 }
 
-// Struct for holding information on each player
-struct worm
-{
-    std::string player;
-    long double x;
-    long double y;
-    long angle;
-    uint8_t direction;
-    bool is_out;
-};
-
 // Auxiliary structure for point/pixel.
 struct pixel
 {
@@ -0,0 +1,796 @@
+#include <iostream>
+#include <fstream>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <chrono>
+#include <charconv>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <set>
+#include <algorithm>
+#include "game_constant.h"
+#include "event_record.h"
+#include "client_datagram.h"
+#include "GUI/shm_ring.h"
+
+// Headless stand-in for the GUI server.
+// Accepts one client, checks its commands, injects key events and reports throughput.
+// Usage: ./screen-worms-gui-sink [-r n] [-d seconds] [-k period_ms | -f script] [-s game_server [-p n]] [-u]
+
+namespace sink_constant
+{
+    const char SINK_OPTSTRING[] = "r:d:k:f:s:p:u";
+    const char DURATION = 'd';
+    const char KEY_PERIOD = 'k';
+    const char KEY_SCRIPT = 'f';
+    const char GAME_SERVER = 's';
+    const char SHARED_RING = 'u';
+
+    const int64_t NS_IN_MS = 1000000;
+    const int64_t REPORT_PERIOD_NS = 1000000000;
+
+    // Violations printed in full, the rest is only counted.
+    const size_t PRINTED_VIOLATIONS = 10;
+
+    const size_t READ_CHUNK = 1 << 16;
+    const int MAX_EPOLL_EVENTS = 8;
+
+    const std::string NEW_GAME = "NEW_GAME";
+    const std::string PIXEL = "PIXEL";
+    const std::string PIXELS = "PIXELS";
+    const std::string PLAYER_ELIMINATED = "PLAYER_ELIMINATED";
+    const std::string ERASE = "ERASE";
+}
+
+// Auxiliary struct for holding sink settings.
+struct sink_settings
+{
+    size_t gui_port = game_constant::DEFAULT_GUI_PORT;
+    size_t duration = 0;
+    std::string server_name;
+    size_t server_port = game_constant::DEFAULT_PORT;
+    bool shared_ring = false;
+    // Key events with delay after previous one, repeated in loop.
+    std::vector<std::pair<int64_t, std::string>> key_script;
+};
+
+// Game as seen through GUI commands.
+struct gui_game
+{
+    uint32_t maxx = 0;
+    uint32_t maxy = 0;
+    std::unordered_map<std::string, bool> players; // Name to elimination status.
+    std::vector<std::string> order; // Names in NEW_GAME order, ring records use these numbers.
+    std::vector<bool> eaten_pixels;
+    size_t event_lines = 0; // PIXEL and PLAYER_ELIMINATED lines so far.
+};
+
+// Counters of one report period.
+struct period_stats
+{
+    uint64_t commands = 0;
+    uint64_t bytes = 0;
+    uint64_t keys = 0;
+    std::vector<int64_t> lag_ns;
+};
+
+int listen_sock, gui_sock = -1, udp_sock = -1, key_timer = -1, heartbeat_timer = -1, report_timer, epoll_fd;
+gui_game game;
+size_t gui_games = 0;
+std::string pending_line;
+uint64_t violations = 0;
+period_stats period, total;
+size_t next_key = 0;
+
+// Shared memory ring offered by local client, with its wake-up and free space eventfds.
+int ring_listener = -1, ring_event = -1, ring_space = -1;
+shm_ring_header *ring = nullptr;
+
+// Spectator view of the server, used as reference time of events.
+uint64_t session_id;
+uint32_t spectator_game_id;
+bool spectator_in_game = false;
+std::set<uint32_t> spectator_previous_games;
+size_t spectator_games = 0;
+uint32_t spectator_next_event_no = 0;
+std::vector<int64_t> spectator_seen_ns;
+
+int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>
+            (std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Reads key script, each line holds delay in milliseconds and a key event.
+void read_key_script(const char *path, sink_settings &settings)
+{
+    std::ifstream script(path);
+    if (script.is_open() == false)
+        throw game_constant::WrongValueArgument{};
+
+    int64_t delay;
+    std::string key;
+    while (script >> delay >> key)
+        settings.key_script.emplace_back(delay * sink_constant::NS_IN_MS, key + "\n");
+
+    if (settings.key_script.empty())
+        throw game_constant::WrongValueArgument{};
+}
+
+// Analyses input arguments.
+sink_settings get_sink_settings(int argc, char *argv[])
+{
+    const char OPT_UNKNOWN_SIGN = '?';
+    sink_settings result;
+
+    int opt;
+    while ((opt = getopt(argc, argv, sink_constant::SINK_OPTSTRING)) != -1)
+    {
+        if (opt == OPT_UNKNOWN_SIGN)
+            throw game_constant::WrongValueArgument{};
+
+        if (opt == sink_constant::KEY_SCRIPT)
+        {
+            read_key_script(optarg, result);
+            continue;
+        }
+        if (opt == sink_constant::SHARED_RING)
+        {
+            result.shared_ring = true;
+            continue;
+        }
+        if (opt == sink_constant::GAME_SERVER)
+        {
+            result.server_name = optarg;
+            continue;
+        }
+
+        if (is_integer(optarg) == false || atol(optarg) < 0)
+            throw game_constant::NotNumberArgument{};
+        const size_t value = atol(optarg);
+
+        switch (opt)
+        {
+            case game_constant::GUI_PORT:
+                result.gui_port = value;
+                break;
+
+            case game_constant::PORT:
+                result.server_port = value;
+                break;
+
+            case sink_constant::DURATION:
+                result.duration = value;
+                break;
+
+            case sink_constant::KEY_PERIOD:
+                if (value == 0)
+                    throw game_constant::WrongValueArgument{};
+                // Right turn, straight, left turn, straight.
+                for (const auto &key: {game_constant::GUI_RIGHT_TURN, game_constant::GUI_FORWARD2,
+                                       game_constant::GUI_LEFT_TURN, game_constant::GUI_FORWARD})
+                    result.key_script.emplace_back(value * sink_constant::NS_IN_MS, key + "\n");
+                break;
+        }
+    }
+
+    // Checks if all arguments were processed.
+    if (optind != argc)
+    {
+        throw game_constant::ArgumentException{};
+    }
+
+    return result;
+}
+
+void watch(int fd, uint32_t events)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+    {
+        std::cerr << "Epoll error." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+void arm_timer(int timer_fd, int64_t delay_ns, int64_t period_ns)
+{
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    // Zero it_value would disarm the timer.
+    delay_ns = std::max(delay_ns, (int64_t) 1);
+    spec.it_value.tv_sec = delay_ns / 1000000000;
+    spec.it_value.tv_nsec = delay_ns % 1000000000;
+    spec.it_interval.tv_sec = period_ns / 1000000000;
+    spec.it_interval.tv_nsec = period_ns % 1000000000;
+    timerfd_settime(timer_fd, 0, &spec, NULL);
+}
+
+// Listens on both IPv4 and IPv6, as client may resolve localhost either way.
+void set_up_listener(const sink_settings &settings)
+{
+    listen_sock = socket(AF_INET6, SOCK_STREAM, 0);
+    if (listen_sock < 0)
+    {
+        std::cerr << "Socket error" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    int flag = 1;
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    flag = 0;
+    setsockopt(listen_sock, IPPROTO_IPV6, IPV6_V6ONLY, &flag, sizeof(flag));
+
+    struct sockaddr_in6 address;
+    memset(&address, 0, sizeof(address));
+    address.sin6_family = AF_INET6;
+    address.sin6_addr = in6addr_any;
+    address.sin6_port = htons(settings.gui_port);
+    if (bind(listen_sock, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(listen_sock, 1) < 0)
+    {
+        std::cerr << "Bind error" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Joins the game server as spectator.
+void set_up_spectator(const sink_settings &settings)
+{
+    struct addrinfo addr_hints;
+    struct addrinfo *addr_result;
+
+    memset(&addr_hints, 0, sizeof(struct addrinfo));
+    addr_hints.ai_family = AF_UNSPEC;
+    addr_hints.ai_socktype = SOCK_DGRAM;
+    addr_hints.ai_protocol = IPPROTO_UDP;
+    if (getaddrinfo(settings.server_name.c_str(), std::to_string(settings.server_port).c_str(),
+                    &addr_hints, &addr_result) != 0)
+    {
+        std::cerr << "Getaddrinfo error." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    udp_sock = socket(addr_result->ai_family, SOCK_DGRAM, 0);
+    if (udp_sock < 0 || connect(udp_sock, addr_result->ai_addr, addr_result->ai_addrlen) < 0)
+    {
+        std::cerr << "Socket error" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    freeaddrinfo(addr_result);
+
+    session_id = std::chrono::duration_cast<std::chrono::microseconds>
+            (std::chrono::system_clock::now().time_since_epoch()).count();
+    watch(udp_sock, EPOLLIN);
+
+    heartbeat_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    arm_timer(heartbeat_timer, game_constant::INTEVAL_LENGTH_NS, game_constant::INTEVAL_LENGTH_NS);
+    watch(heartbeat_timer, EPOLLIN);
+}
+
+void violation(const std::string &reason, std::string_view line)
+{
+    violations++;
+    if (violations <= sink_constant::PRINTED_VIOLATIONS)
+        std::cerr << "Violation: " << reason << ": " << line << std::endl;
+}
+
+// Splits line by single spaces.
+std::vector<std::string_view> split_line(std::string_view line)
+{
+    std::vector<std::string_view> words;
+    size_t start = 0;
+    while (start <= line.size())
+    {
+        size_t end = line.find(' ', start);
+        if (end == std::string_view::npos)
+            end = line.size();
+        words.push_back(line.substr(start, end - start));
+        start = end + 1;
+    }
+    return words;
+}
+
+bool parse_number(std::string_view word, uint32_t &value)
+{
+    auto result = std::from_chars(word.data(), word.data() + word.size(), value);
+    return word.empty() == false && result.ec == std::errc() && result.ptr == word.data() + word.size();
+}
+
+// Matches event line with the time spectator received the same event.
+void record_lag(int64_t now)
+{
+    if (udp_sock < 0 || gui_games != spectator_games || game.event_lines >= spectator_seen_ns.size())
+        return;
+
+    const int64_t lag = now - spectator_seen_ns[game.event_lines];
+    period.lag_ns.push_back(lag);
+    total.lag_ns.push_back(lag);
+}
+
+// Checks one pixel of PIXEL or PIXELS command or ring record.
+void check_pixel(uint32_t x, uint32_t y, std::string_view name, std::string_view line, int64_t now)
+{
+    record_lag(now);
+    game.event_lines++;
+
+    auto player = game.players.find(std::string(name));
+    if (player == game.players.end())
+        violation("unknown player", line);
+    else if (player->second)
+        violation("pixel of eliminated player", line);
+
+    if (x >= game.maxx || y >= game.maxy)
+        violation("pixel out of board", line);
+    else if (game.eaten_pixels[(size_t) y * game.maxx + x])
+        violation("pixel eaten twice", line);
+    else
+        game.eaten_pixels[(size_t) y * game.maxx + x] = true;
+}
+
+void check_eliminated(std::string_view name, std::string_view line, int64_t now)
+{
+    record_lag(now);
+    game.event_lines++;
+
+    auto player = game.players.find(std::string(name));
+    if (player == game.players.end())
+        violation("unknown player", line);
+    else if (player->second)
+        violation("player eliminated twice", line);
+    else
+        player->second = true;
+}
+
+// Checks one command against the game state built from previous ones.
+void check_line(std::string_view line, int64_t now)
+{
+    period.commands++;
+    const auto words = split_line(line);
+
+    if (words[0] == sink_constant::NEW_GAME)
+    {
+        game = gui_game();
+        gui_games++;
+        if (words.size() < 4 || parse_number(words[1], game.maxx) == false
+            || parse_number(words[2], game.maxy) == false || game.maxx == 0 || game.maxy == 0)
+        {
+            violation("malformed NEW_GAME", line);
+            return;
+        }
+        for (size_t i = 3; i < words.size(); ++i)
+        {
+            if (is_nick_fine(std::string(words[i])) == false || words[i].empty())
+                violation("wrong player name", line);
+            if (i > 3 && words[i] <= words[i - 1])
+                violation("players not sorted", line);
+            game.players[std::string(words[i])] = false;
+            game.order.emplace_back(words[i]);
+        }
+        game.eaten_pixels.assign((size_t) game.maxx * game.maxy, false);
+        return;
+    }
+
+    if (gui_games == 0)
+    {
+        violation("command before NEW_GAME", line);
+        return;
+    }
+
+    if (words[0] == sink_constant::PIXEL || words[0] == sink_constant::PIXELS)
+    {
+        // PIXELS holds any positive number of x y player triples.
+        if (words.size() < 4 || (words.size() - 1) % 3 != 0
+            || (words[0] == sink_constant::PIXEL && words.size() != 4))
+        {
+            violation("malformed PIXEL", line);
+            return;
+        }
+        for (size_t i = 1; i < words.size(); i += 3)
+        {
+            uint32_t x, y;
+            if (parse_number(words[i], x) == false || parse_number(words[i + 1], y) == false)
+                violation("malformed PIXEL", line);
+            else
+                check_pixel(x, y, words[i + 2], line, now);
+        }
+        return;
+    }
+
+    // Pixels a predicting client drew ahead of the server and took back are free again.
+    if (words[0] == sink_constant::ERASE)
+    {
+        if (words.size() < 3 || (words.size() - 1) % 2 != 0)
+        {
+            violation("malformed ERASE", line);
+            return;
+        }
+        for (size_t i = 1; i < words.size(); i += 2)
+        {
+            uint32_t x, y;
+            if (parse_number(words[i], x) == false || parse_number(words[i + 1], y) == false
+                || x >= game.maxx || y >= game.maxy)
+                violation("malformed ERASE", line);
+            else
+                game.eaten_pixels[(size_t) y * game.maxx + x] = false;
+        }
+        return;
+    }
+
+    if (words[0] == sink_constant::PLAYER_ELIMINATED)
+    {
+        if (words.size() != 2)
+        {
+            violation("malformed PLAYER_ELIMINATED", line);
+            return;
+        }
+        check_eliminated(words[1], line, now);
+        return;
+    }
+
+    violation("unknown command", line);
+}
+
+// Reads everything the client wrote, returns false once it disconnected.
+bool receive_from_client()
+{
+    char buffer[sink_constant::READ_CHUNK];
+    while (true)
+    {
+        ssize_t len = recv(gui_sock, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (len == 0)
+            return false;
+        if (len < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+
+        const int64_t now = now_ns();
+        period.bytes += len;
+        std::string_view chunk(buffer, len);
+        size_t start = 0;
+        size_t end;
+        while ((end = chunk.find('\n', start)) != std::string_view::npos)
+        {
+            if (pending_line.empty())
+            {
+                check_line(chunk.substr(start, end - start), now);
+            }
+            else
+            {
+                pending_line.append(chunk.substr(start, end - start));
+                check_line(pending_line, now);
+                pending_line.clear();
+            }
+            start = end + 1;
+        }
+        pending_line.append(chunk.substr(start));
+    }
+}
+
+// Sends next scripted key event and schedules the following one.
+void inject_key(const sink_settings &settings)
+{
+    uint64_t expirations;
+    if (read(key_timer, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return;
+
+    const auto &key = settings.key_script[next_key].second;
+    if (send(gui_sock, key.c_str(), key.size(), MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t) key.size())
+        period.keys++;
+
+    next_key = (next_key + 1) % settings.key_script.size();
+    arm_timer(key_timer, settings.key_script[next_key].first, 0);
+}
+
+// Follows events in order, remembering when each pixel and elimination arrived.
+void receive_from_server()
+{
+    char buffer[game_constant::BUFFER_SIZE];
+    ssize_t len;
+    while ((len = recv(udp_sock, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+    {
+        const int64_t now = now_ns();
+        RecordReader reader(buffer, len);
+        uint32_t game_id;
+        if (reader.read_game_id(game_id) == false)
+            continue;
+
+        if (spectator_previous_games.insert(game_id).second)
+        {
+            spectator_game_id = game_id;
+            spectator_in_game = true;
+            spectator_games++;
+            spectator_next_event_no = 0;
+            spectator_seen_ns.clear();
+        }
+        if (spectator_in_game == false || game_id != spectator_game_id)
+            continue;
+
+        event_record record;
+        while (reader.next(record) == record_status::FINE)
+        {
+            if (record.event_no != spectator_next_event_no)
+                continue;
+
+            if (record.type == 3) // Game over.
+            {
+                spectator_in_game = false;
+                break;
+            }
+            if (record.type == 1 || record.type == 2
+                || record.type == game_constant::PIXEL_WIDE || record.type == game_constant::PLAYER_ELIMINATED_WIDE)
+                spectator_seen_ns.push_back(now);
+            spectator_next_event_no++;
+        }
+    }
+}
+
+void send_to_server()
+{
+    uint64_t expirations;
+    if (read(heartbeat_timer, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return;
+
+    char mess[game_constant::BUFFER_SIZE];
+    const size_t len = build_client_datagram(mess, session_id, game_constant::FORWARD_TURN,
+                                             spectator_next_event_no, "", 0);
+    send(udp_sock, mess, len, MSG_DONTWAIT);
+}
+
+double percentile_us(std::vector<int64_t> &samples, size_t percent)
+{
+    if (samples.empty())
+        return 0;
+
+    auto nth = samples.begin() + samples.size() * percent / 100;
+    std::nth_element(samples.begin(), nth, samples.end());
+    return *nth / 1000.0;
+}
+
+void print_stats(const char *label, period_stats &stats, double seconds)
+{
+    printf("%s transport=%s seconds=%.1f commands=%lu commands_per_s=%.0f bytes_per_s=%.0f keys=%lu games=%zu violations=%lu "
+           "lag_samples=%zu lag_p50_us=%.1f lag_p99_us=%.1f\n",
+           label, ring != nullptr ? "ring" : "tcp", seconds, stats.commands, stats.commands / seconds, stats.bytes / seconds, stats.keys, gui_games,
+           violations, stats.lag_ns.size(), percentile_us(stats.lag_ns, 50), percentile_us(stats.lag_ns, 99));
+    fflush(stdout);
+}
+
+void add_period(period_stats &to, const period_stats &from)
+{
+    to.commands += from.commands;
+    to.bytes += from.bytes;
+    to.keys += from.keys;
+}
+
+// Listens for ring offer on the socket GUI uses.
+void set_up_ring_listener(const sink_settings &settings)
+{
+    ring_listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path + 1, sizeof(address.sun_path) - 1, SHM_RING_SOCKET_FORMAT,
+             (unsigned) settings.gui_port);
+    socklen_t address_len = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(address.sun_path + 1);
+    if (ring_listener < 0 || bind(ring_listener, (struct sockaddr *) &address, address_len) < 0
+        || listen(ring_listener, 1) < 0)
+    {
+        std::cerr << "Ring socket error" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    watch(ring_listener, EPOLLIN);
+}
+
+// Checks records from shared memory ring the way GUI would draw them.
+void drain_ring(int64_t now)
+{
+    bool consumed = false;
+    do
+    {
+        shm_ring_record *record;
+        while ((record = shm_ring_peek(ring)) != nullptr)
+        {
+            period.bytes += record->len;
+            const std::string_view name = record->player < game.order.size()
+                                          ? std::string_view(game.order[record->player]) : std::string_view();
+            if (record->type == SHM_RING_LINE)
+            {
+                check_line(std::string_view((const char *) (record + 1), record->len - sizeof(*record)), now);
+            }
+            else if (gui_games == 0)
+            {
+                period.commands++;
+                violation("command before NEW_GAME", "ring record");
+            }
+            else if (record->type == SHM_RING_PIXEL)
+            {
+                const auto *pixel = (const shm_ring_pixel *) record;
+                period.commands++;
+                check_pixel(pixel->x, pixel->y, name, "ring PIXEL", now);
+            }
+            else if (record->type == SHM_RING_ELIMINATED)
+            {
+                period.commands++;
+                check_eliminated(name, "ring PLAYER_ELIMINATED", now);
+            }
+            else
+            {
+                violation("unknown ring record", "");
+            }
+            shm_ring_consume(ring, record);
+            consumed = true;
+        }
+    } while (shm_ring_prepare_wait(ring));
+
+    // Client that found the ring full waits for this to write again.
+    const uint64_t space = 1;
+    if (consumed && shm_ring_should_signal_space(ring)
+        && write(ring_space, &space, sizeof(space)) < 0 && errno != EAGAIN)
+    {
+        std::cerr << "Ring space signal error" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Takes ring memory and eventfds from client.
+void accept_ring()
+{
+    int conn = accept(ring_listener, NULL, NULL);
+    if (conn < 0)
+        return;
+
+    char buffer[16];
+    struct iovec iov = {buffer, sizeof(buffer)};
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cmsg;
+    int fds[3];
+    if (ring != nullptr || recvmsg(conn, &msg, 0) <= 0 || (cmsg = CMSG_FIRSTHDR(&msg)) == nullptr
+        || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+    {
+        close(conn);
+        return;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    void *mapped = mmap(NULL, SHM_RING_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    close(fds[0]);
+    if (mapped == MAP_FAILED || ((shm_ring_header *) mapped)->data_size != SHM_RING_DATA_SIZE
+        || write(conn, SHM_RING_ACCEPTED, strlen(SHM_RING_ACCEPTED)) < 0)
+    {
+        std::cerr << "Ring setup error" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    close(conn);
+
+    ring = (shm_ring_header *) mapped;
+    ring_event = fds[1];
+    ring_space = fds[2];
+    watch(ring_event, EPOLLIN);
+    drain_ring(now_ns());
+}
+
+void run_sink(const sink_settings &settings)
+{
+    gui_sock = accept(listen_sock, NULL, NULL);
+    if (gui_sock < 0)
+    {
+        std::cerr << "Accept error" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    int flag = 1;
+    setsockopt(gui_sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    watch(gui_sock, EPOLLIN);
+
+    report_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    arm_timer(report_timer, sink_constant::REPORT_PERIOD_NS, sink_constant::REPORT_PERIOD_NS);
+    watch(report_timer, EPOLLIN);
+
+    if (settings.key_script.empty() == false)
+    {
+        key_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        arm_timer(key_timer, settings.key_script[0].first, 0);
+        watch(key_timer, EPOLLIN);
+    }
+
+    const int64_t start = now_ns();
+    int64_t period_start = start;
+    struct epoll_event events[sink_constant::MAX_EPOLL_EVENTS];
+    bool connected = true;
+    while (connected && (settings.duration == 0 || now_ns() - start < (int64_t) settings.duration * 1000000000))
+    {
+        int ready = epoll_wait(epoll_fd, events, sink_constant::MAX_EPOLL_EVENTS, 100);
+        for (int i = 0; i < ready; ++i)
+        {
+            const int fd = events[i].data.fd;
+            if (fd == gui_sock)
+            {
+                connected = receive_from_client();
+            }
+            else if (fd == udp_sock)
+            {
+                receive_from_server();
+            }
+            else if (fd == ring_listener)
+            {
+                accept_ring();
+            }
+            else if (fd == ring_event)
+            {
+                uint64_t wakeups;
+                if (read(ring_event, &wakeups, sizeof(wakeups)) == sizeof(wakeups))
+                    drain_ring(now_ns());
+            }
+            else if (fd == heartbeat_timer)
+            {
+                send_to_server();
+            }
+            else if (fd == key_timer)
+            {
+                inject_key(settings);
+            }
+            else if (fd == report_timer)
+            {
+                uint64_t expirations;
+                if (read(report_timer, &expirations, sizeof(expirations)) != sizeof(expirations))
+                    continue;
+
+                const int64_t now = now_ns();
+                print_stats("period", period, (now - period_start) / 1e9);
+                add_period(total, period);
+                period = period_stats();
+                period_start = now;
+            }
+        }
+    }
+
+    add_period(total, period);
+    print_stats("total", total, (now_ns() - start) / 1e9);
+}
+
+int main(int argc, char *argv[])
+{
+    sink_settings settings;
+    try
+    {
+        settings = get_sink_settings(argc, argv);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    epoll_fd = epoll_create1(0);
+    set_up_listener(settings);
+    if (settings.shared_ring)
+        set_up_ring_listener(settings);
+    if (settings.server_name.empty() == false)
+        set_up_spectator(settings);
+
+    run_sink(settings);
+    close(gui_sock);
+    close(listen_sock);
+}
@@ -0,0 +1,102 @@
+#ifndef ROBALETHEGAME_HISTOGRAM_H
+#define ROBALETHEGAME_HISTOGRAM_H
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Counts of values in buckets growing by powers of two, each split into 8 linear sub-buckets, so percentiles
+// are within 12.5%. Recording takes no lock and no allocation, reading may go on meanwhile.
+class Histogram
+{
+    public:
+    Histogram() = default;
+
+    // Copy and move semantics are disabled.
+    Histogram(const Histogram &) = delete;
+    Histogram &operator=(const Histogram &) = delete;
+
+    void record(uint64_t value)
+    {
+        buckets[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        uint64_t seen = highest.load(std::memory_order_relaxed);
+        while (value > seen && highest.compare_exchange_weak(seen, value, std::memory_order_relaxed) == false);
+    }
+
+    uint64_t count() const
+    {
+        return total.load(std::memory_order_relaxed);
+    }
+
+    uint64_t max() const
+    {
+        return highest.load(std::memory_order_relaxed);
+    }
+
+    // Upper end of the bucket holding given fraction of values, 0 if there are none.
+    uint64_t percentile(double fraction) const
+    {
+        const uint64_t all = count();
+        if (all == 0)
+            return 0;
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i)
+        {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen >= fraction * all)
+                return std::min(bucket_end(i), max());
+        }
+        return max();
+    }
+
+    // Count, percentiles and maximum, values multiplied by scale and divided by unit.
+    std::string summary(const std::string &name, uint64_t unit = 1, uint64_t scale = 1) const
+    {
+        return name + " count=" + std::to_string(count())
+               + " p50=" + std::to_string(percentile(0.5) * scale / unit)
+               + " p90=" + std::to_string(percentile(0.9) * scale / unit)
+               + " p99=" + std::to_string(percentile(0.99) * scale / unit)
+               + " max=" + std::to_string(max() * scale / unit);
+    }
+
+    // The same as JSON member.
+    std::string json(const std::string &name, uint64_t unit = 1, uint64_t scale = 1) const
+    {
+        return "\"" + name + "\":{\"count\":" + std::to_string(count())
+               + ",\"p50\":" + std::to_string(percentile(0.5) * scale / unit)
+               + ",\"p90\":" + std::to_string(percentile(0.9) * scale / unit)
+               + ",\"p99\":" + std::to_string(percentile(0.99) * scale / unit)
+               + ",\"max\":" + std::to_string(max() * scale / unit) + "}";
+    }
+
+    private:
+    static const size_t SUB_BITS = 3;
+    static const size_t SUB_BUCKETS = 1 << SUB_BITS;
+    static const size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    std::atomic<uint64_t> buckets[BUCKETS] = {};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> highest{0};
+
+    static size_t bucket_of(uint64_t value)
+    {
+        if (value < SUB_BUCKETS)
+            return value;
+
+        const size_t shift = 63 - __builtin_clzll(value) - SUB_BITS + 1;
+        return shift * SUB_BUCKETS + ((value >> (shift - 1)) & (SUB_BUCKETS - 1));
+    }
+
+    static uint64_t bucket_end(size_t bucket)
+    {
+        if (bucket < SUB_BUCKETS)
+            return bucket;
+
+        const size_t shift = bucket / SUB_BUCKETS;
+        return ((SUB_BUCKETS + bucket % SUB_BUCKETS + 1) << (shift - 1)) - 1;
+    }
+};
+
+#endif //ROBALETHEGAME_HISTOGRAM_H
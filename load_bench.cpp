@@ -0,0 +1,105 @@
+#include <iostream>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include "game_constant.h"
+#include "event_sink.h"
+#include "game.h"
+#include "randomiser.h"
+
+// Load benchmark of the tick loop: time of Game::make_turn against number of worms.
+// Usage: ./screen-worms-load-bench [ticks] [worms...]
+
+const size_t DEFAULT_TICKS = 500;
+const std::vector<size_t> DEFAULT_WORMS = {25, 256, 1000, 2500, 5000, 10000};
+
+// Player names sort in the same order as their numbers.
+std::string bench_name(size_t i)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "w%05zu", i);
+    return name;
+}
+
+void run_room(size_t worms_number, size_t ticks)
+{
+    auto settings(game_constant::DEFAULT_GAME_SETTINGS);
+    settings[game_constant::SEED] = 2021;
+    settings[game_constant::BOARD_WIDTH] = game_constant::MAX_WIDTH;
+    settings[game_constant::BOARD_HEIGHT] = game_constant::MAX_HEIGHT;
+    settings[game_constant::ROOM_SIZE] = game_constant::MAX_ROOM_SIZE;
+
+    // Events are only serialised.
+    NullEventSink sink;
+    Game game(settings, sink);
+    std::vector<std::string> names;
+    for (size_t i = 0; i < worms_number; ++i)
+    {
+        names.push_back(bench_name(i));
+        game.add_player(names.back());
+    }
+
+    Randomiser randomiser(settings[game_constant::SEED]);
+    Randomiser steering(worms_number);
+    game.start(randomiser);
+
+    std::vector<double> tick_us;
+    bool over = false;
+    while (over == false && tick_us.size() < ticks)
+    {
+        for (const auto &name: names)
+            if (steering.rand() % 8 == 0)
+                game.set_direction(name, steering.rand() % 3);
+
+        auto begin = std::chrono::steady_clock::now();
+        over = game.make_turn();
+        auto end = std::chrono::steady_clock::now();
+        tick_us.push_back(std::chrono::duration<double, std::micro>(end - begin).count());
+    }
+
+    auto sorted = tick_us;
+    std::sort(sorted.begin(), sorted.end());
+    double total = 0;
+    for (auto t: tick_us)
+        total += t;
+
+    printf("worms=%zu ticks=%zu mean_us=%.2f p50_us=%.2f p99_us=%.2f max_us=%.2f events=%u\n",
+           worms_number, tick_us.size(), total / tick_us.size(), sorted[sorted.size() / 2],
+           sorted[sorted.size() * 99 / 100], sorted.back(), game.get_event_count());
+}
+
+int main(int argc, char *argv[])
+{
+    size_t ticks = DEFAULT_TICKS;
+    std::vector<size_t> worms = DEFAULT_WORMS;
+
+    if (argc > 1)
+    {
+        if (is_integer(argv[1]) == false || atol(argv[1]) <= 0)
+        {
+            std::cerr << "Usage: " << argv[0] << " [ticks] [worms...]" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        ticks = atol(argv[1]);
+    }
+    if (argc > 2)
+    {
+        worms.clear();
+        for (int i = 2; i < argc; ++i)
+        {
+            if (is_integer(argv[i]) == false || atol(argv[i]) < 2
+                || (size_t) atol(argv[i]) > game_constant::MAX_ROOM_SIZE)
+            {
+                std::cerr << "Wrong number of worms." << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            worms.push_back(atol(argv[i]));
+        }
+    }
+
+    for (auto worms_number: worms)
+        run_room(worms_number, ticks);
+}
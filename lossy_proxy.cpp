@@ -0,0 +1,647 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <queue>
+#include <algorithm>
+#include "game_constant.h"
+#include "event_record.h"
+#include "histogram.h"
+#include "randomiser.h"
+
+// Lossy network emulation between clients and the game server, in user space.
+// Every client gets its own socket towards the server, datagrams of both directions go through
+// loss, duplication, reordering, delay, jitter and a rate cap, set per direction and changed over time
+// by a scenario file. Goodput and recovery time are measured on what clients are given.
+// Usage: ./screen-worms-lossy-proxy game_server [-p n] [-l n] [-u impairments] [-d impairments] [-f scenario]
+//        [-t seconds] [-s seed]
+// Impairments are comma separated loss=%,duplicate=%,reorder=%,delay=ms,jitter=ms,rate=kbit/s.
+// Scenario lines are "seconds up|down|both key=value..."; each changes given keys from that time on.
+
+namespace proxy_constant
+{
+    const char PROXY_OPTSTRING[] = "p:l:u:d:f:t:s:";
+    const char LISTEN_PORT = 'l';
+    const char UP = 'u';
+    const char DOWN = 'd';
+    const char SCENARIO = 'f';
+    const char DURATION = 't';
+    const char SEED = 's';
+    const size_t DEFAULT_LISTEN_PORT = game_constant::DEFAULT_PORT + 2;
+
+    // Reordered datagrams are held back this much longer than the others.
+    const int64_t REORDER_DELAY_NS = 20000000;
+
+    // Datagrams that would wait longer than this for a capped link are dropped.
+    const int64_t LINK_QUEUE_NS = 200000000;
+
+    const int64_t REPORT_INTERVAL_NS = 1000000000;
+
+    const int MAX_EPOLL_EVENTS = 64;
+}
+
+// Impairments of one direction.
+struct impairment
+{
+    uint32_t loss = 0;
+    uint32_t duplicate = 0;
+    uint32_t reorder = 0;
+    uint32_t delay_ms = 0;
+    uint32_t jitter_ms = 0;
+    // 0 means no cap.
+    uint32_t rate_kbps = 0;
+};
+
+// Impairments from given time on, with what clients got meanwhile.
+struct phase
+{
+    int64_t start_ns;
+    impairment up;
+    impairment down;
+    uint64_t goodput_bytes = 0;
+    uint64_t events = 0;
+};
+
+// One direction of the emulated link.
+struct link_direction
+{
+    // End of sending of datagrams already on a capped link.
+    int64_t free_at_ns = 0;
+    uint64_t datagrams = 0;
+    uint64_t lost = 0;
+    uint64_t duplicated = 0;
+    uint64_t reordered = 0;
+    uint64_t overflowed = 0;
+};
+
+// Client as the proxy sees it, with events it was given in order.
+struct session
+{
+    struct sockaddr_in6 address;
+    int upstream;
+    uint32_t game_id;
+    std::set<uint32_t> previous_game_id;
+    uint32_t next_expected_event_no;
+    uint32_t highest_seen;
+    // Time the client was first given an event beyond a missing one, 0 without a gap.
+    int64_t gap_since_ns;
+};
+
+// Datagram waiting for its time.
+struct delivery
+{
+    int64_t at_ns;
+    uint64_t order;
+    size_t client;
+    bool to_client;
+    std::string data;
+
+    bool operator>(const delivery &other) const
+    {
+        return at_ns != other.at_ns ? at_ns > other.at_ns : order > other.order;
+    }
+};
+
+// Auxiliary struct for holding proxy settings.
+struct proxy_settings
+{
+    std::string server_name;
+    size_t server_port = game_constant::DEFAULT_PORT;
+    size_t listen_port = proxy_constant::DEFAULT_LISTEN_PORT;
+    std::vector<phase> phases = {phase{}};
+    size_t duration = 0;
+    uint32_t seed = 1;
+};
+
+int listen_sock, epoll_fd, timer_fd, signal_fd;
+struct addrinfo *server_address;
+std::vector<session> sessions;
+std::map<std::string, size_t> session_of;
+std::map<int, size_t> session_of_upstream;
+std::priority_queue<delivery, std::vector<delivery>, std::greater<delivery>> pending;
+uint64_t delivery_order = 0;
+link_direction up_link, down_link;
+Histogram recovery;
+uint64_t gaps = 0;
+uint64_t goodput_bytes = 0;
+uint64_t goodput_events = 0;
+
+int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>
+            (std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Sets one key=value of impairments.
+void set_impairment(impairment &target, const std::string &key_value)
+{
+    const size_t equals = key_value.find('=');
+    if (equals == std::string::npos)
+        throw game_constant::WrongValueArgument{};
+
+    const std::string key = key_value.substr(0, equals);
+    const std::string value_text = key_value.substr(equals + 1);
+    if (value_text.empty() || is_integer(value_text.c_str()) == false || atol(value_text.c_str()) < 0)
+        throw game_constant::NotNumberArgument{};
+    const uint32_t value = atol(value_text.c_str());
+
+    if ((key == "loss" || key == "duplicate" || key == "reorder") && value > 100)
+        throw game_constant::WrongValueArgument{};
+
+    if (key == "loss")
+        target.loss = value;
+    else if (key == "duplicate")
+        target.duplicate = value;
+    else if (key == "reorder")
+        target.reorder = value;
+    else if (key == "delay")
+        target.delay_ms = value;
+    else if (key == "jitter")
+        target.jitter_ms = value;
+    else if (key == "rate")
+        target.rate_kbps = value;
+    else
+        throw game_constant::WrongValueArgument{};
+}
+
+void set_impairments(impairment &target, const std::string &list)
+{
+    std::stringstream stream(list);
+    std::string key_value;
+    while (std::getline(stream, key_value, ','))
+        set_impairment(target, key_value);
+}
+
+// Each scenario line starts a phase that keeps what it does not change from the one before.
+void read_scenario(const char *file_name, std::vector<phase> &phases)
+{
+    std::ifstream file(file_name);
+    if (file.is_open() == false)
+        throw game_constant::WrongValueArgument{};
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::stringstream stream(line.substr(0, line.find('#')));
+        std::string seconds, direction, key_value;
+        if (!(stream >> seconds))
+            continue;
+        if (!(stream >> direction) || is_integer(seconds.c_str()) == false || atol(seconds.c_str()) < 0
+            || (direction != "up" && direction != "down" && direction != "both"))
+            throw game_constant::WrongValueArgument{};
+
+        const int64_t start_ns = (int64_t) atol(seconds.c_str()) * 1000000000;
+        if (start_ns < phases.back().start_ns)
+            throw game_constant::WrongValueArgument{};
+        if (start_ns > phases.back().start_ns)
+        {
+            phase next;
+            next.start_ns = start_ns;
+            next.up = phases.back().up;
+            next.down = phases.back().down;
+            phases.push_back(next);
+        }
+
+        while (stream >> key_value)
+        {
+            if (direction != "down")
+                set_impairment(phases.back().up, key_value);
+            if (direction != "up")
+                set_impairment(phases.back().down, key_value);
+        }
+    }
+}
+
+// Analyses input arguments.
+proxy_settings get_proxy_settings(int argc, char *argv[])
+{
+    const char OPT_UNKNOWN_SIGN = '?';
+    proxy_settings result;
+    result.phases[0].start_ns = 0;
+    const char *scenario = nullptr;
+
+    if (argc < 2)
+        throw game_constant::ArgumentException{};
+    result.server_name = argv[1];
+
+    int opt;
+    while ((opt = getopt(argc - 1, argv + 1, proxy_constant::PROXY_OPTSTRING)) != -1)
+    {
+        if (opt == OPT_UNKNOWN_SIGN)
+            throw game_constant::WrongValueArgument{};
+
+        if (opt == proxy_constant::UP)
+        {
+            set_impairments(result.phases[0].up, optarg);
+            continue;
+        }
+        if (opt == proxy_constant::DOWN)
+        {
+            set_impairments(result.phases[0].down, optarg);
+            continue;
+        }
+        if (opt == proxy_constant::SCENARIO)
+        {
+            scenario = optarg;
+            continue;
+        }
+
+        if (is_integer(optarg) == false || atol(optarg) < 0)
+            throw game_constant::NotNumberArgument{};
+        const size_t value = atol(optarg);
+
+        switch (opt)
+        {
+            case game_constant::PORT:
+            case proxy_constant::LISTEN_PORT:
+                if (value < game_constant::MIN_PORT || value > game_constant::MAX_PORT)
+                    throw game_constant::WrongValueArgument{};
+                (opt == game_constant::PORT ? result.server_port : result.listen_port) = value;
+                break;
+
+            case proxy_constant::DURATION:
+                result.duration = value;
+                break;
+
+            case proxy_constant::SEED:
+                result.seed = value;
+                break;
+        }
+    }
+
+    // Checks if all arguments were processed.
+    if (optind != argc - 1)
+    {
+        throw game_constant::ArgumentException{};
+    }
+
+    // Scenario builds on impairments given as options.
+    if (scenario != nullptr)
+        read_scenario(scenario, result.phases);
+
+    return result;
+}
+
+void watch(int fd)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+    {
+        std::cerr << "Epoll error." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+void set_up(const proxy_settings &settings)
+{
+    struct addrinfo addr_hints;
+    memset(&addr_hints, 0, sizeof(struct addrinfo));
+    addr_hints.ai_family = AF_UNSPEC;
+    addr_hints.ai_socktype = SOCK_DGRAM;
+    addr_hints.ai_protocol = IPPROTO_UDP;
+    if (getaddrinfo(settings.server_name.c_str(), std::to_string(settings.server_port).c_str(),
+                    &addr_hints, &server_address) != 0)
+    {
+        std::cerr << "Getaddrinfo error." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    epoll_fd = epoll_create1(0);
+
+    // Listens on both IPv4 and IPv6.
+    listen_sock = socket(AF_INET6, SOCK_DGRAM, 0);
+    struct sockaddr_in6 address;
+    memset(&address, 0, sizeof(address));
+    address.sin6_family = AF_INET6;
+    address.sin6_port = htons(settings.listen_port);
+    address.sin6_addr = in6addr_any;
+    if (listen_sock < 0 || bind(listen_sock, (struct sockaddr *) &address, sizeof(address)) < 0)
+    {
+        std::cerr << "Socket error" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    watch(listen_sock);
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    watch(timer_fd);
+
+    // Interrupt ends the run with the summary.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK);
+    watch(signal_fd);
+}
+
+// Client seen for the first time gets its own socket, so the server tells clients apart.
+size_t find_session(const struct sockaddr_in6 &address)
+{
+    const std::string key((const char *) &address, sizeof(address));
+    const auto found = session_of.find(key);
+    if (found != session_of.end())
+        return found->second;
+
+    const int upstream = socket(server_address->ai_family, SOCK_DGRAM, 0);
+    if (upstream < 0 || connect(upstream, server_address->ai_addr, server_address->ai_addrlen) < 0)
+    {
+        std::cerr << "Socket error" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    watch(upstream);
+
+    session client;
+    client.address = address;
+    client.upstream = upstream;
+    client.game_id = 0;
+    client.next_expected_event_no = 0;
+    client.highest_seen = 0;
+    client.gap_since_ns = 0;
+    sessions.push_back(client);
+    session_of[key] = sessions.size() - 1;
+    session_of_upstream[upstream] = sessions.size() - 1;
+    return sessions.size() - 1;
+}
+
+bool happens(Randomiser &randomiser, uint32_t percent)
+{
+    return percent > 0 && randomiser.rand() % 100 < percent;
+}
+
+// Decides fate of a datagram on one direction of the link.
+void impair(link_direction &direction, const impairment &now, Randomiser &randomiser, delivery sent)
+{
+    direction.datagrams++;
+    if (happens(randomiser, now.loss))
+    {
+        direction.lost++;
+        return;
+    }
+
+    const int copies = happens(randomiser, now.duplicate) ? 2 : 1;
+    direction.duplicated += copies - 1;
+    for (int copy = 0; copy < copies; ++copy)
+    {
+        delivery planned = sent;
+        if (now.rate_kbps != 0)
+        {
+            const int64_t start = std::max(sent.at_ns, direction.free_at_ns);
+            if (start - sent.at_ns > proxy_constant::LINK_QUEUE_NS)
+            {
+                direction.overflowed++;
+                continue;
+            }
+            // Bits over kilobits per second give milliseconds.
+            direction.free_at_ns = start + (int64_t) planned.data.size() * 8 * 1000000 / now.rate_kbps;
+            planned.at_ns = direction.free_at_ns;
+        }
+
+        planned.at_ns += (int64_t) now.delay_ms * 1000000;
+        if (now.jitter_ms != 0)
+            planned.at_ns += randomiser.rand() % ((uint64_t) now.jitter_ms * 1000000 + 1);
+        if (happens(randomiser, now.reorder))
+        {
+            planned.at_ns += proxy_constant::REORDER_DELAY_NS;
+            direction.reordered++;
+        }
+        planned.order = delivery_order++;
+        pending.push(planned);
+    }
+}
+
+// Takes in order records the client would take, tracking gaps until resent events fill them.
+void account(session &client, const std::string &data, phase &current, int64_t now)
+{
+    RecordReader reader(data.data(), data.size());
+    uint32_t game_id;
+    if (reader.read_game_id(game_id) == false || client.previous_game_id.count(game_id) != 0)
+        return;
+    if (game_id != client.game_id)
+    {
+        client.previous_game_id.insert(client.game_id);
+        client.game_id = game_id;
+        client.next_expected_event_no = 0;
+        client.highest_seen = 0;
+        client.gap_since_ns = 0;
+    }
+
+    event_record record;
+    while (reader.next(record) == record_status::FINE)
+    {
+        if (record.event_no == client.next_expected_event_no)
+        {
+            client.next_expected_event_no++;
+            current.goodput_bytes += record.whole.size();
+            current.events++;
+            goodput_bytes += record.whole.size();
+            goodput_events++;
+        }
+        else if (record.event_no > client.next_expected_event_no)
+        {
+            client.highest_seen = std::max(client.highest_seen, record.event_no);
+            if (client.gap_since_ns == 0)
+            {
+                client.gap_since_ns = now;
+                gaps++;
+            }
+        }
+    }
+
+    if (client.gap_since_ns != 0 && client.next_expected_event_no > client.highest_seen)
+    {
+        recovery.record(now - client.gap_since_ns);
+        client.gap_since_ns = 0;
+    }
+}
+
+void deliver(const delivery &due, phase &current, int64_t now)
+{
+    session &client = sessions[due.client];
+    if (due.to_client)
+    {
+        sendto(listen_sock, due.data.data(), due.data.size(), MSG_DONTWAIT,
+               (struct sockaddr *) &client.address, sizeof(client.address));
+        account(client, due.data, current, now);
+    }
+    else
+    {
+        send(client.upstream, due.data.data(), due.data.size(), MSG_DONTWAIT);
+    }
+}
+
+// Goodput of the last interval, given totals at its start.
+void report_line(int64_t since_start, size_t phase_number, uint64_t bytes, uint64_t events)
+{
+    size_t open_gaps = 0;
+    for (const auto &client: sessions)
+        open_gaps += client.gap_since_ns != 0;
+
+    printf("t=%.1f phase=%zu clients=%zu goodput_bytes_per_s=%lu events_per_s=%lu up_lost=%lu down_lost=%lu "
+           "gaps=%lu recovered=%lu open_gaps=%zu\n", since_start / 1e9, phase_number, sessions.size(),
+           (unsigned long) (goodput_bytes - bytes), (unsigned long) (goodput_events - events),
+           (unsigned long) up_link.lost, (unsigned long) down_link.lost, (unsigned long) gaps,
+           (unsigned long) recovery.count(), open_gaps);
+    fflush(stdout);
+}
+
+void report_summary(const std::vector<phase> &phases, size_t reached, int64_t since_start)
+{
+    for (size_t i = 0; i <= reached; ++i)
+    {
+        const int64_t end = i + 1 <= reached ? phases[i + 1].start_ns : since_start;
+        const double seconds = std::max<int64_t>(end - phases[i].start_ns, 1) / 1e9;
+        printf("phase=%zu from_s=%.1f goodput_bytes_per_s=%.0f events_per_s=%.0f\n", i, phases[i].start_ns / 1e9,
+               phases[i].goodput_bytes / seconds, phases[i].events / seconds);
+    }
+
+    const std::pair<const char *, const link_direction *> directions[] = {{"up", &up_link}, {"down", &down_link}};
+    for (const auto &direction: directions)
+        printf("%s datagrams=%lu lost=%lu duplicated=%lu reordered=%lu overflowed=%lu\n", direction.first,
+               (unsigned long) direction.second->datagrams, (unsigned long) direction.second->lost,
+               (unsigned long) direction.second->duplicated, (unsigned long) direction.second->reordered,
+               (unsigned long) direction.second->overflowed);
+
+    const uint64_t ms = 1000000;
+    printf("gaps=%lu %s\n", (unsigned long) gaps, recovery.summary("recovery_ms", ms).c_str());
+    fflush(stdout);
+}
+
+// Wakes the loop at the nearest of due delivery, report, next phase and end.
+void arm_timer(int64_t wake_ns)
+{
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    wake_ns = std::max<int64_t>(wake_ns, 1);
+    spec.it_value.tv_sec = wake_ns / 1000000000;
+    spec.it_value.tv_nsec = wake_ns % 1000000000;
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+void run_proxy(proxy_settings &settings)
+{
+    Randomiser randomiser(settings.seed);
+    auto &phases = settings.phases;
+    const int64_t start = now_ns();
+    const int64_t end = settings.duration == 0 ? INT64_MAX : start + (int64_t) settings.duration * 1000000000;
+    size_t current = 0;
+    int64_t next_report = start + proxy_constant::REPORT_INTERVAL_NS;
+    uint64_t reported_bytes = 0, reported_events = 0;
+    char buffer[game_constant::BUFFER_SIZE];
+    struct epoll_event events[proxy_constant::MAX_EPOLL_EVENTS];
+
+    while (true)
+    {
+        int64_t now = now_ns();
+        if (now >= next_report)
+        {
+            report_line(now - start, current, reported_bytes, reported_events);
+            reported_bytes = goodput_bytes;
+            reported_events = goodput_events;
+            next_report += proxy_constant::REPORT_INTERVAL_NS;
+        }
+        while (current + 1 < phases.size() && now - start >= phases[current + 1].start_ns)
+            current++;
+        while (pending.empty() == false && pending.top().at_ns <= now)
+        {
+            deliver(pending.top(), phases[current], now);
+            pending.pop();
+        }
+        if (now >= end)
+            break;
+
+        int64_t wake = std::min(next_report, end);
+        if (pending.empty() == false)
+            wake = std::min(wake, pending.top().at_ns);
+        if (current + 1 < phases.size())
+            wake = std::min(wake, start + phases[current + 1].start_ns);
+        arm_timer(wake);
+
+        const int ready = epoll_wait(epoll_fd, events, proxy_constant::MAX_EPOLL_EVENTS, -1);
+        if (ready < 0 && errno != EINTR)
+        {
+            std::cerr << "Epoll error." << std::endl;
+            exit(EXIT_FAILURE);
+        }
+
+        now = now_ns();
+        bool interrupted = false;
+        for (int i = 0; i < ready; ++i)
+        {
+            const int fd = events[i].data.fd;
+            if (fd == timer_fd)
+            {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) < 0)
+                    continue;
+            }
+            else if (fd == signal_fd)
+            {
+                interrupted = true;
+            }
+            else if (fd == listen_sock)
+            {
+                struct sockaddr_in6 address;
+                socklen_t address_len = sizeof(address);
+                ssize_t len;
+                while ((len = recvfrom(listen_sock, buffer, sizeof(buffer), MSG_DONTWAIT,
+                                       (struct sockaddr *) &address, &address_len)) >= 0)
+                {
+                    impair(up_link, phases[current].up, randomiser,
+                           {now, 0, find_session(address), false, std::string(buffer, len)});
+                    address_len = sizeof(address);
+                }
+            }
+            else
+            {
+                const size_t client = session_of_upstream[fd];
+                ssize_t len;
+                while ((len = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT)) >= 0)
+                    impair(down_link, phases[current].down, randomiser, {now, 0, client, true, std::string(buffer, len)});
+            }
+        }
+        if (interrupted)
+            break;
+    }
+
+    report_summary(phases, current, now_ns() - start);
+}
+
+int main(int argc, char *argv[])
+{
+    proxy_settings settings;
+    try
+    {
+        settings = get_proxy_settings(argc, argv);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        std::cerr << "Usage: " << argv[0] << " game_server [-p server_port] [-l listen_port] [-u impairments]"
+                  << " [-d impairments] [-f scenario_file] [-t seconds] [-s seed]" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    set_up(settings);
+    run_proxy(settings);
+    freeaddrinfo(server_address);
+}
@@ -0,0 +1,148 @@
+#include "memory_transport.h"
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+FrameQueue::FrameQueue(size_t capacity)
+{
+    size_t size = 1;
+    while (size < capacity)
+        size *= 2;
+    slots.resize(size);
+    mask = size - 1;
+}
+
+bool FrameQueue::push(const struct sockaddr_in6 &address, const char *data, size_t len)
+{
+    const size_t at = tail.load(std::memory_order_relaxed);
+    if (len > sizeof(frame::data) || at - head.load(std::memory_order_acquire) == slots.size())
+        return false;
+
+    frame &slot = slots[at & mask];
+    slot.address = address;
+    slot.len = len;
+    memcpy(slot.data, data, len);
+    tail.store(at + 1, std::memory_order_release);
+    return true;
+}
+
+const frame *FrameQueue::front()
+{
+    const size_t at = head.load(std::memory_order_relaxed);
+    if (at == tail.load(std::memory_order_acquire))
+        return nullptr;
+    return &slots[at & mask];
+}
+
+void FrameQueue::pop()
+{
+    head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+size_t FrameQueue::capacity() const
+{
+    return slots.size();
+}
+
+MemoryTransport::MemoryTransport(size_t clients, size_t to_server_capacity, size_t to_client_capacity)
+{
+    for (size_t i = 0; i < clients; ++i)
+    {
+        inbound.push_back(std::make_unique<FrameQueue>(to_server_capacity));
+        outbound.push_back(std::make_unique<FrameQueue>(to_client_capacity));
+    }
+}
+
+// Queues are ready from construction.
+void MemoryTransport::start()
+{
+}
+
+size_t MemoryTransport::receive(char *buffer, size_t size, struct sockaddr_in6 &from, int64_t &received_ns)
+{
+    while (true)
+    {
+        for (size_t checked = 0; checked < inbound.size(); ++checked)
+        {
+            FrameQueue &queue = *inbound[next_inbound];
+            next_inbound = next_inbound + 1 == inbound.size() ? 0 : next_inbound + 1;
+
+            const frame *got = queue.front();
+            if (got == nullptr)
+                continue;
+
+            const size_t len = std::min<size_t>(got->len, size);
+            memcpy(buffer, got->data, len);
+            from = got->address;
+            queue.pop();
+            received_ns = 0;
+            return len;
+        }
+        std::this_thread::yield();
+    }
+}
+
+size_t MemoryTransport::send(const struct sockaddr_in6 &to, const char *data, size_t len)
+{
+    uint32_t client;
+    memcpy(&client, to.sin6_addr.s6_addr + sizeof(to.sin6_addr) - sizeof(client), sizeof(client));
+    client = ntohl(client);
+    if (to.sin6_addr.s6_addr[0] != 0xfd || client >= outbound.size())
+        throw UDPError("Error on sending datagram to unknown virtual client.");
+
+    if (outbound[client]->push(to, data, len) == false)
+        dropped.fetch_add(1, std::memory_order_relaxed);
+    return len;
+}
+
+size_t MemoryTransport::send_burst(const struct sockaddr_in6 &to, const std::string &burst,
+                                   const std::vector<size_t> &ends)
+{
+    size_t sent = 0;
+    for (size_t i = 0; i < ends.size(); ++i)
+    {
+        const size_t start = i * game_constant::MAX_UDP_SIZE;
+        sent += send(to, burst.data() + start, ends[i] - start);
+    }
+    return sent;
+}
+
+uint32_t MemoryTransport::get_dropped()
+{
+    return dropped.load(std::memory_order_relaxed);
+}
+
+// Capacity of one client queue in each direction.
+std::pair<int, int> MemoryTransport::get_buffer_sizes()
+{
+    if (inbound.empty())
+        return {0, 0};
+    return {(int) (inbound[0]->capacity() * sizeof(frame)), (int) (outbound[0]->capacity() * sizeof(frame))};
+}
+
+size_t MemoryTransport::get_client_count() const
+{
+    return inbound.size();
+}
+
+struct sockaddr_in6 MemoryTransport::client_address(size_t client) const
+{
+    struct sockaddr_in6 address;
+    memset(&address, 0, sizeof(address));
+    address.sin6_family = AF_INET6;
+    address.sin6_port = htons(game_constant::DEFAULT_PORT);
+    address.sin6_addr.s6_addr[0] = 0xfd;
+    const uint32_t number = htonl(client);
+    memcpy(address.sin6_addr.s6_addr + sizeof(address.sin6_addr) - sizeof(number), &number, sizeof(number));
+    return address;
+}
+
+FrameQueue &MemoryTransport::to_server(size_t client)
+{
+    return *inbound[client];
+}
+
+FrameQueue &MemoryTransport::to_client(size_t client)
+{
+    return *outbound[client];
+}
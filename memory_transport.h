@@ -0,0 +1,94 @@
+#ifndef ROBALETHEGAME_MEMORY_TRANSPORT_H
+#define ROBALETHEGAME_MEMORY_TRANSPORT_H
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "game_constant.h"
+#include "transport.h"
+
+// Datagram with its address, as it waits in a queue.
+struct frame
+{
+    struct sockaddr_in6 address;
+    uint32_t len;
+    char data[game_constant::MAX_UDP_SIZE];
+};
+
+// Lock-free queue of frames for one producer thread and one consumer thread.
+class FrameQueue
+{
+    public:
+    FrameQueue() = delete;
+
+    // Capacity is rounded up to a power of two.
+    explicit FrameQueue(size_t capacity);
+
+    // Copy and move semantics are disabled.
+    FrameQueue(const FrameQueue &) = delete;
+    FrameQueue &operator=(const FrameQueue &) = delete;
+
+    // Returns false when the queue is full or the datagram does not fit into a frame.
+    bool push(const struct sockaddr_in6 &address, const char *data, size_t len);
+
+    // Oldest frame, nullptr when the queue is empty. It stays valid until pop.
+    const frame *front();
+
+    void pop();
+
+    [[nodiscard]] size_t capacity() const;
+
+    private:
+    std::vector<frame> slots;
+    size_t mask;
+    // Counters only grow, producer and consumer each write one of them.
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+};
+
+// Virtual clients of the server inside the process, each with a queue to the server and one from it.
+// Client i has address fd00::i, so sending needs no lookup. A full queue drops the datagram, as a full
+// socket buffer would.
+class MemoryTransport : public Transport
+{
+    public:
+    MemoryTransport() = delete;
+
+    MemoryTransport(size_t clients, size_t to_server_capacity, size_t to_client_capacity);
+
+    // Copy and move semantics are disabled.
+    MemoryTransport(const MemoryTransport &) = delete;
+    MemoryTransport &operator=(const MemoryTransport &) = delete;
+
+    void start() override;
+
+    // Polls queues of all clients in turn, yielding while all of them are empty.
+    size_t receive(char *buffer, size_t size, struct sockaddr_in6 &from, int64_t &received_ns) override;
+
+    size_t send(const struct sockaddr_in6 &to, const char *data, size_t len) override;
+
+    size_t send_burst(const struct sockaddr_in6 &to, const std::string &burst,
+                      const std::vector<size_t> &ends) override;
+
+    uint32_t get_dropped() override;
+
+    std::pair<int, int> get_buffer_sizes() override;
+
+    [[nodiscard]] size_t get_client_count() const;
+
+    [[nodiscard]] struct sockaddr_in6 client_address(size_t client) const;
+
+    // Client side: datagrams to the server are pushed, datagrams from it are read from front.
+    FrameQueue &to_server(size_t client);
+
+    FrameQueue &to_client(size_t client);
+
+    private:
+    std::vector<std::unique_ptr<FrameQueue>> inbound;
+    std::vector<std::unique_ptr<FrameQueue>> outbound;
+    // Next client queue polled by receive.
+    size_t next_inbound = 0;
+    std::atomic<uint32_t> dropped{0};
+};
+
+#endif //ROBALETHEGAME_MEMORY_TRANSPORT_H
@@ -0,0 +1,56 @@
+#ifndef ROBALETHEGAME_PHASE_TIMER_H
+#define ROBALETHEGAME_PHASE_TIMER_H
+#include <cstdint>
+#include <chrono>
+#include <thread>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Cycle counter read without a system call; on other architectures steady clock nanoseconds.
+inline uint64_t read_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>
+            (std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Ticks in one microsecond, measured against steady clock on first call, which sleeps 20 ms.
+inline uint64_t ticks_per_us()
+{
+    static const uint64_t rate = []
+    {
+        const auto clock_start = std::chrono::steady_clock::now();
+        const uint64_t ticks_start = read_ticks();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        const uint64_t ticks = read_ticks() - ticks_start;
+        const auto us = std::chrono::duration_cast<std::chrono::microseconds>
+                (std::chrono::steady_clock::now() - clock_start).count();
+        return us > 0 && ticks >= (uint64_t) us ? ticks / us : 1;
+    }();
+    return rate;
+}
+
+// Adds ticks from its construction to its destruction to a sum.
+class TickSpan
+{
+    public:
+    explicit TickSpan(uint64_t &_sum) : sum(_sum), start(read_ticks()) {};
+
+    TickSpan(const TickSpan &) = delete;
+    TickSpan &operator=(const TickSpan &) = delete;
+
+    ~TickSpan()
+    {
+        sum += read_ticks() - start;
+    }
+
+    private:
+    uint64_t &sum;
+    const uint64_t start;
+};
+
+#endif //ROBALETHEGAME_PHASE_TIMER_H
@@ -0,0 +1,294 @@
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <set>
+#include <thread>
+#include "game_constant.h"
+#include "event_record.h"
+#include "client_datagram.h"
+#include "UDP_server.h"
+
+// Spectator relay: joins game server (or another relay) as one spectator, keeps event log of the current
+// game and serves it to any number of downstream clients with the same protocol, catch-up included.
+// Usage: ./screen-worms-relay game_server [-p n] [-l n]
+
+namespace relay_constant
+{
+    const char RELAY_OPTSTRING[] = "p:l:";
+    const char LISTEN_PORT = 'l';
+    const size_t DEFAULT_LISTEN_PORT = game_constant::DEFAULT_PORT + 1;
+
+    const int MAX_EPOLL_EVENTS = 8;
+}
+
+// Auxiliary struct for holding relay settings.
+struct relay_settings
+{
+    std::string server_name;
+    size_t server_port = game_constant::DEFAULT_PORT;
+    size_t listen_port = relay_constant::DEFAULT_LISTEN_PORT;
+};
+
+int udp_sock, heartbeat_timer, epoll_fd;
+uint64_t session_id;
+
+// Event log of the current game, records kept whole as received.
+uint32_t current_game_id;
+bool in_game = false;
+std::set<uint32_t> previous_game_id;
+std::vector<std::string> event_log;
+// Log went on to downstream clients since the last heartbeat.
+bool log_sent = false;
+
+// Analyses input arguments.
+relay_settings get_relay_settings(int argc, char *argv[])
+{
+    const char OPT_UNKNOWN_SIGN = '?';
+    relay_settings result;
+
+    if (argc < 2)
+        throw game_constant::ArgumentException{};
+    result.server_name = argv[1];
+
+    int opt;
+    while ((opt = getopt(argc - 1, argv + 1, relay_constant::RELAY_OPTSTRING)) != -1)
+    {
+        if (opt == OPT_UNKNOWN_SIGN)
+            throw game_constant::WrongValueArgument{};
+
+        if (is_integer(optarg) == false || atol(optarg) < 0)
+            throw game_constant::NotNumberArgument{};
+        const size_t value = atol(optarg);
+        if (value < game_constant::MIN_PORT || value > game_constant::MAX_PORT)
+            throw game_constant::WrongValueArgument{};
+
+        switch (opt)
+        {
+            case game_constant::PORT:
+                result.server_port = value;
+                break;
+
+            case relay_constant::LISTEN_PORT:
+                result.listen_port = value;
+                break;
+        }
+    }
+
+    // Checks if all arguments were processed.
+    if (optind != argc - 1)
+    {
+        throw game_constant::ArgumentException{};
+    }
+
+    return result;
+}
+
+void watch(int fd)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+    {
+        std::cerr << "Epoll error." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Joins the game server as spectator.
+void set_up_upstream(const relay_settings &settings)
+{
+    struct addrinfo addr_hints;
+    struct addrinfo *addr_result;
+
+    memset(&addr_hints, 0, sizeof(struct addrinfo));
+    addr_hints.ai_family = AF_UNSPEC;
+    addr_hints.ai_socktype = SOCK_DGRAM;
+    addr_hints.ai_protocol = IPPROTO_UDP;
+    if (getaddrinfo(settings.server_name.c_str(), std::to_string(settings.server_port).c_str(),
+                    &addr_hints, &addr_result) != 0)
+    {
+        std::cerr << "Getaddrinfo error." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    udp_sock = socket(addr_result->ai_family, SOCK_DGRAM, 0);
+    if (udp_sock < 0 || connect(udp_sock, addr_result->ai_addr, addr_result->ai_addrlen) < 0)
+    {
+        std::cerr << "Socket error" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    freeaddrinfo(addr_result);
+
+    session_id = std::chrono::duration_cast<std::chrono::microseconds>
+            (std::chrono::system_clock::now().time_since_epoch()).count();
+    watch(udp_sock);
+
+    heartbeat_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_nsec = game_constant::INTEVAL_LENGTH_NS;
+    spec.it_interval.tv_nsec = game_constant::INTEVAL_LENGTH_NS;
+    timerfd_settime(heartbeat_timer, 0, &spec, NULL);
+    watch(heartbeat_timer);
+}
+
+// Appends events that continue the log, returns true if any was appended.
+bool extend_log(const char *buffer, size_t len)
+{
+    RecordReader reader(buffer, len);
+    uint32_t game_id;
+    if (reader.read_game_id(game_id) == false)
+        return false;
+
+    if (previous_game_id.insert(game_id).second)
+    {
+        current_game_id = game_id;
+        in_game = true;
+        event_log.clear();
+    }
+    if (game_id != current_game_id)
+        return false;
+
+    // Events beyond a gap are dropped, upstream resends from the first missing one.
+    const size_t old_size = event_log.size();
+    event_record record;
+    while (in_game && reader.next(record) == record_status::FINE)
+    {
+        if (record.event_no != event_log.size())
+            continue;
+
+        event_log.emplace_back(record.whole);
+        if (record.type == 3) // Game over.
+            in_game = false;
+    }
+    return event_log.size() > old_size;
+}
+
+// Upstream sends a datagram per turn and many of them while it resends after a loss, so the log goes on
+// to downstream clients once the socket is drained, and only when it grew.
+void receive_from_upstream(UDPServer &server)
+{
+    char buffer[game_constant::BUFFER_SIZE];
+    ssize_t len;
+    bool grew = false;
+    while ((len = recv(udp_sock, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+    {
+        if (extend_log(buffer, len))
+            grew = true;
+    }
+    if (grew)
+    {
+        server.send_datagram(event_log, current_game_id);
+        log_sent = true;
+    }
+}
+
+// Downstream clients behind get the log again once per heartbeat in which it did not grow, game over included.
+void send_to_upstream(UDPServer &server)
+{
+    uint64_t expirations;
+    if (read(heartbeat_timer, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return;
+
+    if (log_sent == false && event_log.empty() == false)
+        server.send_datagram(event_log, current_game_id);
+    log_sent = false;
+
+    char mess[game_constant::BUFFER_SIZE];
+    const uint32_t next_expected_event_no = in_game ? event_log.size() : 0;
+    const size_t len = build_client_datagram(mess, session_id, game_constant::FORWARD_TURN,
+                                             next_expected_event_no, "", 0);
+    send(udp_sock, mess, len, MSG_DONTWAIT);
+}
+
+// Takes datagrams of downstream clients, which only update where each of them is in the log.
+void receive_from_downstream(UDPServer &server)
+{
+    try
+    {
+        while (true)
+            server.receive_datagram();
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+void run_relay(UDPServer &server)
+{
+    std::chrono::time_point<std::chrono::steady_clock> last_check = std::chrono::steady_clock::now();
+    struct epoll_event events[relay_constant::MAX_EPOLL_EVENTS];
+    while (true)
+    {
+        int ready = epoll_wait(epoll_fd, events, relay_constant::MAX_EPOLL_EVENTS, -1);
+        for (int i = 0; i < ready; ++i)
+        {
+            if (events[i].data.fd == udp_sock)
+                receive_from_upstream(server);
+            else
+                send_to_upstream(server);
+        }
+
+        // Downstream clients silent for too long are forgotten as on the server.
+        const auto now = std::chrono::steady_clock::now();
+        if ((now - last_check).count() > game_constant::INTEVAL_LENGTH_NS)
+        {
+            server.check_sleepers();
+            last_check = now;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    relay_settings settings;
+    try
+    {
+        settings = get_relay_settings(argc, argv);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        std::cerr << "Usage: " << argv[0] << " game_server [-p server_port] [-l listen_port]" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    UDPServer server({{game_constant::PORT, settings.listen_port}});
+    try
+    {
+        server.start();
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    epoll_fd = epoll_create1(0);
+    set_up_upstream(settings);
+
+    std::thread downstream_receiver(receive_from_downstream, std::ref(server));
+    try
+    {
+        run_relay(server);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    downstream_receiver.join();
+}
@@ -2,11 +2,16 @@
 #include <cstdint>
 #include <unistd.h>
 #include <map>
+#include <deque>
+#include <memory>
+#include <atomic>
 #include <thread>
 #include "game_constant.h"
 #include "UDP_server.h"
 #include "game.h"
 #include "randomiser.h"
+#include "stats_server.h"
+#include "trace.h"
 
 // Analyses input arguments.
 std::map<char, uint32_t> get_game_settings(int argc, char *argv[])
@@ -73,6 +78,51 @@ std::map<char, uint32_t> get_game_settings(int argc, char *argv[])
                     throw game_constant::WrongValueArgument{};
                 break;
 
+            case game_constant::ROOM_SIZE:
+                if (game_constant::MIN_ROOM_SIZE <= argvalue
+                    && argvalue <= game_constant::MAX_ROOM_SIZE)
+                    game_settings[game_constant::ROOM_SIZE] = argvalue;
+                else
+                    throw game_constant::WrongValueArgument{};
+                break;
+
+            case game_constant::ADMIN_PORT:
+            case game_constant::STREAM_PORT:
+                if (argvalue == 0 || (game_constant::MIN_PORT <= argvalue && argvalue <= game_constant::MAX_PORT))
+                    game_settings[opt] = argvalue;
+                else
+                    throw game_constant::WrongValueArgument{};
+                break;
+
+            case game_constant::PACING:
+                if (argvalue <= game_constant::MAX_PACING)
+                    game_settings[game_constant::PACING] = argvalue;
+                else
+                    throw game_constant::WrongValueArgument{};
+                break;
+
+            case game_constant::RECEIVE_BUFFER:
+            case game_constant::SEND_BUFFER:
+                if (argvalue <= (uint32_t) std::numeric_limits<int>::max())
+                    game_settings[opt] = argvalue;
+                else
+                    throw game_constant::WrongValueArgument{};
+                break;
+
+            case game_constant::LOCKSTEP:
+                if (argvalue <= game_constant::MAX_LOCKSTEP_HASH_PERIOD)
+                    game_settings[game_constant::LOCKSTEP] = argvalue;
+                else
+                    throw game_constant::WrongValueArgument{};
+                break;
+
+            case game_constant::PREDICTION:
+                if (argvalue <= 1)
+                    game_settings[game_constant::PREDICTION] = argvalue;
+                else
+                    throw game_constant::WrongValueArgument{};
+                break;
+
             case OPT_UNKNOWN_SIGN:
                 throw game_constant::WrongValueArgument{};
         }
@@ -87,8 +137,29 @@ std::map<char, uint32_t> get_game_settings(int argc, char *argv[])
     return game_settings;
 }
 
+// Admin requests: "json" or any other line for stats, "trace ms" for spans of the next ms milliseconds.
+std::string answer_admin(UDPServer &server, const std::string &request)
+{
+    const std::string trace_request = "trace ";
+    if (request.compare(0, trace_request.size(), trace_request) == 0)
+    {
+        const std::string duration = request.substr(trace_request.size());
+        const int64_t ms = atol(duration.c_str());
+        if (is_integer(duration.c_str()) == false || duration.size() > 5 || ms < 0 || ms > game_constant::TRACE_MAX_MS)
+            return "Wrong trace duration.\n";
+
+        if (trace::start_capture() == false)
+            return "Trace already running.\n";
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+        return trace::stop_capture();
+    }
+    return server.get_report(request == "json");
+}
+
 // Global variable for game status.
 bool game_concluded;
+// Players acknowledged the end of the game, next one may be made.
+std::atomic<bool> players_finished;
 
 // Receives and analyses datagram from players.
 void receive_datagrams(UDPServer &server, Game &game, Randomiser &randomiser)
@@ -120,7 +191,8 @@ void receive_datagrams(UDPServer &server, Game &game, Randomiser &randomiser)
             continue;
 
         game.add_player(datagram.player_name);
-        game.set_direction(datagram.player_name, datagram.turn_direction);
+        trace::Span span("input");
+        game.set_direction(datagram.player_name, datagram.turn_direction, datagram.received_ns);
     }
 
     std::set<std::string> finish_players;
@@ -136,10 +208,13 @@ void receive_datagrams(UDPServer &server, Game &game, Randomiser &randomiser)
             game.add_player(datagram.player_name);
         }
 
+        // Clients following lockstep log count its events.
+        const uint32_t final_event = datagram.lockstep ? game.get_final_lockstep_event() : game.get_final_event();
         if (datagram.player_name.empty() == false
-            && datagram.next_expected_event_no == game.get_final_event())
+            && datagram.next_expected_event_no == final_event)
             finish_players.insert(datagram.player_name);
     }
+    players_finished = true;
 }
 
 // Moves players in equal time intervals with regard to their angle and position.
@@ -152,6 +227,7 @@ void make_turns(Game &game, std::map<char, uint32_t> settings, UDPServer &server
     {
         std::this_thread::sleep_for(std::chrono::milliseconds(50));
         server.check_sleepers();
+        server.serve_streams();
     }
 
     while (game_concluded == false)
@@ -162,6 +238,14 @@ void make_turns(Game &game, std::map<char, uint32_t> settings, UDPServer &server
 
         game_concluded = game.make_turn();
     }
+
+    // Turns no longer resend the log, so it goes out at their pace until players got its end.
+    while (players_finished == false)
+    {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(interval));
+        game.resend_log();
+        server.serve_streams();
+    }
 }
 
 int main(int argc, char *argv[])
@@ -180,9 +264,15 @@ int main(int argc, char *argv[])
 
     Randomiser randomiser(game_settings[game_constant::SEED]);
     UDPServer server(game_settings);
+    StatsServer admin;
     try
     {
         server.start();
+        if (game_settings[game_constant::ADMIN_PORT] != 0)
+            admin.start(game_settings[game_constant::ADMIN_PORT], [&server](const std::string &request)
+            {
+                return answer_admin(server, request);
+            });
     }
     catch (const std::exception &e)
     {
@@ -192,19 +282,28 @@ int main(int argc, char *argv[])
 
     try
     {
+        // Stream spectators are written straight from logs of the current game and the one before,
+        // which live until the game after next starts.
+        std::deque<std::unique_ptr<Game>> finished_games;
         while (true)
         {
-            Game game(game_settings, server);
+            auto game = std::make_unique<Game>(game_settings, server);
             game_concluded = true;
+            players_finished = false;
 
             std::thread datagram_receiver(receive_datagrams,
-                  std::ref(server), std::ref(game), std::ref(randomiser));
+                  std::ref(server), std::ref(*game), std::ref(randomiser));
 
             std::thread turns_maker(make_turns,
-                  std::ref(game), game_settings, std::ref(server));
+                  std::ref(*game), game_settings, std::ref(server));
 
             turns_maker.join();
             datagram_receiver.join();
+
+            std::cerr << server.get_telemetry();
+            finished_games.push_back(std::move(game));
+            if (finished_games.size() > 2)
+                finished_games.pop_front();
         }
     }
     catch (const std::exception &e)
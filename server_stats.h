@@ -0,0 +1,26 @@
+#ifndef ROBALETHEGAME_SERVER_STATS_H
+#define ROBALETHEGAME_SERVER_STATS_H
+#include <atomic>
+#include <cstdint>
+#include "histogram.h"
+
+// Turn phases in cycle counter ticks and totals of sending the event log. The server runs one room,
+// so these are the counters of that room.
+struct ServerStats
+{
+    Histogram check_sleepers;
+    Histogram movement;
+    Histogram collision;
+    Histogram serialization;
+    Histogram fan_out;
+    Histogram turn;
+
+    std::atomic<uint64_t> turns{0};
+    std::atomic<uint64_t> events{0};
+    std::atomic<uint64_t> datagrams{0};
+    std::atomic<uint64_t> bytes{0};
+    // Events sent again to a client that had them sent before.
+    std::atomic<uint64_t> resent_events{0};
+};
+
+#endif //ROBALETHEGAME_SERVER_STATS_H
@@ -0,0 +1,160 @@
+#include "socket_transport.h"
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/udp.h>
+#include "game_constant.h"
+
+// Commencing connection.
+void SocketTransport::start()
+{
+    con_socket = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (con_socket < 0)
+    {
+        throw UDPError("Error for UDP socket");
+    }
+
+    // Buffers are set before binding, the kernel doubles given sizes for its bookkeeping.
+    if ((receive_buffer != 0 && setsockopt(con_socket, SOL_SOCKET, SO_RCVBUF, &receive_buffer, sizeof(int)) < 0)
+        || (send_buffer != 0 && setsockopt(con_socket, SOL_SOCKET, SO_SNDBUF, &send_buffer, sizeof(int)) < 0))
+    {
+        throw UDPError("Error for UDP buffer size");
+    }
+
+    // Receive time and drop counter come with every datagram.
+    int flag = 1;
+    setsockopt(con_socket, SOL_SOCKET, SO_TIMESTAMPNS, &flag, sizeof(flag));
+    setsockopt(con_socket, SOL_SOCKET, SO_RXQ_OVFL, &flag, sizeof(flag));
+
+    struct sockaddr_in6 server_address;
+    memset(&server_address, 0, sizeof(server_address));
+    server_address.sin6_family = AF_INET6;
+    server_address.sin6_port = htons(port);
+    server_address.sin6_addr = in6addr_any;
+
+    if (bind(con_socket, (struct sockaddr *) &server_address, sizeof(server_address)) < 0)
+    {
+        throw UDPError("Error for UDP binding");
+    }
+
+    // Segment size is given with every burst, zero here only checks that the kernel knows the option.
+    int segment = 0;
+    gso_enabled = setsockopt(con_socket, SOL_UDP, UDP_SEGMENT, &segment, sizeof(segment)) == 0;
+}
+
+// Obtain single datagram.
+size_t SocketTransport::receive(char *buffer, size_t size, struct sockaddr_in6 &from, int64_t &received_ns)
+{
+    struct iovec iov = {buffer, size};
+    char control[CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32_t))];
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_name = &from;
+    message.msg_namelen = sizeof(from);
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    int flags = 0;
+    int len = recvmsg(con_socket, &message, flags);
+    if (len < 0)
+    {
+        throw UDPError("Error on datagram from client socket");
+    }
+
+    received_ns = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL; cmsg = CMSG_NXTHDR(&message, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            struct timespec stamp;
+            memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+            received_ns = (int64_t) stamp.tv_sec * 1000000000 + stamp.tv_nsec;
+        }
+        else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+        {
+            uint32_t drops;
+            memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+            dropped.store(drops, std::memory_order_relaxed);
+        }
+    }
+    return len;
+}
+
+size_t SocketTransport::send(const struct sockaddr_in6 &to, const char *data, size_t len)
+{
+    int flags = 0;
+    int snd_len = sendto(con_socket, data, len, flags, (struct sockaddr *) &to, (socklen_t) sizeof(to));
+    if (snd_len < 0)
+        throw UDPError("Error on sending datagram to client socket.");
+    return snd_len;
+}
+
+// The kernel splits datagrams of the burst when they go in one buffer.
+size_t SocketTransport::send_burst(const struct sockaddr_in6 &to, const std::string &burst,
+                                   const std::vector<size_t> &ends)
+{
+    if (gso_enabled && ends.size() > 1)
+    {
+        struct iovec iov = {(void *) burst.data(), burst.size()};
+        char control[CMSG_SPACE(sizeof(uint16_t))];
+        memset(control, 0, sizeof(control));
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_name = (void *) &to;
+        message.msg_namelen = sizeof(to);
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        const uint16_t segment_size = game_constant::MAX_UDP_SIZE;
+        memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+
+        if (sendmsg(con_socket, &message, 0) >= 0)
+            return burst.size();
+        // Route without checksum offload, datagrams go one by one from now on.
+        if (errno != EIO && errno != EINVAL && errno != ENOPROTOOPT)
+            throw UDPError("Error on sending datagram to client socket.");
+        gso_enabled = false;
+    }
+
+    size_t sent = 0;
+    for (size_t i = 0; i < ends.size(); ++i)
+    {
+        const size_t start = i * game_constant::MAX_UDP_SIZE;
+        sent += send(to, burst.data() + start, ends[i] - start);
+    }
+    return sent;
+}
+
+uint32_t SocketTransport::get_dropped()
+{
+    return dropped.load(std::memory_order_relaxed);
+}
+
+// Sizes are read back from the socket, as the kernel sees them.
+std::pair<int, int> SocketTransport::get_buffer_sizes()
+{
+    int receive_size = 0, send_size = 0;
+    socklen_t option_len = sizeof(int);
+    getsockopt(con_socket, SOL_SOCKET, SO_RCVBUF, &receive_size, &option_len);
+    option_len = sizeof(int);
+    getsockopt(con_socket, SOL_SOCKET, SO_SNDBUF, &send_size, &option_len);
+    return {receive_size, send_size};
+}
+
+// Desctructor shuts down connection.
+SocketTransport::~SocketTransport()
+{
+    if (con_socket >= 0)
+        close(con_socket);
+}
@@ -0,0 +1,47 @@
+#ifndef ROBALETHEGAME_SOCKET_TRANSPORT_H
+#define ROBALETHEGAME_SOCKET_TRANSPORT_H
+#include <atomic>
+#include <cstdint>
+#include "transport.h"
+
+// Datagrams through one kernel UDP socket, bound on all addresses.
+class SocketTransport : public Transport
+{
+    public:
+    SocketTransport() = delete;
+
+    // Buffer sizes of 0 leave the kernel defaults.
+    SocketTransport(uint32_t _port, int _receive_buffer, int _send_buffer)
+            : port(_port), receive_buffer(_receive_buffer), send_buffer(_send_buffer) {};
+
+    // Copy and move semantics are disabled.
+    SocketTransport(const SocketTransport &) = delete;
+    SocketTransport &operator=(const SocketTransport &) = delete;
+
+    void start() override;
+
+    size_t receive(char *buffer, size_t size, struct sockaddr_in6 &from, int64_t &received_ns) override;
+
+    size_t send(const struct sockaddr_in6 &to, const char *data, size_t len) override;
+
+    size_t send_burst(const struct sockaddr_in6 &to, const std::string &burst,
+                      const std::vector<size_t> &ends) override;
+
+    uint32_t get_dropped() override;
+
+    std::pair<int, int> get_buffer_sizes() override;
+
+    ~SocketTransport() override;
+
+    private:
+    int con_socket = -1;
+    uint32_t port;
+    int receive_buffer;
+    int send_buffer;
+    // Kernel counter of datagrams dropped on full receive buffer, as of the last datagram.
+    std::atomic<uint32_t> dropped{0};
+    // Datagrams of a burst go in one call with UDP_SEGMENT while the kernel takes it.
+    bool gso_enabled = false;
+};
+
+#endif //ROBALETHEGAME_SOCKET_TRANSPORT_H
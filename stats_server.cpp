@@ -0,0 +1,91 @@
+#include "stats_server.h"
+#include <cerrno>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include "game_constant.h"
+#include "transport.h"
+
+// Listens on IPv6 loopback only, reports are not for other machines.
+void StatsServer::start(uint32_t port, std::function<std::string(const std::string &)> answer)
+{
+    make_answer = std::move(answer);
+    listener = socket(AF_INET6, SOCK_STREAM, 0);
+    if (listener < 0)
+    {
+        throw UDPError("Error for stats socket");
+    }
+
+    int flag = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+
+    struct sockaddr_in6 address;
+    memset(&address, 0, sizeof(address));
+    address.sin6_family = AF_INET6;
+    address.sin6_port = htons(port);
+    address.sin6_addr = in6addr_loopback;
+    if (bind(listener, (struct sockaddr *) &address, sizeof(address)) < 0
+        || listen(listener, game_constant::STREAM_BACKLOG) < 0)
+    {
+        throw UDPError("Error for stats binding");
+    }
+
+    // Server runs until killed, so does the thread.
+    std::thread(&StatsServer::serve, this).detach();
+}
+
+// Clients over ADMIN_MAX_ANSWERING at a time are closed without answer.
+void StatsServer::serve()
+{
+    while (true)
+    {
+        const int fd = accept(listener, NULL, NULL);
+        if (fd < 0)
+        {
+            // Out of descriptors or memory the next accept fails as well, it waits until some are freed.
+            if (errno != EINTR && errno != ECONNABORTED)
+                std::this_thread::sleep_for(std::chrono::milliseconds(game_constant::ADMIN_ACCEPT_BACKOFF_MS));
+            continue;
+        }
+
+        if (answering.load() >= game_constant::ADMIN_MAX_ANSWERING)
+        {
+            close(fd);
+            continue;
+        }
+        answering++;
+        std::thread(&StatsServer::answer, this, fd).detach();
+    }
+}
+
+// A silent client is given a second to send its request.
+void StatsServer::answer(int fd)
+{
+    struct timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    char request[game_constant::BUFFER_SIZE];
+    size_t len = 0;
+    ssize_t got;
+    while (len < sizeof(request) && memchr(request, '\n', len) == nullptr
+           && (got = recv(fd, request + len, sizeof(request) - len, 0)) > 0)
+        len += got;
+
+    const char *line_end = (const char *) memchr(request, '\n', len);
+    const std::string report = make_answer(std::string(request, line_end != nullptr ? line_end - request : len));
+    size_t sent = 0;
+    while (sent < report.size())
+    {
+        const ssize_t written = send(fd, report.data() + sent, report.size() - sent, MSG_NOSIGNAL);
+        if (written <= 0)
+            break;
+        sent += written;
+    }
+    close(fd);
+    answering--;
+}
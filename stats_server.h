@@ -0,0 +1,33 @@
+#ifndef ROBALETHEGAME_STATS_SERVER_H
+#define ROBALETHEGAME_STATS_SERVER_H
+#include <cstdint>
+#include <string>
+#include <functional>
+#include <atomic>
+
+// Admin endpoint on loopback TCP: a client sends one request line and gets the answer
+// before the connection is closed.
+class StatsServer
+{
+    public:
+    StatsServer() = default;
+
+    // Copy and move semantics are disabled.
+    StatsServer(const StatsServer &) = delete;
+    StatsServer &operator=(const StatsServer &) = delete;
+
+    // Serves answers made by given function from request lines, from its own thread; each client
+    // is answered from a thread of its own, so a long trace does not hold up reports.
+    void start(uint32_t port, std::function<std::string(const std::string &)> answer);
+
+    private:
+    int listener = -1;
+    std::function<std::string(const std::string &)> make_answer;
+    std::atomic<int> answering{0};
+
+    void serve();
+
+    void answer(int fd);
+};
+
+#endif //ROBALETHEGAME_STATS_SERVER_H
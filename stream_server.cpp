@@ -0,0 +1,220 @@
+#include "stream_server.h"
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "transport.h"
+
+// Listens on both IPv4 and IPv6.
+void StreamServer::start(uint32_t port)
+{
+    listener = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listener < 0)
+    {
+        throw UDPError("Error for stream socket");
+    }
+
+    int flag = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+
+    struct sockaddr_in6 address;
+    memset(&address, 0, sizeof(address));
+    address.sin6_family = AF_INET6;
+    address.sin6_port = htons(port);
+    address.sin6_addr = in6addr_any;
+    if (bind(listener, (struct sockaddr *) &address, sizeof(address)) < 0
+        || listen(listener, game_constant::STREAM_BACKLOG) < 0)
+    {
+        throw UDPError("Error for stream binding");
+    }
+}
+
+void StreamServer::accept_clients()
+{
+    int fd;
+    while ((fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK)) >= 0)
+    {
+        // Frames of one turn are small, they should not wait for acknowledgement of previous ones.
+        int flag = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+        clients.push_back({fd, {}, 0, std::chrono::steady_clock::now(), false, 0, 0, std::string(), 0});
+    }
+}
+
+// Returns false if client left before sending whole handshake.
+bool StreamServer::read_handshake(stream_client &client)
+{
+    const ssize_t len = recv(client.fd, client.handshake + client.handshake_len,
+                             sizeof(client.handshake) - client.handshake_len, MSG_DONTWAIT);
+    if (len == 0 || (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+        return false;
+    if (len < 0)
+        return true;
+
+    client.handshake_len += len;
+    if (client.handshake_len == sizeof(client.handshake))
+    {
+        memcpy(&client.game_id, client.handshake, sizeof(client.game_id));
+        memcpy(&client.next_event, client.handshake + sizeof(client.game_id), sizeof(client.next_event));
+        client.game_id = ntohl(client.game_id);
+        client.next_event = ntohl(client.next_event);
+    }
+    return true;
+}
+
+// Log of a new game becomes the current one, the current one is kept as the log of the game before.
+void StreamServer::follow_log(const std::vector<std::string> &messages, uint32_t game_id)
+{
+    if (game_id != log_game_id)
+    {
+        previous_game_id = log_game_id;
+        previous_log = log;
+        log_game_id = game_id;
+    }
+    log = &messages;
+}
+
+// Writes frames of given game until the client has all of them or its socket is full, returns false on error.
+bool StreamServer::write_frames(stream_client &client, const std::vector<std::string> &messages, uint32_t game_id)
+{
+    client.following = true;
+    while (client.next_event < messages.size() && client.rest.empty())
+    {
+        const size_t frame_end = std::min(messages.size(), client.next_event + game_constant::STREAM_FRAME_EVENTS);
+
+        // Length - game_id, then records as they are in the log.
+        uint32_t header[2];
+        size_t frame_len = sizeof(header);
+        struct iovec iov[1 + game_constant::STREAM_FRAME_EVENTS];
+        iov[0] = {header, sizeof(header)};
+        size_t iov_len = 1;
+        for (size_t i = client.next_event; i < frame_end; ++i)
+        {
+            iov[iov_len++] = {(void *) messages[i].data(), messages[i].size()};
+            frame_len += messages[i].size();
+        }
+        header[0] = htonl(frame_len - sizeof(uint32_t));
+        header[1] = htonl(game_id);
+
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = iov;
+        message.msg_iovlen = iov_len;
+        const ssize_t len = sendmsg(client.fd, &message, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (len < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+
+        client.next_event = frame_end;
+        if ((size_t) len < frame_len)
+        {
+            size_t skip = len;
+            for (size_t i = 0; i < iov_len; ++i)
+            {
+                if (skip < iov[i].iov_len)
+                    client.rest.append((const char *) iov[i].iov_base + skip, iov[i].iov_len - skip);
+                skip -= std::min(skip, iov[i].iov_len);
+            }
+        }
+    }
+    return true;
+}
+
+// Writes what the client misses from the followed logs until its socket is full, returns false on error
+// or when the client fell more than a game behind.
+bool StreamServer::send_frames(stream_client &client)
+{
+    while (client.rest_sent < client.rest.size())
+    {
+        const ssize_t len = send(client.fd, client.rest.data() + client.rest_sent,
+                                 client.rest.size() - client.rest_sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (len < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        client.rest_sent += len;
+    }
+    client.rest.clear();
+    client.rest_sent = 0;
+
+    // Rest of the game before, game over included, goes first.
+    if (previous_log != nullptr && client.game_id == previous_game_id && client.game_id != log_game_id
+        && client.next_event < previous_log->size())
+    {
+        if (write_frames(client, *previous_log, previous_game_id) == false)
+            return false;
+        if (client.rest.empty() == false || client.next_event < previous_log->size())
+            return true;
+    }
+
+    // Asked for another game, or a new game started, events go from the first one.
+    if (client.game_id != log_game_id)
+    {
+        if (client.following && client.game_id != previous_game_id)
+            return false;
+        client.game_id = log_game_id;
+        client.next_event = 0;
+    }
+
+    return write_frames(client, *log, log_game_id);
+}
+
+// Accepts new clients, drops the ones silent for too long and writes the rest what they miss.
+void StreamServer::serve_clients()
+{
+    accept_clients();
+
+    const auto now = std::chrono::steady_clock::now();
+    auto client = clients.begin();
+    while (client != clients.end())
+    {
+        bool fine = true;
+        if (client->handshake_len < sizeof(client->handshake))
+            fine = read_handshake(*client) && (client->handshake_len == sizeof(client->handshake)
+                   || (now - client->accepted).count() <= game_constant::STREAM_HANDSHAKE_TIMEOUT_NS);
+        if (fine && client->handshake_len == sizeof(client->handshake) && log != nullptr
+            && log->empty() == false)
+            fine = send_frames(*client);
+
+        if (fine)
+        {
+            ++client;
+        }
+        else
+        {
+            close(client->fd);
+            client = clients.erase(client);
+        }
+    }
+}
+
+// Accepts new clients and writes them events they do not have yet, without blocking.
+void StreamServer::send_log(const std::vector<std::string> &messages, uint32_t game_id)
+{
+    if (listener < 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(clients_mutex);
+    follow_log(messages, game_id);
+    serve_clients();
+}
+
+// Between games no turn sends the log, spectators still get the rest of the followed ones.
+void StreamServer::serve()
+{
+    if (listener < 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(clients_mutex);
+    serve_clients();
+}
+
+StreamServer::~StreamServer()
+{
+    for (const auto &client: clients)
+        close(client.fd);
+    if (listener >= 0)
+        close(listener);
+}
@@ -0,0 +1,73 @@
+#ifndef ROBALETHEGAME_STREAM_SERVER_H
+#define ROBALETHEGAME_STREAM_SERVER_H
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include "game_constant.h"
+
+// Spectators reading events over TCP, written straight from the event log.
+// Each client sends game_id and next expected event number once, then gets the rest of that game
+// (or whole current game) and every following game in order. The log of the game before is followed
+// through the next game, so spectators behind at the end of a game still get the rest of it.
+class StreamServer
+{
+    public:
+    StreamServer() = default;
+
+    // Copy and move semantics are disabled.
+    StreamServer(const StreamServer &) = delete;
+    StreamServer &operator=(const StreamServer &) = delete;
+
+    void start(uint32_t port);
+
+    // Accepts new clients and writes them events they do not have yet, without blocking. Logs are
+    // referenced, not copied: a log passed here stays alive, only growing, until the log of the game
+    // after the next one is passed.
+    void send_log(const std::vector<std::string> &messages, uint32_t game_id);
+
+    // Same for times without turns, from the logs passed last.
+    void serve();
+
+    ~StreamServer();
+
+    private:
+    struct stream_client
+    {
+        int fd;
+        char handshake[game_constant::STREAM_HANDSHAKE_LENGTH];
+        size_t handshake_len;
+        std::chrono::steady_clock::time_point accepted;
+        // Frames were written to the client, it follows games in order from then on.
+        bool following;
+        uint32_t game_id;
+        uint32_t next_event;
+        // Part of frame the socket did not take, copied as the log may change before it is sent.
+        std::string rest;
+        size_t rest_sent;
+    };
+
+    int listener = -1;
+    std::vector<stream_client> clients;
+    std::mutex clients_mutex;
+    // Log of the current game and the log of the game before.
+    uint32_t log_game_id = 0;
+    const std::vector<std::string> *log = nullptr;
+    uint32_t previous_game_id = 0;
+    const std::vector<std::string> *previous_log = nullptr;
+
+    void accept_clients();
+
+    void follow_log(const std::vector<std::string> &messages, uint32_t game_id);
+
+    [[nodiscard]] bool read_handshake(stream_client &client);
+
+    [[nodiscard]] bool write_frames(stream_client &client, const std::vector<std::string> &messages, uint32_t game_id);
+
+    [[nodiscard]] bool send_frames(stream_client &client);
+
+    void serve_clients();
+};
+
+#endif //ROBALETHEGAME_STREAM_SERVER_H
@@ -0,0 +1,456 @@
+#include <iostream>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <chrono>
+#include <vector>
+#include <set>
+#include <string>
+#include <algorithm>
+#include "game_constant.h"
+#include "event_record.h"
+#include "client_datagram.h"
+#include "randomiser.h"
+
+// Synthetic client swarm for server load testing.
+// Simulates players and spectators from one process and reports their view of the server.
+// Usage: ./screen-worms-swarm game_server [-p n] [-n players] [-m spectators] [-d seconds] [-b steering] [-s seed]
+
+namespace swarm_constant
+{
+    const char SWARM_OPTSTRING[] = "p:n:m:d:b:s:";
+    const char PLAYERS = 'n';
+    const char SPECTATORS = 'm';
+    const char DURATION = 'd';
+    const char STEERING = 'b';
+    const char SEED = 's';
+
+    const size_t DEFAULT_PLAYERS = 100;
+    const size_t DEFAULT_SPECTATORS = 0;
+    const size_t DEFAULT_DURATION = 10;
+
+    // Resolution of heartbeat scheduling.
+    const uint32_t SCHEDULER_TICK_NS = 1000000;
+
+    // Datagrams further apart than this start a new burst, one burst per server turn.
+    const int64_t BURST_GAP_NS = 2000000;
+
+    // One in this many heartbeats of random steering picks new direction.
+    const uint32_t RANDOM_TURN_ODDS = 10;
+
+    const int MAX_EPOLL_EVENTS = 256;
+}
+
+enum class steering_mode
+{
+    RANDOM,
+    CIRCLE,
+    STRAIGHT
+};
+
+// Auxiliary struct for holding swarm settings.
+struct swarm_settings
+{
+    std::string server_name;
+    size_t port = game_constant::DEFAULT_PORT;
+    size_t players = swarm_constant::DEFAULT_PLAYERS;
+    size_t spectators = swarm_constant::DEFAULT_SPECTATORS;
+    size_t duration = swarm_constant::DEFAULT_DURATION;
+    steering_mode steering = steering_mode::RANDOM;
+    uint32_t seed = 1;
+};
+
+// State and statistics of one simulated client.
+struct bot_session
+{
+    int sock;
+    uint64_t session_id;
+    std::string player_name;
+    uint8_t turn_direction;
+    bool in_game;
+    uint32_t game_id;
+    uint32_t next_expected_event_no;
+
+    uint64_t bytes;
+    uint64_t datagrams;
+    uint64_t events;
+    uint64_t ahead;
+    uint64_t duplicates;
+    uint64_t bursts;
+    int64_t last_datagram_ns;
+    int64_t lag_sum_ns;
+    int64_t lag_max_ns;
+};
+
+std::vector<bot_session> sessions;
+std::set<uint32_t> previous_game_id;
+uint32_t current_game_id;
+size_t games_seen;
+// Time each event of current game first reached any session.
+std::vector<int64_t> first_seen_ns;
+
+int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>
+            (std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Analyses input arguments.
+swarm_settings get_swarm_settings(int argc, char *argv[])
+{
+    const char OPT_UNKNOWN_SIGN = '?';
+    swarm_settings result;
+    result.server_name = argv[1];
+
+    int opt;
+    while ((opt = getopt(argc - 1, argv + 1, swarm_constant::SWARM_OPTSTRING)) != -1)
+    {
+        if (opt == OPT_UNKNOWN_SIGN)
+            throw game_constant::WrongValueArgument{};
+
+        if (opt == swarm_constant::STEERING)
+        {
+            const std::string mode = optarg;
+            if (mode == "random")
+                result.steering = steering_mode::RANDOM;
+            else if (mode == "circle")
+                result.steering = steering_mode::CIRCLE;
+            else if (mode == "straight")
+                result.steering = steering_mode::STRAIGHT;
+            else
+                throw game_constant::WrongValueArgument{};
+            continue;
+        }
+
+        if (is_integer(optarg) == false || atol(optarg) < 0)
+            throw game_constant::NotNumberArgument{};
+        const size_t value = atol(optarg);
+
+        switch (opt)
+        {
+            case game_constant::PORT:
+                if (value < game_constant::MIN_PORT || value > game_constant::MAX_PORT)
+                    throw game_constant::WrongValueArgument{};
+                result.port = value;
+                break;
+
+            case swarm_constant::PLAYERS:
+                result.players = value;
+                break;
+
+            case swarm_constant::SPECTATORS:
+                result.spectators = value;
+                break;
+
+            case swarm_constant::DURATION:
+                result.duration = value;
+                break;
+
+            case swarm_constant::SEED:
+                result.seed = value;
+                break;
+        }
+    }
+
+    // Checks if all arguments were processed.
+    if (optind != argc - 1 || result.players + result.spectators == 0)
+    {
+        throw game_constant::ArgumentException{};
+    }
+
+    return result;
+}
+
+// Opens one UDP socket per session, server identifies clients by address.
+void set_up_sessions(const swarm_settings &settings)
+{
+    struct addrinfo addr_hints;
+    struct addrinfo *addr_result;
+
+    memset(&addr_hints, 0, sizeof(struct addrinfo));
+    addr_hints.ai_family = AF_UNSPEC;
+    addr_hints.ai_socktype = SOCK_DGRAM;
+    addr_hints.ai_protocol = IPPROTO_UDP;
+    if (getaddrinfo(settings.server_name.c_str(), std::to_string(settings.port).c_str(), &addr_hints, &addr_result) != 0)
+    {
+        std::cerr << "Getaddrinfo error." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // Every session needs its own descriptor.
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    const uint64_t base_session_id = std::chrono::duration_cast<std::chrono::microseconds>
+            (std::chrono::system_clock::now().time_since_epoch()).count();
+    sessions.resize(settings.players + settings.spectators);
+    for (size_t i = 0; i < sessions.size(); ++i)
+    {
+        auto &session = sessions[i];
+        session.sock = socket(addr_result->ai_family, SOCK_DGRAM, 0);
+        if (session.sock < 0 || connect(session.sock, addr_result->ai_addr, addr_result->ai_addrlen) < 0)
+        {
+            std::cerr << "Socket error for session " << i << "." << std::endl;
+            exit(EXIT_FAILURE);
+        }
+
+        session.session_id = base_session_id + i;
+        if (i < settings.players)
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "bot%05zu", i);
+            session.player_name = name;
+        }
+        session.turn_direction = game_constant::RIGHT_TURN;
+        session.in_game = false;
+        session.game_id = 0;
+        session.next_expected_event_no = 0;
+        session.bytes = session.datagrams = session.events = 0;
+        session.ahead = session.duplicates = session.bursts = 0;
+        session.last_datagram_ns = session.lag_sum_ns = session.lag_max_ns = 0;
+    }
+    freeaddrinfo(addr_result);
+}
+
+// Picks direction according to steering mode, players waiting for game keep turning to be ready.
+void steer(bot_session &session, steering_mode steering, Randomiser &randomiser)
+{
+    if (session.in_game == false || steering == steering_mode::CIRCLE)
+        session.turn_direction = game_constant::RIGHT_TURN;
+    else if (steering == steering_mode::STRAIGHT)
+        session.turn_direction = game_constant::FORWARD_TURN;
+    else if (randomiser.rand() % swarm_constant::RANDOM_TURN_ODDS == 0)
+        session.turn_direction = randomiser.rand() % 3;
+}
+
+void send_status(bot_session &session)
+{
+    char mess[game_constant::BUFFER_SIZE];
+    const size_t len = build_client_datagram(mess, session.session_id, session.turn_direction,
+                                             session.next_expected_event_no, session.player_name, 0);
+    // Full socket buffer only delays this heartbeat.
+    send(session.sock, mess, len, MSG_DONTWAIT);
+}
+
+// Follows events of one datagram the way client does, without GUI.
+void analyse_datagram(bot_session &session, const char *buffer, size_t len, int64_t now)
+{
+    session.bytes += len;
+    session.datagrams++;
+    if (now - session.last_datagram_ns > swarm_constant::BURST_GAP_NS)
+        session.bursts++;
+    session.last_datagram_ns = now;
+
+    RecordReader reader(buffer, len);
+    uint32_t game_id;
+    if (reader.read_game_id(game_id) == false)
+        return;
+
+    if (previous_game_id.find(game_id) == previous_game_id.end())
+    {
+        previous_game_id.insert(game_id);
+        current_game_id = game_id;
+        first_seen_ns.clear();
+        games_seen++;
+    }
+    if (session.in_game == false && game_id == current_game_id && game_id != session.game_id)
+    {
+        session.in_game = true;
+        session.game_id = game_id;
+        session.next_expected_event_no = 0;
+    }
+    if (session.in_game == false || game_id != session.game_id)
+        return;
+
+    event_record record;
+    while (reader.next(record) == record_status::FINE)
+    {
+        if (game_id == current_game_id)
+        {
+            if (record.event_no >= first_seen_ns.size())
+                first_seen_ns.resize(record.event_no + 1, 0);
+            if (first_seen_ns[record.event_no] == 0)
+                first_seen_ns[record.event_no] = now;
+        }
+
+        if (record.event_no < session.next_expected_event_no)
+        {
+            session.duplicates++;
+            continue;
+        }
+        if (record.event_no > session.next_expected_event_no)
+        {
+            session.ahead++;
+            continue;
+        }
+
+        session.events++;
+        if (game_id == current_game_id)
+        {
+            const int64_t lag = now - first_seen_ns[record.event_no];
+            session.lag_sum_ns += lag;
+            session.lag_max_ns = std::max(session.lag_max_ns, lag);
+        }
+
+        if (record.type == 3) // Game over.
+        {
+            session.in_game = false;
+            break;
+        }
+        session.next_expected_event_no++;
+    }
+}
+
+void receive_datagrams(bot_session &session)
+{
+    char buffer[game_constant::BUFFER_SIZE];
+    while (true)
+    {
+        ssize_t len = recv(session.sock, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (len < 0)
+            return;
+        analyse_datagram(session, buffer, len, now_ns());
+    }
+}
+
+void watch(int epoll_fd, int fd, uint64_t key)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u64 = key;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+    {
+        std::cerr << "Epoll error." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Sends heartbeats spread evenly over the interval and handles server datagrams.
+void run_swarm(const swarm_settings &settings)
+{
+    int epoll_fd = epoll_create1(0);
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (epoll_fd < 0 || timer_fd < 0)
+    {
+        std::cerr << "Epoll error." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    struct itimerspec period;
+    memset(&period, 0, sizeof(period));
+    period.it_value.tv_nsec = swarm_constant::SCHEDULER_TICK_NS;
+    period.it_interval.tv_nsec = swarm_constant::SCHEDULER_TICK_NS;
+    timerfd_settime(timer_fd, 0, &period, NULL);
+
+    const uint64_t timer_key = sessions.size();
+    watch(epoll_fd, timer_fd, timer_key);
+    for (size_t i = 0; i < sessions.size(); ++i)
+        watch(epoll_fd, sessions[i].sock, i);
+
+    Randomiser randomiser(settings.seed);
+    const int64_t start = now_ns();
+    const int64_t end = start + (int64_t) settings.duration * 1000000000;
+    uint64_t heartbeats_sent = 0;
+
+    struct epoll_event events[swarm_constant::MAX_EPOLL_EVENTS];
+    while (now_ns() < end)
+    {
+        int ready = epoll_wait(epoll_fd, events, swarm_constant::MAX_EPOLL_EVENTS, 100);
+        for (int i = 0; i < ready; ++i)
+        {
+            if (events[i].data.u64 != timer_key)
+            {
+                receive_datagrams(sessions[events[i].data.u64]);
+                continue;
+            }
+
+            uint64_t expirations;
+            if (read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+                continue;
+
+            // Session k sends at k / N of every interval.
+            const uint64_t due = (uint64_t) (now_ns() - start) * sessions.size() / game_constant::INTEVAL_LENGTH_NS;
+            for (; heartbeats_sent < due; ++heartbeats_sent)
+            {
+                auto &session = sessions[heartbeats_sent % sessions.size()];
+                steer(session, settings.steering, randomiser);
+                send_status(session);
+            }
+        }
+    }
+
+    close(timer_fd);
+    close(epoll_fd);
+}
+
+void report(const swarm_settings &settings)
+{
+    const double seconds = settings.duration;
+    std::vector<double> lag_means;
+    std::vector<double> tick_rates;
+    uint64_t total_bytes = 0, total_events = 0, total_ahead = 0, total_duplicates = 0;
+
+    for (size_t i = 0; i < sessions.size(); ++i)
+    {
+        const auto &session = sessions[i];
+        const double lag_mean_us = session.events ? session.lag_sum_ns / 1000.0 / session.events : 0;
+        lag_means.push_back(lag_mean_us);
+        tick_rates.push_back(session.bursts / seconds);
+        total_bytes += session.bytes;
+        total_events += session.events;
+        total_ahead += session.ahead;
+        total_duplicates += session.duplicates;
+
+        printf("session=%zu role=%s datagrams=%lu bytes_per_s=%.0f events=%lu ahead=%lu duplicates=%lu "
+               "lag_mean_us=%.1f lag_max_us=%.1f ticks_per_s=%.1f\n",
+               i, session.player_name.empty() ? "spectator" : "player", session.datagrams,
+               session.bytes / seconds, session.events, session.ahead, session.duplicates,
+               lag_mean_us, session.lag_max_ns / 1000.0, session.bursts / seconds);
+    }
+
+    std::sort(lag_means.begin(), lag_means.end());
+    std::sort(tick_rates.begin(), tick_rates.end());
+    printf("summary sessions=%zu players=%zu spectators=%zu games=%zu bytes_per_s=%.0f events_per_s=%.0f "
+           "ahead=%lu duplicates=%lu lag_p50_us=%.1f lag_p99_us=%.1f ticks_per_s=%.1f\n",
+           sessions.size(), settings.players, settings.spectators, games_seen, total_bytes / seconds,
+           total_events / seconds, total_ahead, total_duplicates, lag_means[lag_means.size() / 2],
+           lag_means[lag_means.size() * 99 / 100], tick_rates[tick_rates.size() / 2]);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0]
+                  << " game_server [-p n] [-n players] [-m spectators] [-d seconds] [-b random|circle|straight] [-s seed]"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    swarm_settings settings;
+    try
+    {
+        settings = get_swarm_settings(argc, argv);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    set_up_sessions(settings);
+    run_swarm(settings);
+    report(settings);
+}
@@ -0,0 +1,53 @@
+#include "tile_index.h"
+#include <algorithm>
+
+void TileIndex::reset(uint32_t width, uint32_t height)
+{
+    tiles_x = (width + game_constant::VIEWPORT_TILE - 1) / game_constant::VIEWPORT_TILE;
+    tiles_y = (height + game_constant::VIEWPORT_TILE - 1) / game_constant::VIEWPORT_TILE;
+    tile_events.assign((size_t) tiles_x * tiles_y, {});
+    global_events.clear();
+}
+
+void TileIndex::add_pixel(uint32_t event_no, const pixel &p)
+{
+    const size_t tile = (size_t) (p.y / game_constant::VIEWPORT_TILE) * tiles_x + p.x / game_constant::VIEWPORT_TILE;
+    if (tile < tile_events.size())
+        tile_events[tile].push_back(event_no);
+    else
+        global_events.push_back(event_no);
+}
+
+void TileIndex::add_global(uint32_t event_no)
+{
+    global_events.push_back(event_no);
+}
+
+// Appends numbers of events in [from, to) that are global or lie in tiles touching the viewport, ascending.
+void TileIndex::collect(uint32_t from, uint32_t to, const viewport &view, std::vector<uint32_t> &result) const
+{
+    const size_t first = result.size();
+    append_range(global_events, from, to, result);
+
+    if (view.left < view.right && view.top < view.bottom)
+    {
+        const uint32_t right = std::min(tiles_x, (view.right - 1) / game_constant::VIEWPORT_TILE + 1);
+        const uint32_t bottom = std::min(tiles_y, (view.bottom - 1) / game_constant::VIEWPORT_TILE + 1);
+        for (uint32_t y = view.top / game_constant::VIEWPORT_TILE; y < bottom; ++y)
+        {
+            for (uint32_t x = view.left / game_constant::VIEWPORT_TILE; x < right; ++x)
+                append_range(tile_events[(size_t) y * tiles_x + x], from, to, result);
+        }
+    }
+
+    std::sort(result.begin() + first, result.end());
+}
+
+// Events of one list are ascending, the range is found by binary search.
+void TileIndex::append_range(const std::vector<uint32_t> &events, uint32_t from, uint32_t to,
+                             std::vector<uint32_t> &result)
+{
+    const auto begin = std::lower_bound(events.begin(), events.end(), from);
+    const auto end = std::lower_bound(begin, events.end(), to);
+    result.insert(result.end(), begin, end);
+}
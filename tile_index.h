@@ -0,0 +1,42 @@
+#ifndef ROBALETHEGAME_TILE_INDEX_H
+#define ROBALETHEGAME_TILE_INDEX_H
+#include <cstdint>
+#include <vector>
+#include "game_constant.h"
+
+// Watched part of board, right and bottom edge excluded.
+struct viewport
+{
+    uint32_t left;
+    uint32_t top;
+    uint32_t right;
+    uint32_t bottom;
+};
+
+// Numbers of events in the log grouped by board tile of their pixel.
+// Events without pixel are needed by every client and kept apart.
+class TileIndex
+{
+    public:
+    TileIndex() = default;
+
+    void reset(uint32_t width, uint32_t height);
+
+    void add_pixel(uint32_t event_no, const pixel &p);
+
+    void add_global(uint32_t event_no);
+
+    // Appends numbers of events in [from, to) that are global or lie in tiles touching the viewport, ascending.
+    void collect(uint32_t from, uint32_t to, const viewport &view, std::vector<uint32_t> &result) const;
+
+    private:
+    uint32_t tiles_x{};
+    uint32_t tiles_y{};
+    std::vector<std::vector<uint32_t>> tile_events;
+    std::vector<uint32_t> global_events;
+
+    static void append_range(const std::vector<uint32_t> &events, uint32_t from, uint32_t to,
+                             std::vector<uint32_t> &result);
+};
+
+#endif //ROBALETHEGAME_TILE_INDEX_H
@@ -0,0 +1,181 @@
+#include "trace.h"
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "game_constant.h"
+
+namespace trace
+{
+    std::atomic<bool> enabled{false};
+
+    namespace
+    {
+        // Span kept field by field in relaxed atomics, readers copy it while its owner may write it again.
+        struct slot
+        {
+            std::atomic<const char *> name;
+            std::atomic<uint64_t> start;
+            std::atomic<uint64_t> end;
+            std::atomic<uint32_t> arg;
+
+            void store(const span &s)
+            {
+                name.store(s.name, std::memory_order_relaxed);
+                start.store(s.start, std::memory_order_relaxed);
+                end.store(s.end, std::memory_order_relaxed);
+                arg.store(s.arg, std::memory_order_relaxed);
+            }
+
+            span load() const
+            {
+                return {name.load(std::memory_order_relaxed), start.load(std::memory_order_relaxed),
+                        end.load(std::memory_order_relaxed), arg.load(std::memory_order_relaxed)};
+            }
+        };
+
+        // Written only by its owner thread, which clears it on the first span of a new capture;
+        // head counts spans written in the capture, started the ones begun, the ring keeps the newest.
+        struct ring
+        {
+            uint32_t tid;
+            std::atomic<uint64_t> generation{0};
+            std::atomic<uint64_t> head{0};
+            std::atomic<uint64_t> started{0};
+            slot spans[game_constant::TRACE_RING_SPANS];
+        };
+
+        std::mutex rings_mutex;
+        std::vector<std::unique_ptr<ring>> rings;
+        std::vector<ring *> free_rings;
+        // Captures go one at a time, the next one gets a new generation.
+        std::atomic<bool> capturing{false};
+        std::atomic<uint64_t> capture_generation{0};
+        uint64_t capture_start;
+
+        // Threads of a game end with it, their rings go to the threads of the next one with spans kept.
+        struct ring_owner
+        {
+            ring *owned = nullptr;
+
+            ring *get()
+            {
+                if (owned != nullptr)
+                    return owned;
+
+                std::lock_guard<std::mutex> lock(rings_mutex);
+                if (free_rings.empty() == false)
+                {
+                    owned = free_rings.back();
+                    free_rings.pop_back();
+                }
+                else
+                {
+                    rings.push_back(std::make_unique<ring>());
+                    owned = rings.back().get();
+                    owned->tid = rings.size();
+                }
+                return owned;
+            }
+
+            ~ring_owner()
+            {
+                if (owned == nullptr)
+                    return;
+
+                std::lock_guard<std::mutex> lock(rings_mutex);
+                free_rings.push_back(owned);
+            }
+        };
+
+        thread_local ring_owner local_ring;
+
+        void append_json(std::string &result, const span &s, uint32_t tid, uint64_t tick_unit)
+        {
+            // Chrome trace takes microseconds, fractions keep nanoseconds.
+            auto micros = [tick_unit](uint64_t ticks)
+            {
+                const uint64_t ns = ticks * 1000 / tick_unit;
+                const std::string fraction = std::to_string(1000 + ns % 1000);
+                return std::to_string(ns / 1000) + "." + fraction.substr(1);
+            };
+
+            if (result.back() != '[')
+                result += ",";
+            result += "{\"name\":\"" + std::string(s.name) + "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                      + std::to_string(tid) + ",\"ts\":" + micros(s.start - capture_start)
+                      + ",\"dur\":" + micros(s.end - s.start)
+                      + ",\"args\":{\"n\":" + std::to_string(s.arg) + "}}";
+        }
+    }
+
+    void record(const span &s)
+    {
+        ring *own = local_ring.get();
+        const uint64_t generation = capture_generation.load(std::memory_order_acquire);
+        if (own->generation.load(std::memory_order_relaxed) != generation)
+        {
+            own->head.store(0, std::memory_order_relaxed);
+            own->started.store(0, std::memory_order_relaxed);
+            own->generation.store(generation, std::memory_order_release);
+        }
+
+        // Readers drop copies of slots begun to be written again while they read them.
+        const uint64_t head = own->head.load(std::memory_order_relaxed);
+        own->started.store(head + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        own->spans[head % game_constant::TRACE_RING_SPANS].store(s);
+        own->head.store(head + 1, std::memory_order_release);
+    }
+
+    bool start_capture()
+    {
+        if (capturing.exchange(true))
+            return false;
+
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        capture_start = read_ticks();
+        capture_generation.fetch_add(1, std::memory_order_release);
+        enabled.store(true, std::memory_order_relaxed);
+        return true;
+    }
+
+    std::string stop_capture()
+    {
+        const uint64_t tick_unit = ticks_per_us();
+        enabled.store(false, std::memory_order_relaxed);
+        // Spans started before this point end shortly.
+        std::this_thread::sleep_for(std::chrono::milliseconds(game_constant::TRACE_SETTLE_MS));
+
+        std::unique_lock<std::mutex> lock(rings_mutex);
+        const uint64_t generation = capture_generation.load(std::memory_order_relaxed);
+        std::string result = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        std::vector<span> copied;
+        for (const auto &own: rings)
+        {
+            // Rings without spans of this capture keep ones of an earlier capture.
+            if (own->generation.load(std::memory_order_acquire) != generation)
+                continue;
+
+            const uint64_t head = own->head.load(std::memory_order_acquire);
+            const uint64_t first = head > game_constant::TRACE_RING_SPANS ? head - game_constant::TRACE_RING_SPANS : 0;
+            copied.clear();
+            for (uint64_t i = first; i < head; ++i)
+                copied.push_back(own->spans[i % game_constant::TRACE_RING_SPANS].load());
+
+            // Span i is written again as span i + TRACE_RING_SPANS, its copy is kept only if that was not begun.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const uint64_t started = own->started.load(std::memory_order_relaxed);
+            for (uint64_t i = first; i < head; ++i)
+            {
+                const span &s = copied[i - first];
+                if (i + game_constant::TRACE_RING_SPANS >= started && s.start >= capture_start)
+                    append_json(result, s, own->tid, tick_unit);
+            }
+        }
+        lock.unlock();
+
+        capturing.store(false);
+        return result + "]}\n";
+    }
+}
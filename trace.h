@@ -0,0 +1,58 @@
+#ifndef ROBALETHEGAME_TRACE_H
+#define ROBALETHEGAME_TRACE_H
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include "phase_timer.h"
+
+// Spans of the server pipeline captured on demand. Each thread writes its spans into its own ring,
+// which keeps the newest ones, without locks; the capture is dumped in Chrome trace JSON format.
+namespace trace
+{
+    struct span
+    {
+        const char *name;
+        uint64_t start;
+        uint64_t end;
+        uint32_t arg;
+    };
+
+    extern std::atomic<bool> enabled;
+
+    void record(const span &s);
+
+    // Starts recording into rings cleared by their threads, returns false when a capture is running.
+    [[nodiscard]] bool start_capture();
+
+    // Stops recording and returns spans recorded since start_capture.
+    std::string stop_capture();
+
+    // Records time from its construction to its destruction when tracing was on at construction.
+    class Span
+    {
+        public:
+        explicit Span(const char *_name, uint32_t _arg = 0)
+                : name(_name), arg(_arg), start(enabled.load(std::memory_order_relaxed) ? read_ticks() : 0) {};
+
+        Span(const Span &) = delete;
+        Span &operator=(const Span &) = delete;
+
+        void set_arg(uint32_t _arg)
+        {
+            arg = _arg;
+        }
+
+        ~Span()
+        {
+            if (start != 0)
+                record({name, start, read_ticks(), arg});
+        }
+
+        private:
+        const char *name;
+        uint32_t arg;
+        const uint64_t start;
+    };
+}
+
+#endif //ROBALETHEGAME_TRACE_H
@@ -0,0 +1,44 @@
+#ifndef ROBALETHEGAME_TRANSPORT_H
+#define ROBALETHEGAME_TRANSPORT_H
+#include <netinet/in.h>
+#include <stdexcept>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Exception for errors of transport and servers built on it.
+class UDPError: public std::runtime_error
+{
+    public:
+    UDPError(const char *w) : std::runtime_error(w) {}
+};
+
+// Carrier of datagrams between UDPServer and its clients: the kernel UDP socket or in-process queues.
+class Transport
+{
+    public:
+    virtual ~Transport() = default;
+
+    virtual void start() = 0;
+
+    // Waits for next datagram and returns its length. Receive time is in nanoseconds of CLOCK_REALTIME,
+    // 0 if unknown.
+    virtual size_t receive(char *buffer, size_t size, struct sockaddr_in6 &from, int64_t &received_ns) = 0;
+
+    // Sends one datagram, returns number of bytes sent.
+    virtual size_t send(const struct sockaddr_in6 &to, const char *data, size_t len) = 0;
+
+    // Sends datagrams written at multiples of MAX_UDP_SIZE in burst, each ending at its entry of ends.
+    // Returns number of bytes sent.
+    virtual size_t send_burst(const struct sockaddr_in6 &to, const std::string &burst,
+                              const std::vector<size_t> &ends) = 0;
+
+    // Datagrams lost on full receive buffer or queues.
+    virtual uint32_t get_dropped() = 0;
+
+    // Receive and send buffer sizes in bytes.
+    virtual std::pair<int, int> get_buffer_sizes() = 0;
+};
+
+#endif //ROBALETHEGAME_TRANSPORT_H
@@ -0,0 +1,308 @@
+#include "worm_prediction.h"
+#include <algorithm>
+
+// Clears board of new game and stops prediction of previous one.
+void WormPrediction::reset(uint32_t _width, uint32_t _height)
+{
+    stop();
+    // Pixels of previous game are gone with its board.
+    unconfirmed.clear();
+    width = _width;
+    height = _height;
+    eaten_pixels.assign((size_t) width * height, false);
+}
+
+// Starts from start pixel and angle, now is arrival of the start pixel.
+void WormPrediction::start(uint32_t _turning, uint32_t rounds_per_sec, const pixel &start_pixel, int32_t angle,
+                           int64_t now_ns)
+{
+    turning = _turning;
+    turn_ns = int64_t(1e9) / rounds_per_sec;
+    anchor_ns = now_ns;
+    // Lead found in previous game is kept, round trip rarely changes between games.
+    anchored = false;
+    drop_drawn();
+    checkpoints.clear();
+
+    mover.names.assign(1, std::string());
+    mover.prepare();
+    mover.alive[0] = 1;
+
+    // Placed as in Game::start, turn 0 moves worm without drawing.
+    worm_state state{};
+    state.x = game_constant::CENTRE + start_pixel.x;
+    state.y = game_constant::CENTRE + start_pixel.y;
+    state.angle = angle;
+    state.pixel_x = (int32_t) start_pixel.x;
+    state.pixel_y = (int32_t) start_pixel.y;
+    state.turn = -1;
+    step(state, lead_ns);
+    checkpoints.push_back(state);
+    running = true;
+}
+
+void WormPrediction::stop()
+{
+    running = false;
+    drop_drawn();
+}
+
+bool WormPrediction::active() const
+{
+    return running;
+}
+
+int64_t WormPrediction::turn_length_ns() const
+{
+    return turn_ns;
+}
+
+// Direction carried by datagram sent to the server.
+void WormPrediction::add_input(uint8_t direction, int64_t sent_ns)
+{
+    // Before start datagrams are kept for as long as they may still reach the game.
+    if (running == false)
+    {
+        const auto current = std::find_if(inputs.begin(), inputs.end(), [sent_ns](const input &sent)
+        {
+            return sent.sent_ns >= sent_ns - game_constant::MAX_PREDICTION_LEAD_NS;
+        });
+        inputs.erase(inputs.begin(), current);
+    }
+    // Repeated direction changes nothing once the previous one surely reached the game.
+    else if (inputs.empty() == false && inputs.back().direction == direction
+             && turn_of(inputs.back().sent_ns, 0) >= 1)
+    {
+        return;
+    }
+
+    inputs.push_back({sent_ns, direction});
+}
+
+// Pixel eaten according to the server.
+void WormPrediction::mark_eaten(const pixel &p)
+{
+    const size_t index = (size_t) p.y * width + p.x;
+    if (index < eaten_pixels.size())
+        eaten_pixels[index] = true;
+}
+
+// Own pixel from the server, returns true if it has already been drawn.
+bool WormPrediction::confirm(const pixel &p, int64_t now_ns)
+{
+    if (running == false)
+        return false;
+
+    if (explains(checkpoints.size() - 1, p, lead_ns))
+    {
+        commit(checkpoints.size() - 1, now_ns);
+        if (drawn.empty() == false && drawn.front() == p)
+        {
+            drawn.pop_front();
+            return true;
+        }
+        drop_drawn();
+        return false;
+    }
+
+    // Pixels drawn with wrong lead are erased. Leads close to the current one are tried
+    // first, each with the longest run of the newest confirmed pixels it explains.
+    drop_drawn();
+    const int64_t lead_step = std::max<int64_t>(1, turn_ns / game_constant::PREDICTION_LEAD_STEPS_PER_TURN);
+    const int64_t last_step = steps + game_constant::PREDICTION_SEARCH_STEPS;
+    const size_t oldest = checkpoints.size()
+                          - std::min(checkpoints.size(), game_constant::PREDICTION_SEARCH_CHECKPOINTS);
+    for (int64_t delta = 0; delta <= game_constant::MAX_PREDICTION_LEAD_NS && steps < last_step; delta += lead_step)
+    {
+        for (const int64_t lead: {lead_ns - delta, lead_ns + delta})
+        {
+            if (lead < 0 || lead > game_constant::MAX_PREDICTION_LEAD_NS)
+                continue;
+
+            size_t from = oldest;
+            while (from < checkpoints.size() && explains(from, p, lead) == false)
+                from++;
+            if (from == checkpoints.size())
+                continue;
+
+            // Lead found is at the edge of leads explaining the server, middle of them within
+            // a turn on each side is less likely to miss the next direction change.
+            int64_t low = lead, high = lead;
+            while (low - lead_step >= std::max<int64_t>(0, lead - turn_ns) && explains(from, p, low - lead_step))
+                low -= lead_step;
+            while (high + lead_step <= std::min(game_constant::MAX_PREDICTION_LEAD_NS, lead + turn_ns)
+                   && explains(from, p, high + lead_step))
+                high += lead_step;
+
+            lead_ns = low + (high - low) / 2 / lead_step * lead_step;
+            explains(from, p, lead_ns);
+            commit(from, now_ns);
+            return false;
+        }
+    }
+
+    // No lead within the search explains the server, worm is drawn from events only.
+    stop();
+    return false;
+}
+
+// Appends pixels predicted up to now which were not drawn yet.
+void WormPrediction::advance(int64_t now_ns, std::vector<pixel> &to_draw)
+{
+    if (running == false)
+        return;
+
+    worm_state state = checkpoints.back();
+    const int64_t last_turn = std::min(turn_of(now_ns, lead_ns),
+                                       state.turn + game_constant::MAX_PREDICTION_LEAD_NS / turn_ns + 1);
+    size_t matched = 0;
+    while (state.turn < last_turn)
+    {
+        const uint8_t result = step(state, lead_ns);
+        if (result == worm_storage_constant::STAYED)
+            continue;
+
+        const pixel p((uint32_t) state.pixel_x, (uint32_t) state.pixel_y);
+        if (matched < drawn.size())
+        {
+            if ((drawn[matched] == p) == false)
+                return;
+            matched++;
+            continue;
+        }
+
+        // Collisions are left for the server to decide.
+        if (result == worm_storage_constant::OUT_OF_BOARD || eaten_pixels[(size_t) p.y * width + p.x]
+            || std::find(drawn.begin(), drawn.end(), p) != drawn.end())
+            return;
+
+        drawn.push_back(p);
+        to_draw.push_back(p);
+        matched++;
+    }
+}
+
+// Moves out drawn pixels the server did not confirm and nobody ate, to be erased.
+void WormPrediction::take_unconfirmed(std::vector<pixel> &to_erase)
+{
+    for (const auto &p: unconfirmed)
+        if (eaten_pixels[(size_t) p.y * width + p.x] == false)
+            to_erase.push_back(p);
+    unconfirmed.clear();
+}
+
+// First turn applying direction sent at given time.
+int64_t WormPrediction::turn_of(int64_t sent_ns, int64_t lead) const
+{
+    const int64_t shifted = sent_ns + lead - anchor_ns;
+    int64_t turn = shifted / turn_ns;
+    if (shifted % turn_ns != 0 && shifted < 0)
+        turn--;
+    return turn + 1;
+}
+
+// Directions reaching the game before its start are lost, as in Game::set_direction.
+uint8_t WormPrediction::direction_in(int64_t turn, int64_t lead) const
+{
+    uint8_t direction = game_constant::FORWARD_TURN;
+    for (const auto &sent: inputs)
+    {
+        const int64_t applied = turn_of(sent.sent_ns, lead);
+        if (applied > turn)
+            break;
+        if (applied >= 1)
+            direction = sent.direction;
+    }
+    return direction;
+}
+
+// Moves worm by one turn with server code.
+uint8_t WormPrediction::step(worm_state &state, int64_t lead)
+{
+    steps++;
+    state.turn++;
+    mover.x[0] = state.x;
+    mover.y[0] = state.y;
+    mover.angle[0] = state.angle;
+    mover.pixel_x[0] = state.pixel_x;
+    mover.pixel_y[0] = state.pixel_y;
+    mover.direction[0] = direction_in(state.turn, lead);
+    mover.move_all(turning, width, height);
+
+    state.x = mover.x[0];
+    state.y = mover.y[0];
+    state.angle = mover.angle[0];
+    state.pixel_x = mover.pixel_x[0];
+    state.pixel_y = mover.pixel_y[0];
+    return mover.move_result[0];
+}
+
+// Moves worm to its next pixel, false if it leaves the board or does not move.
+bool WormPrediction::next_pixel(worm_state &state, int64_t lead, pixel &p)
+{
+    for (int64_t i = 0; i < game_constant::PREDICTION_TURNS_PER_PIXEL; ++i)
+    {
+        const uint8_t result = step(state, lead);
+        if (result == worm_storage_constant::STAYED)
+            continue;
+
+        p = pixel((uint32_t) state.pixel_x, (uint32_t) state.pixel_y);
+        return result == worm_storage_constant::MOVED;
+    }
+    return false;
+}
+
+// Repeats confirmed pixels after checkpoint with given lead, true if they lead to p.
+bool WormPrediction::explains(size_t from, const pixel &p, int64_t lead)
+{
+    replayed.clear();
+    worm_state state = checkpoints[from];
+    pixel next(0u, 0u);
+    for (size_t i = from + 1; i < checkpoints.size(); ++i)
+    {
+        if (next_pixel(state, lead, next) == false || next.x != (uint32_t) checkpoints[i].pixel_x
+            || next.y != (uint32_t) checkpoints[i].pixel_y)
+            return false;
+        replayed.push_back(state);
+    }
+
+    if (next_pixel(state, lead, next) == false || (next == p) == false)
+        return false;
+
+    replayed.push_back(state);
+    return true;
+}
+
+// Keeps states of last successful replay as checkpoints.
+void WormPrediction::commit(size_t from, int64_t now_ns)
+{
+    checkpoints.resize(from + 1);
+    checkpoints.insert(checkpoints.end(), replayed.begin(), replayed.end());
+    while (checkpoints.size() > game_constant::PREDICTION_CHECKPOINTS)
+        checkpoints.pop_front();
+
+    // Events of a turn leave the server together, their arrival times the turn.
+    const int64_t sample = now_ns - checkpoints.back().turn * turn_ns;
+    anchor_ns = anchored ? anchor_ns + (sample - anchor_ns) / game_constant::PREDICTION_ANCHOR_WEIGHT : sample;
+    anchored = true;
+
+    prune_inputs();
+}
+
+// Gives up pixels drawn ahead of the server.
+void WormPrediction::drop_drawn()
+{
+    unconfirmed.insert(unconfirmed.end(), drawn.begin(), drawn.end());
+    drawn.clear();
+}
+
+// Drops inputs overridden before the oldest checkpoint whatever the lead.
+void WormPrediction::prune_inputs()
+{
+    size_t overridden = 0;
+    const int64_t oldest_turn = checkpoints.front().turn;
+    while (overridden + 1 < inputs.size()
+           && turn_of(inputs[overridden + 1].sent_ns, game_constant::MAX_PREDICTION_LEAD_NS) <= oldest_turn)
+        overridden++;
+    inputs.erase(inputs.begin(), inputs.begin() + overridden);
+}
@@ -0,0 +1,105 @@
+#ifndef ROBALETHEGAME_WORM_PREDICTION_H
+#define ROBALETHEGAME_WORM_PREDICTION_H
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include "game_constant.h"
+#include "worm_storage.h"
+
+// Player's own worm moved locally by the server's rules, ahead of server events.
+// Turns are numbered as on the server, turn 0 eats start pixels.
+// Direction sent at time t is applied from turn floor((t + lead - anchor) / turn length) + 1,
+// anchor follows arrivals of own pixels and lead (round trip) is searched on mismatch.
+class WormPrediction
+{
+    public:
+    WormPrediction() = default;
+
+    // Clears board of new game and stops prediction of previous one.
+    void reset(uint32_t width, uint32_t height);
+
+    // Starts from start pixel and angle, now is arrival of the start pixel.
+    void start(uint32_t turning, uint32_t rounds_per_sec, const pixel &start_pixel, int32_t angle,
+               int64_t now_ns);
+
+    void stop();
+
+    [[nodiscard]] bool active() const;
+
+    [[nodiscard]] int64_t turn_length_ns() const;
+
+    // Direction carried by datagram sent to the server.
+    void add_input(uint8_t direction, int64_t sent_ns);
+
+    // Pixel eaten according to the server.
+    void mark_eaten(const pixel &p);
+
+    // Own pixel from the server, returns true if it has already been drawn.
+    bool confirm(const pixel &p, int64_t now_ns);
+
+    // Appends pixels predicted up to now which were not drawn yet.
+    void advance(int64_t now_ns, std::vector<pixel> &to_draw);
+
+    // Moves out drawn pixels the server did not confirm and nobody ate, to be erased.
+    void take_unconfirmed(std::vector<pixel> &to_erase);
+
+    private:
+    // Worm after given turn.
+    struct worm_state
+    {
+        double x;
+        double y;
+        int32_t angle;
+        int32_t pixel_x;
+        int32_t pixel_y;
+        int64_t turn;
+    };
+
+    struct input
+    {
+        int64_t sent_ns;
+        uint8_t direction;
+    };
+
+    bool running{};
+    uint32_t width{};
+    uint32_t height{};
+    uint32_t turning{};
+    int64_t turn_ns{};
+    int64_t anchor_ns{};
+    bool anchored{};
+    int64_t lead_ns{};
+    // Moves made by step, bounds the lead search.
+    int64_t steps{};
+
+    // States reached by confirmed pixels, last one is the newest.
+    std::deque<worm_state> checkpoints;
+    // States after checkpoint reached by the last replay.
+    std::vector<worm_state> replayed;
+    std::vector<input> inputs;
+    // Pixels drawn ahead of the server, oldest first.
+    std::deque<pixel> drawn;
+    // Drawn pixels given up before the server confirmed them.
+    std::vector<pixel> unconfirmed;
+    std::vector<bool> eaten_pixels;
+    // Single worm moved with server code.
+    WormStorage mover;
+
+    [[nodiscard]] int64_t turn_of(int64_t sent_ns, int64_t lead) const;
+
+    [[nodiscard]] uint8_t direction_in(int64_t turn, int64_t lead) const;
+
+    uint8_t step(worm_state &state, int64_t lead);
+
+    bool next_pixel(worm_state &state, int64_t lead, pixel &p);
+
+    bool explains(size_t from, const pixel &p, int64_t lead);
+
+    void commit(size_t from, int64_t now_ns);
+
+    void prune_inputs();
+
+    void drop_drawn();
+};
+
+#endif //ROBALETHEGAME_WORM_PREDICTION_H
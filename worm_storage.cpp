@@ -0,0 +1,189 @@
+#include "worm_storage.h"
+#include <cmath>
+#include <cstring>
+#include "game_constant.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(WORMS_NO_SIMD)
+#include <immintrin.h>
+#define WORM_STORAGE_X86 1
+#endif
+
+namespace
+{
+    // Angles stay within (-FULL_ROTATE, FULL_ROTATE), tables are shifted by ANGLE_OFFSET.
+    const int32_t ANGLE_OFFSET = game_constant::FULL_ROTATE - 1;
+    const size_t ANGLE_TABLE_SIZE = 2 * game_constant::FULL_ROTATE - 1;
+
+    // Precomputed unit moves for every integer angle.
+    struct move_tables
+    {
+        double cos_tab[ANGLE_TABLE_SIZE];
+        double sin_tab[ANGLE_TABLE_SIZE];
+
+        move_tables()
+        {
+            for (size_t i = 0; i < ANGLE_TABLE_SIZE; ++i)
+            {
+                const long angle = (long) i - ANGLE_OFFSET;
+                cos_tab[i] = std::cos(game_constant::RADIAN_RATIO * angle);
+                sin_tab[i] = std::sin(game_constant::RADIAN_RATIO * angle);
+            }
+        }
+    };
+
+    const move_tables tables;
+
+    bool avx2_available()
+    {
+#ifdef WORM_STORAGE_X86
+        static const bool available = __builtin_cpu_supports("avx2");
+        return available;
+#else
+        return false;
+#endif
+    }
+}
+
+// Players joining mid-game only extend names, they are not moved until next prepare.
+size_t WormStorage::size() const
+{
+    return alive.size();
+}
+
+// Allocates hot arrays for every named worm.
+void WormStorage::prepare()
+{
+    const size_t n = names.size();
+    x.assign(n, 0);
+    y.assign(n, 0);
+    angle.assign(n, 0);
+    pixel_x.assign(n, 0);
+    pixel_y.assign(n, 0);
+    direction.assign(n, game_constant::FORWARD_TURN);
+    alive.assign(n, 0);
+    move_result.assign(n, worm_storage_constant::STAYED);
+}
+
+// Moves every alive worm by one and turns it, fills move_result.
+void WormStorage::move_all(uint32_t turning, uint32_t width, uint32_t height)
+{
+    size_t vector_end = 0;
+    if (avx2_available())
+    {
+        vector_end = size() - size() % 4;
+        move_range_avx2(0, vector_end, turning, width, height);
+    }
+    move_range_scalar(vector_end, size(), turning, width, height);
+}
+
+void WormStorage::move_range_scalar(size_t from, size_t to, int32_t turning, int32_t width, int32_t height)
+{
+    for (size_t i = from; i < to; ++i)
+    {
+        if (alive[i] == 0)
+        {
+            move_result[i] = worm_storage_constant::STAYED;
+            continue;
+        }
+
+        x[i] += tables.cos_tab[angle[i] + ANGLE_OFFSET];
+        y[i] += tables.sin_tab[angle[i] + ANGLE_OFFSET];
+
+        angle[i] -= direction[i] == game_constant::LEFT_TURN ? turning : 0;
+        angle[i] += direction[i] == game_constant::RIGHT_TURN ? turning : 0;
+        angle[i] %= game_constant::FULL_ROTATE;
+
+        const auto new_x = (int32_t) x[i];
+        const auto new_y = (int32_t) y[i];
+        if (new_x == pixel_x[i] && new_y == pixel_y[i])
+        {
+            move_result[i] = worm_storage_constant::STAYED;
+            continue;
+        }
+
+        pixel_x[i] = new_x;
+        pixel_y[i] = new_y;
+        // Positions in (-1, 0) truncate onto the board, as pixel conversion always did.
+        if (x[i] <= -1 || y[i] <= -1 || new_x >= width || new_y >= height)
+            move_result[i] = worm_storage_constant::OUT_OF_BOARD;
+        else
+            move_result[i] = worm_storage_constant::MOVED;
+    }
+}
+
+#ifdef WORM_STORAGE_X86
+__attribute__((target("avx2")))
+void WormStorage::move_range_avx2(size_t from, size_t to, int32_t turning, int32_t width, int32_t height)
+{
+    const __m128i offset = _mm_set1_epi32(ANGLE_OFFSET);
+    const __m128i turn = _mm_set1_epi32(turning);
+    const __m128i left = _mm_set1_epi32(game_constant::LEFT_TURN);
+    const __m128i right = _mm_set1_epi32(game_constant::RIGHT_TURN);
+    const __m128i full = _mm_set1_epi32(game_constant::FULL_ROTATE);
+    const __m128i full_minus_one = _mm_set1_epi32(game_constant::FULL_ROTATE - 1);
+    const __m128i minus_full_plus_one = _mm_set1_epi32(1 - game_constant::FULL_ROTATE);
+    const __m128i minus_one = _mm_set1_epi32(-1);
+    const __m128i max_x = _mm_set1_epi32(width);
+    const __m128i max_y = _mm_set1_epi32(height);
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i zero = _mm_setzero_si128();
+
+    for (size_t i = from; i < to; i += 4)
+    {
+        int32_t packed;
+        memcpy(&packed, &alive[i], sizeof(packed));
+        const __m128i alive_mask = _mm_cmpgt_epi32(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed)), zero);
+        memcpy(&packed, &direction[i], sizeof(packed));
+        const __m128i dir = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed));
+
+        // Move by one in current direction.
+        __m128i ang = _mm_load_si128((const __m128i *) &angle[i]);
+        const __m128i index = _mm_add_epi32(ang, offset);
+        const __m256d alive_wide = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(alive_mask));
+        const __m256d dx = _mm256_mask_i32gather_pd(_mm256_setzero_pd(), tables.cos_tab, index, alive_wide, 8);
+        const __m256d dy = _mm256_mask_i32gather_pd(_mm256_setzero_pd(), tables.sin_tab, index, alive_wide, 8);
+        const __m256d new_x = _mm256_add_pd(_mm256_load_pd(&x[i]), dx);
+        const __m256d new_y = _mm256_add_pd(_mm256_load_pd(&y[i]), dy);
+        _mm256_store_pd(&x[i], new_x);
+        _mm256_store_pd(&y[i], new_y);
+
+        // Turn and keep angle in (-FULL_ROTATE, FULL_ROTATE) like truncating modulo does.
+        __m128i delta = _mm_sub_epi32(_mm_and_si128(_mm_cmpeq_epi32(dir, right), turn),
+                                      _mm_and_si128(_mm_cmpeq_epi32(dir, left), turn));
+        ang = _mm_add_epi32(ang, _mm_and_si128(delta, alive_mask));
+        ang = _mm_sub_epi32(ang, _mm_and_si128(_mm_cmpgt_epi32(ang, full_minus_one), full));
+        ang = _mm_add_epi32(ang, _mm_and_si128(_mm_cmplt_epi32(ang, minus_full_plus_one), full));
+        _mm_store_si128((__m128i *) &angle[i], ang);
+
+        // Pixel change and bounds check.
+        const __m128i px = _mm256_cvttpd_epi32(new_x);
+        const __m128i py = _mm256_cvttpd_epi32(new_y);
+        const __m128i old_px = _mm_load_si128((const __m128i *) &pixel_x[i]);
+        const __m128i old_py = _mm_load_si128((const __m128i *) &pixel_y[i]);
+        const __m128i stayed = _mm_and_si128(_mm_cmpeq_epi32(px, old_px), _mm_cmpeq_epi32(py, old_py));
+        const __m128i moved = _mm_andnot_si128(stayed, alive_mask);
+
+        const __m256d low = _mm256_set1_pd(-1);
+        const __m128i below = _mm_or_si128(
+                _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(_mm256_castpd_si256(
+                        _mm256_cmp_pd(new_x, low, _CMP_LE_OQ)), _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7))),
+                _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(_mm256_castpd_si256(
+                        _mm256_cmp_pd(new_y, low, _CMP_LE_OQ)), _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7))));
+        const __m128i beyond = _mm_or_si128(_mm_cmpgt_epi32(px, _mm_add_epi32(max_x, minus_one)),
+                                            _mm_cmpgt_epi32(py, _mm_add_epi32(max_y, minus_one)));
+        const __m128i out = _mm_and_si128(_mm_or_si128(below, beyond), moved);
+
+        _mm_store_si128((__m128i *) &pixel_x[i], _mm_blendv_epi8(old_px, px, moved));
+        _mm_store_si128((__m128i *) &pixel_y[i], _mm_blendv_epi8(old_py, py, moved));
+
+        const __m128i result = _mm_add_epi32(_mm_and_si128(moved, one), _mm_and_si128(out, one));
+        packed = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packus_epi32(result, zero), zero));
+        memcpy(&move_result[i], &packed, sizeof(packed));
+    }
+}
+#else
+void WormStorage::move_range_avx2(size_t from, size_t to, int32_t turning, int32_t width, int32_t height)
+{
+    move_range_scalar(from, to, turning, width, height);
+}
+#endif
@@ -0,0 +1,91 @@
+#ifndef ROBALETHEGAME_WORM_STORAGE_H
+#define ROBALETHEGAME_WORM_STORAGE_H
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace worm_storage_constant
+{
+    // Alignment of hot arrays (one AVX2 register).
+    const size_t ARRAY_ALIGNMENT = 32;
+
+    // Result of moving single worm in one turn.
+    const uint8_t STAYED = 0;
+    const uint8_t MOVED = 1;
+    const uint8_t OUT_OF_BOARD = 2;
+}
+
+// Allocator giving arrays aligned for vector loads.
+template <typename T>
+struct aligned_allocator
+{
+    using value_type = T;
+
+    aligned_allocator() = default;
+
+    template <typename U>
+    aligned_allocator(const aligned_allocator<U> &) {};
+
+    T *allocate(size_t n)
+    {
+        size_t bytes = n * sizeof(T);
+        bytes = (bytes + worm_storage_constant::ARRAY_ALIGNMENT - 1) / worm_storage_constant::ARRAY_ALIGNMENT
+                * worm_storage_constant::ARRAY_ALIGNMENT;
+        void *ptr = std::aligned_alloc(worm_storage_constant::ARRAY_ALIGNMENT, bytes);
+        if (ptr == nullptr)
+            throw std::bad_alloc();
+        return static_cast<T *>(ptr);
+    }
+
+    void deallocate(T *ptr, size_t)
+    {
+        std::free(ptr);
+    }
+
+    template <typename U>
+    bool operator==(const aligned_allocator<U> &) const { return true; }
+
+    template <typename U>
+    bool operator!=(const aligned_allocator<U> &) const { return false; }
+};
+
+template <typename T>
+using aligned_vector = std::vector<T, aligned_allocator<T>>;
+
+// Per-worm state kept as structure of arrays.
+// Hot arrays are walked every turn, names are only needed for lookups and NEW_GAME.
+class WormStorage
+{
+    public:
+    WormStorage() = default;
+
+    // Cold side table, index is the player number.
+    std::vector<std::string> names;
+
+    aligned_vector<double> x;
+    aligned_vector<double> y;
+    aligned_vector<int32_t> angle;
+    aligned_vector<int32_t> pixel_x;
+    aligned_vector<int32_t> pixel_y;
+    aligned_vector<uint8_t> direction;
+    aligned_vector<uint8_t> alive;
+    aligned_vector<uint8_t> move_result;
+
+    // Number of worms prepared for current game.
+    size_t size() const;
+
+    // Allocates hot arrays for every named worm.
+    void prepare();
+
+    // Moves every alive worm by one and turns it, fills move_result.
+    void move_all(uint32_t turning, uint32_t width, uint32_t height);
+
+    private:
+    void move_range_scalar(size_t from, size_t to, int32_t turning, int32_t width, int32_t height);
+
+    void move_range_avx2(size_t from, size_t to, int32_t turning, int32_t width, int32_t height);
+};
+
+#endif //ROBALETHEGAME_WORM_STORAGE_H